@@ -0,0 +1,110 @@
+#include <assert.h>
+#include "log.h"
+#include "mem.h"
+#include "arena.h"
+
+// all blocks are aligned to this many bytes
+#define ARENA_ALIGN 8
+
+// a chunk of memory in an Arena
+struct ArenaChunk {
+  struct ArenaChunk* next;   // next (newer) chunk
+  unsigned used;             // bytes already handed out
+  unsigned cap;              // bytes available in data
+  unsigned char data[];      // the memory itself
+};
+
+static struct ArenaChunk* chunk_create(Arena* arena, unsigned cap);
+
+void arena_build(Arena* arena, unsigned chunk_size) {
+  arena->chunks = 0;
+  arena->current = 0;
+  arena->chunk_size = chunk_size;
+}
+
+void arena_destroy(Arena* arena) {
+  while (arena->chunks) {
+    struct ArenaChunk* chunk = arena->chunks;
+    arena->chunks = chunk->next;
+    FREE(chunk);
+  }
+  arena->current = 0;
+}
+
+void arena_reset(Arena* arena) {
+#if ARENA_DEBUG
+  arena_destroy(arena);
+#else
+  // chunks after the first one get their used count reset when reached
+  arena->current = arena->chunks;
+  if (arena->current) arena->current->used = 0;
+#endif
+}
+
+void* arena_alloc(Arena* arena, unsigned bytes) {
+  bytes = (bytes + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+#if ARENA_DEBUG
+  struct ArenaChunk* chunk = chunk_create(arena, bytes);
+#else
+  struct ArenaChunk* chunk = arena->current;
+  if (!chunk || chunk->used + bytes > chunk->cap) {
+    // reuse the next chunk, left over from before a reset, if it is big enough
+    struct ArenaChunk* next = chunk ? chunk->next : 0;
+    if (next && next->cap >= bytes) {
+      next->used = 0;
+      chunk = next;
+    } else {
+      chunk = chunk_create(arena, bytes > arena->chunk_size ? bytes : arena->chunk_size);
+    }
+    arena->current = chunk;
+  }
+#endif
+  void* block = chunk->data + chunk->used;
+  chunk->used += bytes;
+  memset(block, 0, bytes);
+  return block;
+}
+
+void* arena_grow(Arena* arena, void* table, unsigned cap, unsigned size, unsigned min) {
+  if (cap != 0 && (cap < min || (cap & (cap - 1)) != 0)) return table;
+  unsigned room = cap ? 2 * cap : min;
+  void* grown = arena_alloc(arena, room * size);
+  if (cap) memcpy(grown, table, cap * size);
+  return grown;
+}
+
+unsigned long arena_size(Arena* arena) {
+  unsigned long size = 0;
+  for (struct ArenaChunk* chunk = arena->chunks; chunk != 0; chunk = chunk->next) {
+    size += chunk->cap;
+  }
+  return size;
+}
+
+unsigned long arena_used(Arena* arena) {
+  unsigned long used = 0;
+  for (struct ArenaChunk* chunk = arena->chunks; chunk != 0; chunk = chunk->next) {
+    used += chunk->used;
+#if !ARENA_DEBUG
+    // chunks after the current one are left over from before a reset
+    if (chunk == arena->current) break;
+#endif
+  }
+  return used;
+}
+
+// create a new chunk and link it right after the current one
+static struct ArenaChunk* chunk_create(Arena* arena, unsigned cap) {
+  struct ArenaChunk* chunk = 0;
+  MALLOC_S(struct ArenaChunk*, chunk, sizeof(struct ArenaChunk) + cap);
+  chunk->cap = cap;
+  if (arena->current) {
+    chunk->next = arena->current->next;
+    arena->current->next = chunk;
+  } else {
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+  }
+  LOG_DEBUG("arena %p: new chunk with %u bytes", (void*) arena, cap);
+  return chunk;
+}
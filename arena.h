@@ -0,0 +1,45 @@
+#pragma once
+
+// an Arena hands out memory carved out of big chunks; nothing is freed
+// individually, the whole arena is reset or released at once
+//
+// when built with ARENA_DEBUG=1, every block gets its own malloc'ed chunk, so
+// that tools such as valgrind can check each block on its own
+#ifndef ARENA_DEBUG
+#define ARENA_DEBUG 0
+#endif
+
+typedef struct Arena {
+  struct ArenaChunk* chunks; // list of chunks, oldest first
+  struct ArenaChunk* current;// chunk currently handing out memory
+  unsigned chunk_size;       // minimum size for new chunks
+} Arena;
+
+// check if a table held in an arena is full; if so, double its size
+// assumes min is a power of 2, so that it is easy to check for fullness
+#define ARENA_TABLE_GROW(arena, tab, cap, min, T) \
+  do { \
+    tab = (T*) arena_grow(arena, tab, cap, sizeof(T), min); \
+  } while (0)
+
+// Build an empty arena, that will grow in chunks of (at least) a given size.
+void arena_build(Arena* arena, unsigned chunk_size);
+
+// Release all the memory held by an arena.
+void arena_destroy(Arena* arena);
+
+// Forget all blocks handed out by an arena, keeping its chunks for reuse.
+void arena_reset(Arena* arena);
+
+// Get a block of zeroed memory of a given size from an arena.
+void* arena_alloc(Arena* arena, unsigned bytes);
+
+// Make room for one more element in a table with cap elements of a given size.
+// If the table is full, return a copy with twice the room (at least min).
+void* arena_grow(Arena* arena, void* table, unsigned cap, unsigned size, unsigned min);
+
+// Return the number of bytes held by an arena.
+unsigned long arena_size(Arena* arena);
+
+// Return the number of bytes handed out by an arena since it was last reset.
+unsigned long arena_used(Arena* arena);
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "mem.h"
+#include "buffer.h"
+#include "timer.h"
+#include "tomita.h"
+
+// an ambiguous expression grammar, so that each sentence takes a while
+#define GRAMMAR_EXPR \
+  "Expr : Expr '-' Expr | Expr '*' Expr | digit ;" \
+  "'-'; '*';" \
+  "digit = '0' '1' '2' '3' '4' '5' '6' '7' '8' '9';"
+
+// number of operands in each sentence
+#define OPERANDS 16
+
+// Time parsing the same batch of sentences with a growing number of threads.
+int main(int argc, char* argv[]) {
+  unsigned count = argc > 1 ? (unsigned) atoi(argv[1]) : 2048;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned max = argc > 2 ? (unsigned) atoi(argv[2]) : (cores > 4 ? cores : 4);
+  Tomita* tomita = tomita_create(0, 0);
+  Buffer text; buffer_build(&text);
+  Slice* inputs = 0;
+  unsigned* errors = 0;
+  MALLOC_N(Slice, inputs, count);
+  MALLOC_N(unsigned, errors, count);
+  do {
+    unsigned failed = tomita_grammar_compile_from_slice(tomita, slice_from_string(GRAMMAR_EXPR, 0));
+    if (!failed) failed = tomita_parser_build_from_grammar(tomita);
+    if (failed) {
+      printf("could not build parser for [%s]\n", GRAMMAR_EXPR);
+      break;
+    }
+
+    // all sentences go into one buffer, and get sliced once it is complete
+    unsigned* offsets = errors;
+    for (unsigned s = 0; s < count; ++s) {
+      offsets[s] = text.len;
+      for (unsigned j = 0; j < OPERANDS; ++j) {
+        if (j) buffer_append_string(&text, (s + j) % 3 ? " - " : " * ", 0);
+        buffer_append_byte(&text, '0' + (s + j) % 10);
+      }
+    }
+    for (unsigned s = 0; s < count; ++s) {
+      unsigned end = s + 1 < count ? offsets[s + 1] : text.len;
+      inputs[s] = slice_from_memory(text.ptr + offsets[s], end - offsets[s]);
+    }
+
+    printf("%d cores, %u sentences with %u operands\n", (int) cores, count, OPERANDS);
+    printf("%8s %12s %12s %8s\n", "threads", "us", "sentences/s", "speedup");
+    unsigned long base = 0;
+    for (unsigned threads = 1; threads <= max; threads *= 2) {
+      Timer timer;
+      timer_start(&timer);
+      failed = tomita_parse_batch(tomita, inputs, count, threads, errors, 0, 0);
+      timer_stop(&timer);
+      if (failed) {
+        printf("could not parse %u sentences\n", failed);
+        break;
+      }
+      unsigned long us = timer_elapsed_us(&timer);
+      if (!us) us = 1;
+      if (!base) base = us;
+      printf("%8u %12lu %12.0f %8.2f\n", threads, us, count * 1e6 / us, (double) base / us);
+    }
+  } while (0);
+  FREE(errors);
+  FREE(inputs);
+  buffer_destroy(&text);
+  tomita_destroy(tomita);
+  return 0;
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "buffer.h"
+#include "timer.h"
+#include "symtab.h"
+#include "grammar.h"
+#include "parser.h"
+#include "forest.h"
+
+// a deliberately ambiguous grammar: the number of parses of n words grows
+// like the Catalan numbers, and every vertex in the stack has many edges
+#define GRAMMAR_AMBIGUOUS "E : E E | a ; a ;"
+
+// Time parsing sentences of increasing length with an ambiguous grammar.
+int main(int argc, char* argv[]) {
+  unsigned max = argc > 1 ? (unsigned) atoi(argv[1]) : 64;
+  SymTab* symtab = symtab_create();
+  Grammar* grammar = grammar_create(symtab);
+  Parser* parser = parser_create(symtab);
+  Forest* forest = forest_create(parser, 0, 0);
+  Buffer text; buffer_build(&text);
+  do {
+    unsigned errors = grammar_compile_from_slice(grammar, slice_from_string(GRAMMAR_AMBIGUOUS, 0));
+    if (!errors) errors = parser_build_from_grammar(parser, grammar);
+    if (errors) {
+      printf("could not build parser for [%s]\n", GRAMMAR_AMBIGUOUS);
+      break;
+    }
+
+    printf("%8s %12s %10s %10s %10s\n", "words", "us", "nodes", "vertices", "reductions");
+    for (unsigned n = 4; n <= max; n *= 2) {
+      buffer_clear(&text);
+      for (unsigned j = 0; j < n; ++j) {
+        buffer_append_string(&text, j ? " a" : "a", 0);
+      }
+
+      Timer timer;
+      timer_start(&timer);
+      errors = forest_parse(forest, buffer_slice(&text));
+      timer_stop(&timer);
+      if (errors || !forest->root) {
+        printf("could not parse %u words\n", n);
+        break;
+      }
+      printf("%8u %12lu %10u %10u %10u\n", n, timer_elapsed_us(&timer), forest->node_cap, forest->vert_cap, forest->rr_cap);
+    }
+  } while (0);
+  buffer_destroy(&text);
+  forest_destroy(forest);
+  parser_destroy(parser);
+  grammar_destroy(grammar);
+  symtab_destroy(symtab);
+  return 0;
+}
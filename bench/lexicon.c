@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "mem.h"
+#include "buffer.h"
+#include "timer.h"
+#include "symbol.h"
+#include "symtab.h"
+#include "words.h"
+
+// append a word of 3 to 12 letters, made unique by its sequence number
+static void append_word(Buffer* text, unsigned* state, unsigned seq) {
+  append_letters(text, state, 3 + next_random(state) % 10);
+  buffer_format_print(text, "%u", seq);
+}
+
+// Load a lexicon with lots of words into a symbol table, and time looking up
+// words that are there, and words that are not.
+int main(int argc, char* argv[]) {
+  unsigned count = argc > 1 ? (unsigned) atoi(argv[1]) : 1000000;
+  unsigned state = 0x12345678;
+  SymTab* symtab = symtab_create();
+  Buffer text; buffer_build(&text);
+  Buffer missing; buffer_build(&missing);
+  unsigned* offsets = 0;
+  unsigned* missing_offsets = 0;
+  MALLOC_N(unsigned, offsets, count + 1);
+  MALLOC_N(unsigned, missing_offsets, count + 1);
+  do {
+    // symbol names point into the text, so all words go in before any lookup
+    for (unsigned j = 0; j < count; ++j) {
+      offsets[j] = text.len;
+      append_word(&text, &state, j);
+      missing_offsets[j] = missing.len;
+      append_word(&missing, &state, count + j);
+    }
+    offsets[count] = text.len;
+    missing_offsets[count] = missing.len;
+
+    Timer timer;
+    timer_start(&timer);
+    for (unsigned j = 0; j < count; ++j) {
+      Slice word = slice_from_memory(text.ptr + offsets[j], offsets[j + 1] - offsets[j]);
+      symtab_lookup(symtab, word, 1, 1);
+    }
+    timer_stop(&timer);
+    unsigned long load_us = timer_elapsed_us(&timer);
+    symtab_freeze(symtab);
+
+    // look words up in a different order than they were inserted
+    unsigned found = 0;
+    timer_start(&timer);
+    for (unsigned k = 0; k < count; ++k) {
+      unsigned j = (unsigned) (((unsigned long) k * 7919) % count);
+      Slice word = slice_from_memory(text.ptr + offsets[j], offsets[j + 1] - offsets[j]);
+      found += symtab_lookup(symtab, word, 1, 0) != 0;
+    }
+    timer_stop(&timer);
+    unsigned long hit_us = timer_elapsed_us(&timer);
+
+    unsigned wrong = 0;
+    timer_start(&timer);
+    for (unsigned j = 0; j < count; ++j) {
+      Slice word = slice_from_memory(missing.ptr + missing_offsets[j], missing_offsets[j + 1] - missing_offsets[j]);
+      wrong += symtab_lookup(symtab, word, 1, 0) != 0;
+    }
+    timer_stop(&timer);
+    unsigned long miss_us = timer_elapsed_us(&timer);
+
+    if (found != count || wrong) {
+      printf("found %u of %u words, and %u missing ones\n", found, count, wrong);
+      break;
+    }
+    printf("%u words, %u slots\n", count, symtab->table_cap);
+    printf("%8s %12s %14s\n", "", "us", "per second");
+    printf("%8s %12lu %14.0f\n", "load", load_us, count * 1e6 / (load_us ? load_us : 1));
+    printf("%8s %12lu %14.0f\n", "hits", hit_us, count * 1e6 / (hit_us ? hit_us : 1));
+    printf("%8s %12lu %14.0f\n", "misses", miss_us, count * 1e6 / (miss_us ? miss_us : 1));
+  } while (0);
+  FREE(missing_offsets);
+  FREE(offsets);
+  buffer_destroy(&missing);
+  buffer_destroy(&text);
+  symtab_destroy(symtab);
+  return 0;
+}
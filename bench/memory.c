@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "buffer.h"
+#include "util.h"
+#include "tomita.h"
+#include "forest.h"
+
+// the bundled examples that come with sample sentences
+static const char* examples[] = {
+  "example0",
+  "example1",
+  "example5",
+  "example6",
+  "epsilon",
+  "germany",
+};
+
+// an ambiguous expression grammar, for forests bigger than the examples
+#define GRAMMAR_EXPR \
+  "Expr : Expr '-' Expr | Expr '*' Expr | digit ;" \
+  "'-'; '*';" \
+  "digit = '0' '1' '2' '3' '4' '5' '6' '7' '8' '9';"
+
+// number of operands in the biggest expression
+#define OPERANDS 64
+
+static void show_bytes(const char* name, unsigned sentences, unsigned long tokens, unsigned long bytes) {
+  printf("%-10s %10u %10lu %12lu %10.1f\n", name, sentences, tokens, bytes, tokens ? (double) bytes / tokens : 0.0);
+}
+
+// parse every sentence in a slice, one per line, adding up tokens and bytes
+static unsigned parse_lines(Tomita* tomita, Slice text, unsigned long* tokens, unsigned long* bytes) {
+  unsigned sentences = 0;
+  unsigned beg = 0;
+  for (unsigned pos = 0; pos <= text.len; ++pos) {
+    if (pos < text.len && text.ptr[pos] != '\n') continue;
+    Slice line = slice_from_memory(text.ptr + beg, pos - beg);
+    beg = pos + 1;
+    if (!line.len) continue;
+    tomita_forest_parse_from_slice(tomita, line);
+    *tokens += tomita->forest->position;
+    *bytes += forest_bytes(tomita->forest);
+    ++sentences;
+  }
+  return sentences;
+}
+
+// Measure the memory taken by parse forests and their parsing stacks, in
+// bytes per input token, for the sample sentences of the bundled examples.
+int main(int argc, char* argv[]) {
+  const char* dir = argc > 1 ? argv[1] : "examples";
+  Buffer grammar; buffer_build(&grammar);
+  Buffer input; buffer_build(&input);
+  Buffer text; buffer_build(&text);
+  printf("%-10s %10s %10s %12s %10s\n", "example", "sentences", "tokens", "bytes", "per token");
+  for (unsigned j = 0; j < ALEN(examples); ++j) {
+    char path[1024];
+    buffer_clear(&grammar);
+    buffer_clear(&input);
+    snprintf(path, sizeof(path), "%s/%s.gram", dir, examples[j]);
+    if (!file_slurp(path, &grammar)) {
+      printf("could not read %s\n", path);
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s.inp", dir, examples[j]);
+    if (!file_slurp(path, &input)) {
+      printf("could not read %s\n", path);
+      continue;
+    }
+    Tomita* tomita = tomita_create(0, 0);
+    unsigned errors = tomita_grammar_compile_from_slice(tomita, buffer_slice(&grammar));
+    if (!errors) errors = tomita_parser_build_from_grammar(tomita);
+    if (errors) {
+      printf("could not build parser for %s\n", examples[j]);
+    } else {
+      unsigned long tokens = 0;
+      unsigned long bytes = 0;
+      unsigned sentences = parse_lines(tomita, buffer_slice(&input), &tokens, &bytes);
+      show_bytes(examples[j], sentences, tokens, bytes);
+    }
+    tomita_destroy(tomita);
+  }
+
+  // expressions of growing length: every operator can be the top one
+  Tomita* tomita = tomita_create(0, 0);
+  do {
+    unsigned errors = tomita_grammar_compile_from_slice(tomita, slice_from_string(GRAMMAR_EXPR, 0));
+    if (!errors) errors = tomita_parser_build_from_grammar(tomita);
+    if (errors) {
+      printf("could not build parser for [%s]\n", GRAMMAR_EXPR);
+      break;
+    }
+    for (unsigned n = 8; n <= OPERANDS; n *= 2) {
+      buffer_clear(&text);
+      for (unsigned k = 0; k < n; ++k) {
+        if (k) buffer_append_string(&text, k % 2 ? " - " : " * ", 0);
+        buffer_append_byte(&text, '0' + k % 10);
+      }
+      unsigned long tokens = 0;
+      unsigned long bytes = 0;
+      unsigned sentences = parse_lines(tomita, buffer_slice(&text), &tokens, &bytes);
+      char name[32];
+      snprintf(name, sizeof(name), "expr%u", n);
+      show_bytes(name, sentences, tokens, bytes);
+    }
+  } while (0);
+  tomita_destroy(tomita);
+  buffer_destroy(&text);
+  buffer_destroy(&input);
+  buffer_destroy(&grammar);
+  return 0;
+}
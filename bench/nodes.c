@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "buffer.h"
+#include "timer.h"
+#include "symtab.h"
+#include "grammar.h"
+#include "parser.h"
+#include "forest.h"
+
+// an ambiguous expression grammar: every operator can be the top one, so
+// nodes end up with many packed branches, which have to be deduplicated
+#define GRAMMAR_EXPR \
+  "Expr : Expr '-' Expr | Expr '*' Expr | digit ;" \
+  "'-'; '*';" \
+  "digit = '0' '1' '2' '3' '4' '5' '6' '7' '8' '9';"
+
+// Time parsing expressions of increasing length, counting nodes and branches.
+int main(int argc, char* argv[]) {
+  unsigned max = argc > 1 ? (unsigned) atoi(argv[1]) : 128;
+  SymTab* symtab = symtab_create();
+  Grammar* grammar = grammar_create(symtab);
+  Parser* parser = parser_create(symtab);
+  Forest* forest = forest_create(parser, 0, 0);
+  Buffer text; buffer_build(&text);
+  do {
+    unsigned errors = grammar_compile_from_slice(grammar, slice_from_string(GRAMMAR_EXPR, 0));
+    if (!errors) errors = parser_build_from_grammar(parser, grammar);
+    if (errors) {
+      printf("could not build parser for [%s]\n", GRAMMAR_EXPR);
+      break;
+    }
+
+    printf("%8s %12s %10s %10s\n", "operands", "us", "nodes", "branches");
+    for (unsigned n = 4; n <= max; n *= 2) {
+      buffer_clear(&text);
+      for (unsigned j = 0; j < n; ++j) {
+        if (j) buffer_append_string(&text, j % 2 ? " - " : " * ", 0);
+        buffer_append_byte(&text, '0' + j % 10);
+      }
+
+      Timer timer;
+      timer_start(&timer);
+      errors = forest_parse(forest, buffer_slice(&text));
+      timer_stop(&timer);
+      if (errors || !forest->root) {
+        printf("could not parse %u operands\n", n);
+        break;
+      }
+      unsigned branches = 0;
+      for (unsigned N = 0; N < forest->node_cap; ++N) {
+        branches += forest->node_table[N].sub_cap;
+      }
+      printf("%8u %12lu %10u %10u\n", n, timer_elapsed_us(&timer), forest->node_cap, branches);
+    }
+  } while (0);
+  buffer_destroy(&text);
+  forest_destroy(forest);
+  parser_destroy(parser);
+  grammar_destroy(grammar);
+  symtab_destroy(symtab);
+  return 0;
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "buffer.h"
+#include "util.h"
+#include "timer.h"
+#include "symtab.h"
+#include "grammar.h"
+#include "parser.h"
+#include "forest.h"
+
+// noun phrases full of optional constituents, most of them missing: without
+// right-nulled reductions, each missing one costs a reduction through an
+// empty node, and a new stack vertex
+#define GRAMMAR_OPTIONAL \
+  "S : S NP | NP ;" \
+  "NP : Det Adj Adj N Mod Mod Mod Mod ;" \
+  "Det : | d ;" \
+  "Adj : | j ;" \
+  "N : n ;" \
+  "Mod : | r | PP ;" \
+  "PP : p NP ;" \
+  "d ; j ; n ; r ; p ;"
+
+// the words in the sentences, over and over; they always end with a noun
+static const char* words[] = { "d", "n", "n", "j", "n", "p", "n", "r", "n", "p", "d", "j", "n" };
+
+// Compare the time and number of reductions needed to parse sentences of
+// increasing length, with and without right-nulled reductions.
+int main(int argc, char* argv[]) {
+  unsigned max = argc > 1 ? (unsigned) atoi(argv[1]) : 1024;
+  SymTab* symtab = symtab_create();
+  Grammar* grammar = grammar_create(symtab);
+  Parser* parser[2] = { parser_create(symtab), parser_create(symtab) };
+  Forest* forest[2] = { forest_create(parser[0], 0, 0), forest_create(parser[1], 0, 0) };
+  Buffer text; buffer_build(&text);
+  do {
+    unsigned errors = grammar_compile_from_slice(grammar, slice_from_string(GRAMMAR_OPTIONAL, 0));
+    for (unsigned right_nulled = 0; right_nulled < 2; ++right_nulled) {
+      parser[right_nulled]->right_nulled = right_nulled;
+      if (!errors) errors = parser_build_from_grammar(parser[right_nulled], grammar);
+    }
+    if (errors) {
+      printf("could not build parser for [%s]\n", GRAMMAR_OPTIONAL);
+      break;
+    }
+
+    printf("%8s %10s %10s %10s %10s %10s %10s\n", "words", "plain us", "reductions", "size", "nulled us", "reductions", "size");
+    for (unsigned n = 16; n <= max; n *= 2) {
+      buffer_clear(&text);
+      for (unsigned j = 0; j < n; ++j) {
+        if (j) buffer_append_byte(&text, ' ');
+        buffer_append_string(&text, j + 1 < n ? words[j % ALEN(words)] : "n", 0);
+      }
+
+      unsigned long us[2];
+      unsigned reductions[2];
+      unsigned long size[2];
+      for (unsigned right_nulled = 0; right_nulled < 2; ++right_nulled) {
+        Forest* F = forest[right_nulled];
+        Timer timer;
+        timer_start(&timer);
+        errors = forest_parse(F, buffer_slice(&text));
+        timer_stop(&timer);
+        if (errors || !F->root) break;
+        us[right_nulled] = timer_elapsed_us(&timer);
+        reductions[right_nulled] = F->rr_cap + F->er_cap;
+        size[right_nulled] = forest_size(F);
+      }
+      if (errors) {
+        printf("could not parse %u words\n", n);
+        break;
+      }
+      printf("%8u %10lu %10u %10lu %10lu %10u %10lu\n", n, us[0], reductions[0], size[0], us[1], reductions[1], size[1]);
+    }
+  } while (0);
+  buffer_destroy(&text);
+  for (unsigned j = 0; j < 2; ++j) {
+    forest_destroy(forest[j]);
+    parser_destroy(parser[j]);
+  }
+  grammar_destroy(grammar);
+  symtab_destroy(symtab);
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "buffer.h"
+#include "timer.h"
+#include "symtab.h"
+#include "grammar.h"
+#include "parser.h"
+#include "forest.h"
+
+// an ambiguous grammar with a long rule: without intermediate nodes, each
+// node for E spanning n words has O(n^2) branches of three nodes each
+#define GRAMMAR_TERNARY "E : E E E | a ; a ;"
+
+// Compare the size of plain and binarised forests for sentences of
+// increasing length.
+int main(int argc, char* argv[]) {
+  unsigned max = argc > 1 ? (unsigned) atoi(argv[1]) : 64;
+  SymTab* symtab = symtab_create();
+  Grammar* grammar = grammar_create(symtab);
+  Parser* parser = parser_create(symtab);
+  Forest* forest = forest_create(parser, 0, 0);
+  Buffer text; buffer_build(&text);
+  do {
+    unsigned errors = grammar_compile_from_slice(grammar, slice_from_string(GRAMMAR_TERNARY, 0));
+    if (!errors) errors = parser_build_from_grammar(parser, grammar);
+    if (errors) {
+      printf("could not build parser for [%s]\n", GRAMMAR_TERNARY);
+      break;
+    }
+
+    printf("%8s %12s %12s %12s %12s\n", "words", "plain us", "plain size", "binary us", "binary size");
+    for (unsigned n = 5; n <= max; n = 2 * n - 1) {
+      buffer_clear(&text);
+      for (unsigned j = 0; j < n; ++j) {
+        buffer_append_string(&text, j ? " a" : "a", 0);
+      }
+
+      unsigned long us[2];
+      unsigned long size[2];
+      for (unsigned binarised = 0; binarised < 2; ++binarised) {
+        forest->binarised = binarised;
+        Timer timer;
+        timer_start(&timer);
+        errors = forest_parse(forest, buffer_slice(&text));
+        timer_stop(&timer);
+        if (errors || !forest->root) break;
+        us[binarised] = timer_elapsed_us(&timer);
+        size[binarised] = forest_size(forest);
+      }
+      if (errors || !forest->root) {
+        printf("could not parse %u words\n", n);
+        break;
+      }
+      printf("%8u %12lu %12lu %12lu %12lu\n", n, us[0], size[0], us[1], size[1]);
+    }
+  } while (0);
+  buffer_destroy(&text);
+  forest_destroy(forest);
+  parser_destroy(parser);
+  grammar_destroy(grammar);
+  symtab_destroy(symtab);
+  return 0;
+}
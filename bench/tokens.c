@@ -0,0 +1,104 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "buffer.h"
+#include "timer.h"
+#include "util.h"
+#include "scanner.h"
+#include "words.h"
+
+// append lines of 5 to 40 words, each of 1 to 12 letters, separated by
+// a mix of spaces and tabs, until the text has at least size bytes
+static void generate_text(Buffer* text, unsigned long size) {
+  unsigned state = 0x12345678;
+  while (text->len < size) {
+    unsigned words = 5 + next_random(&state) % 36;
+    for (unsigned w = 0; w < words; ++w) {
+      if (w) buffer_append_string(text, next_random(&state) % 8 ? " " : " \t ", 0);
+      append_letters(text, &state, 1 + next_random(&state) % 12);
+    }
+    buffer_append_byte(text, '\n');
+  }
+}
+
+// split a line into words one byte at a time, the way input used to be split
+static unsigned split_bytes(Slice text, unsigned pos, unsigned* words) {
+  while (pos < text.len) {
+    while (pos < text.len && (text.ptr[pos] == ' ' || text.ptr[pos] == '\t')) ++pos;
+    if (pos >= text.len) break;
+    if (text.ptr[pos] == '\n') return pos + 1;
+    while (pos < text.len && !isspace(text.ptr[pos])) ++pos;
+    ++*words;
+  }
+  return pos;
+}
+
+static void show_speed(const char* name, unsigned long bytes, unsigned long words, unsigned long us) {
+  printf("%-10s %12lu %12lu %10.1f\n", name, words, us, us ? bytes / (double) us : 0.0);
+}
+
+// Time finding the words in a large generated file, line by line: reading it
+// with fgets() and looking at one byte at a time, as the driver used to do;
+// looking at one byte at a time in memory; and with scanner_split().
+int main(int argc, char* argv[]) {
+  unsigned mb = argc > 1 ? (unsigned) atoi(argv[1]) : 64;
+  const char* path = argc > 2 ? argv[2] : "/tmp/tomita-tokens.txt";
+  Buffer text; buffer_build(&text);
+  ScanWords words = {0};
+  do {
+    generate_text(&text, mb * 1024UL * 1024UL);
+    if (file_spew(path, buffer_slice(&text)) != text.len) {
+      printf("could not write %s\n", path);
+      break;
+    }
+    printf("%s: %u bytes\n", path, text.len);
+    printf("%-10s %12s %12s %10s\n", "", "words", "us", "MB/s");
+
+    Timer timer;
+    unsigned long fgets_words = 0;
+    timer_start(&timer);
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+      printf("could not read %s\n", path);
+      break;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+      unsigned count = 0;
+      split_bytes(slice_from_string(line, 0), 0, &count);
+      fgets_words += count;
+    }
+    fclose(fp);
+    timer_stop(&timer);
+    show_speed("fgets", text.len, fgets_words, timer_elapsed_us(&timer));
+
+    Slice all = buffer_slice(&text);
+    unsigned long byte_words = 0;
+    timer_start(&timer);
+    for (unsigned pos = 0; pos < all.len; ) {
+      unsigned count = 0;
+      pos = split_bytes(all, pos, &count);
+      byte_words += count;
+    }
+    timer_stop(&timer);
+    show_speed("bytes", text.len, byte_words, timer_elapsed_us(&timer));
+
+    unsigned long split_words = 0;
+    timer_start(&timer);
+    for (unsigned pos = 0; pos < all.len; ) {
+      pos = scanner_split(all, pos, '\n', &words);
+      split_words += words.cap;
+    }
+    timer_stop(&timer);
+    show_speed("split", text.len, split_words, timer_elapsed_us(&timer));
+
+    if (split_words != byte_words || fgets_words != byte_words) {
+      printf("found different numbers of words\n");
+    }
+  } while (0);
+  unlink(path);
+  scanner_words_destroy(&words);
+  buffer_destroy(&text);
+  return 0;
+}
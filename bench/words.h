@@ -0,0 +1,24 @@
+#pragma once
+
+#include "buffer.h"
+
+// Random words for the benchmarks, repeatable from run to run.
+
+// the letters words are made of, more or less as frequent as in English
+static const char letters[] = "eeeeeeetttttaaaaoooiiinnnssshhrrdllcumwfgypbvkjxqz";
+
+// a simple xorshift generator, so that runs are repeatable
+static unsigned next_random(unsigned* state) {
+  unsigned x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+// append len random letters
+static void append_letters(Buffer* text, unsigned* state, unsigned len) {
+  for (unsigned j = 0; j < len; ++j) {
+    buffer_append_byte(text, letters[next_random(state) % (sizeof(letters) - 1)]);
+  }
+}
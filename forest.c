@@ -1,4 +1,6 @@
 #include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include "log.h"
 #include "mem.h"
@@ -8,74 +10,188 @@
 #include "forest.h"
 #include "tomita.h"
 
-// a reference-counted subnode, part of a node
+// Subnodes, stack nodes and all the lists in a forest (branches of nodes,
+// stack nodes in vertices, predecessors of stack nodes) are kept in tables
+// that work as pools, and refer to each other by their 32-bit position in
+// those tables, never with pointers.  Position 0 of the subnode and list
+// pools is never used, so that 0 means "none".
+
+// a subnode, part of a node; subnodes are shared between branches
 // it represents a possible parsed branch for the node
 struct Subnode {
   unsigned Size;
   unsigned Cur;
-  unsigned ref_cnt;          // reference count
-  struct Subnode* next;      // link to next Subnode
+  unsigned hash;             // structural hash, from Cur and next
+  unsigned next;             // position of next Subnode, 0 if none
+  unsigned rule;             // first in a branch: index of its rule + 1, 0 if none
 };
 
+// a stack node; its position in the pool is its sequential number
 struct ZNode {
-  unsigned Index;
-  unsigned Size;
-  unsigned* List;
+  unsigned Index;            // node in forest
+  unsigned Size;             // number of predecessor vertices
+  unsigned List;             //   position of their list in list pool
 };
 
 struct Path {
-  struct ZNode* Zn;
-  struct Subnode* Sn;
+  unsigned Zn;               // stack node
+  unsigned Sn;               // subnode
 };
 
+// unknown words come from the forest arena, in chunks this big
+#define FOREST_ARENA_CHUNK (4 * 1024)
+
+// nodes with at least this many branches get a hash index for them
+#define FOREST_BRANCH_INDEX 8
+
+// tables in a forest start with this many elements, and double when full
+#define FOREST_TABLE_MIN 8
+
+// make room for one more element in a forest table
+#define FOREST_TABLE_GROW(tab, cap, size, T) \
+  do { \
+    if ((cap) >= (size)) { \
+      size = (size) ? 2 * (size) : FOREST_TABLE_MIN; \
+      REALLOC(T, tab, size); \
+    } \
+  } while (0)
+
+// lists in the list pool start with room for this many elements
+#define FOREST_LIST_MIN 4
+
 // a Vertex
 struct Vertex {
-  struct ParserState* State;
+  unsigned State;            // parser state
   unsigned Start;
-  unsigned Size;
-  struct ZNode** List;
+  unsigned Size;             // number of stack nodes
+  unsigned List;             //   position of their list in list pool
 };
 
 // a Regular Reduction
 struct RRed {
-  struct ZNode* Zn;
+  unsigned Zn;               // stack node
   struct Reduce* Rd;         // the reduce rule
 };
 
+// an entry in an EdgeHash
+struct Edge {
+  unsigned a;                // first number in key
+  unsigned b;                // second number in key
+  unsigned value;            // value stored for key
+  unsigned stamp;            // entry is only in use if it matches table stamp
+};
+
 // an Empty Reduction
 struct ERed {
   unsigned vertex_index;     // vertex
   Symbol* LHS;               // left-hand side symbol
 };
 
+// how far forest_evaluate() got with a node
+enum {
+  VALUE_NONE,                // not looked at
+  VALUE_BUSY,                // its children are being evaluated
+  VALUE_DONE,                // evaluated
+};
+
+// a node being evaluated, with the children of its chosen branch
+struct EvalFrame {
+  unsigned N;                // node
+  unsigned kids;             // position of its children in the child stack
+  unsigned count;            //   number of children
+  unsigned next;             //   next child to evaluate
+  unsigned rule;             // rule of the chosen branch, as in its first subnode
+};
+
+// the work stacks used by forest_evaluate()
+struct Evaluation {
+  Forest* forest;
+  ForestActions* actions;
+  void* ctx;
+  struct EvalFrame* frames;  // nodes being evaluated, innermost last
+  unsigned frame_cap;        //   capacity of table
+  unsigned frame_size;       //   allocated elements in table
+  unsigned* kids;            // children of the nodes being evaluated
+  unsigned kid_cap;          //   capacity of table
+  unsigned kid_size;         //   allocated elements in table
+  struct Node** nodes;       // arguments for a rule action
+  ForestValue* values;       //   and their values
+  unsigned arg_size;         //   allocated elements in tables
+  unsigned errors;
+};
+
 static void forest_prepare(Forest* forest);
+static void forest_advance(Forest* forest, Symbol* Next);
+static void forest_update_high(Forest* forest);
+static void forest_free_tables(Forest* forest);
 static void forest_show_vertex(Forest* forest, unsigned vertex_index);
-static unsigned forest_next_symbol(Forest* forest, Slice text, unsigned pos, Symbol** symbol);
-static unsigned forest_add_subnode(Forest* forest, Symbol* symbol, struct Subnode* Sn);
-static unsigned forest_add_parser_state(Forest* forest, struct ParserState* state);
+static Symbol* forest_unknown_word(Forest* forest, Slice name);
+static Symbol* forest_word_symbol(Forest* forest, Slice name);
+static void forest_push_word(Forest* forest, Slice word);
+static unsigned forest_add_subnode(Forest* forest, Symbol* symbol, unsigned Sn, RuleSet* rs);
+static unsigned forest_add_node(Forest* forest, Symbol* symbol, unsigned Start, unsigned Size);
+static void forest_add_branch(Forest* forest, struct Node* Nd, unsigned Sn, RuleSet* rs);
+static unsigned forest_pack_tail(Forest* forest, Symbol* lhs, RuleSet* rs, unsigned dot, unsigned Sn);
+static unsigned forest_add_epsilon_node(Forest* forest, Symbol* symbol);
+static unsigned forest_nulled_tail(Forest* forest, Symbol* lhs, RuleSet* rs, unsigned dot);
+static unsigned forest_add_parser_state(Forest* forest, unsigned state);
 static void forest_reduce_one_regular_reduction(Forest* forest, struct RRed* rr);
 static void forest_add_vertex_node(Forest* forest, unsigned N, unsigned vertex_index);
-static void forest_add_subnode_link(Forest* forest, struct ZNode* Zn, struct Subnode* Sn);
-static void forest_add_regular_reduction(Forest* forest, struct ZNode* Zn, struct Reduce* Rd);
+static void forest_add_subnode_link(Forest* forest, unsigned Zn, unsigned Sn);
+static void forest_add_regular_reduction(Forest* forest, unsigned Zn, struct Reduce* Rd);
 static void forest_add_epsilon_reduction(Forest* forest, unsigned vertex_index, Symbol* LHS);
-static struct ParserState* forest_get_next_state(Forest* forest, struct ParserState* state, Symbol* symbol);
+static unsigned forest_list_grow(Forest* forest, unsigned list, unsigned cap);
+static unsigned forest_list_alloc(Forest* forest, unsigned room);
+static int forest_lookahead_viable(Forest* forest, unsigned char* la);
+
+static unsigned subnode_create(Forest* forest, unsigned N, unsigned Size, unsigned next);
+static int subnode_equal(Forest* forest, unsigned l, unsigned r);
+static unsigned subnode_hash(Forest* forest, unsigned Sn);
+static int branch_equal(Forest* forest, unsigned l, unsigned r);
 
-static void subnode_free(struct Subnode* Sn);
-static int subnode_equal(struct Subnode* l, struct Subnode* r);
+static int node_has_branch(Forest* forest, struct Node* Nd, unsigned Sn);
+static void node_index_branches(Forest* forest, struct Node* Nd);
+static unsigned node_index_mask(unsigned sub_cap);
 
 static void node_show(struct Node* node);
 
+static unsigned expected_add(Symbol* symbol, unsigned char* seen, Symbol** symbols, unsigned cap, unsigned count);
+static unsigned expected_add_lookahead(Parser* parser, unsigned char* la, unsigned char* seen, Symbol** symbols, unsigned cap, unsigned count);
+
+static void evaluate_enter(struct Evaluation* ev, unsigned N);
+static void evaluate_leave(struct Evaluation* ev);
+static void evaluate_children(struct Evaluation* ev, unsigned Sn);
+static unsigned evaluate_branch(struct Evaluation* ev, struct Node* Nd);
+static RuleSet* evaluate_rule(Forest* forest, struct Node* Nd, unsigned rule);
+
+static void edge_reset(EdgeHash* hash);
+static void edge_destroy(EdgeHash* hash);
+static int edge_lookup(EdgeHash* hash, unsigned a, unsigned b, unsigned* value);
+static void edge_grow(EdgeHash* hash);
+
 Forest* forest_create(struct Parser* parser, ForestCallbacks* fcb, void* fct) {
   Forest* forest = 0;
   MALLOC(Forest, forest);
   forest->parser = parser;
   forest->fcb = fcb;
   forest->fct = fct;
+  arena_build(&forest->arena, FOREST_ARENA_CHUNK);
   return forest;
 }
 
 void forest_destroy(Forest* forest) {
   forest_clear(forest);
+  forest_free_tables(forest);
+  FREE(forest->state_vertex);
+  FREE(forest->state_stamp);
+  edge_destroy(&forest->vert_nodes);
+  edge_destroy(&forest->node_links);
+  edge_destroy(&forest->node_index);
+  edge_destroy(&forest->inter_index);
+  arena_destroy(&forest->arena);
+  scanner_words_destroy(&forest->words);
+  FREE(forest->value_table);
+  FREE(forest->value_state);
   FREE(forest);
 }
 
@@ -86,11 +202,12 @@ void forest_show(Forest* forest) {
     if (Nd->symbol->literal) continue;
     printf("%c", Nd == forest->root ? '*' : ' ');
     node_show(Nd);
+    unsigned* branches = &forest->list_table[Nd->sub_list];
     if (Nd->sub_cap > 0) {
-      struct Subnode* Sn = Nd->sub_table[0];
+      unsigned Sn = branches[0];
       // we were not checking Sn in the next if
       // fix by gonzo
-      if (Sn && forest->node_table[Sn->Cur].symbol->literal) {
+      if (Sn && forest->node_table[forest->sub_table[Sn].Cur].symbol->literal) {
         putchar(':');
       } else {
         printf(" =");
@@ -100,8 +217,8 @@ void forest_show(Forest* forest) {
       if (S > 0) {
         printf(" |");
       }
-      for (struct Subnode* Sn = Nd->sub_table[S]; Sn != 0; Sn = Sn->next) {
-        struct Node* node = &forest->node_table[Sn->Cur];
+      for (unsigned Sn = branches[S]; Sn != 0; Sn = forest->sub_table[Sn].next) {
+        struct Node* node = &forest->node_table[forest->sub_table[Sn].Cur];
         node_show(node);
       }
     }
@@ -122,13 +239,13 @@ void forest_show_stack(Forest* forest) {
       if (vertex_index > 0) {
         printf("\t\t");
       }
-      struct ZNode* N = V->List[vertex_index];
+      struct ZNode* N = &forest->zn_table[forest->list_table[V->List + vertex_index]];
       struct Node* node = &forest->node_table[N->Index];
       printf(" [");
       node_show(node);
       printf(" ] <-");
       for (unsigned adj_index = 0; adj_index < N->Size; ++adj_index) {
-        forest_show_vertex(forest, N->List[adj_index]);
+        forest_show_vertex(forest, forest->list_table[N->List + adj_index]);
       }
       putchar('\n');
     }
@@ -140,87 +257,375 @@ void forest_clear(Forest* forest) {
   forest->prepared = 0;
   LOG_DEBUG("cleaning up forest");
 
+  forest_update_high(forest);
   forest->root = 0;
+  forest->value_cap = 0;
+  // unknown words live in the arena
+  arena_reset(&forest->arena);
+  if (forest->unknown_cap) {
+    memset(forest->unknown, 0, sizeof(forest->unknown));
+    forest->unknown_cap = 0;
+  }
+  if (!forest->persistent) forest_free_tables(forest);
+  forest->node_cap = forest->node_pos = 0;
+  forest->vert_cap = forest->vert_pos = 0;
+  forest->rr_cap = forest->rr_pos = 0;
+  forest->er_cap = forest->er_pos = 0;
+  forest->sub_cap = forest->zn_cap = forest->list_cap = 0;
+}
+
+void forest_reserve(Forest* forest, const ForestStats* stats) {
+  forest->persistent = 1;
+  if (!stats) return;
+  if (forest->node_size < stats->nodes) {
+    forest->node_size = stats->nodes;
+    REALLOC(struct Node, forest->node_table, forest->node_size);
+  }
+  if (forest->vert_size < stats->vertices) {
+    forest->vert_size = stats->vertices;
+    REALLOC(struct Vertex, forest->vert_table, forest->vert_size);
+  }
+  if (forest->rr_size < stats->rr) {
+    forest->rr_size = stats->rr;
+    REALLOC(struct RRed, forest->rr_table, forest->rr_size);
+  }
+  if (forest->er_size < stats->er) {
+    forest->er_size = stats->er;
+    REALLOC(struct ERed, forest->er_table, forest->er_size);
+  }
+  if (forest->path_size < stats->paths) {
+    forest->path_size = stats->paths;
+    REALLOC(struct Path, forest->path_table, forest->path_size);
+  }
+  if (forest->sub_size < stats->subnodes) {
+    forest->sub_size = stats->subnodes;
+    REALLOC(struct Subnode, forest->sub_table, forest->sub_size);
+  }
+  if (forest->zn_size < stats->znodes) {
+    forest->zn_size = stats->znodes;
+    REALLOC(struct ZNode, forest->zn_table, forest->zn_size);
+  }
+  if (forest->list_size < stats->lists) {
+    forest->list_size = stats->lists;
+    REALLOC(unsigned, forest->list_table, forest->list_size);
+  }
+}
+
+void forest_stats(Forest* forest, ForestStats* stats) {
+  forest_update_high(forest);
+  *stats = forest->high;
+}
+
+unsigned long forest_size(Forest* forest) {
+  unsigned long size = forest->node_cap;
   for (unsigned N = 0; N < forest->node_cap; ++N) {
     struct Node* Nd = &forest->node_table[N];
     for (unsigned S = 0; S < Nd->sub_cap; ++S) {
-      subnode_free(Nd->sub_table[S]);
+      unsigned branch = forest->list_table[Nd->sub_list + S];
+      for (unsigned Sn = branch; Sn != 0; Sn = forest->sub_table[Sn].next) ++size;
     }
-    FREE(Nd->sub_table);
   }
-  FREE(forest->node_table);
-  forest->node_cap = 0;
-  forest->node_pos = 0;
-  for (unsigned forest_vertex_index = 0; forest_vertex_index < forest->vert_cap; ++forest_vertex_index) {
-    struct Vertex* V = &forest->vert_table[forest_vertex_index];
-    for (unsigned vertex_index = 0; vertex_index < V->Size; ++vertex_index) {
-      struct ZNode*  ZN = V->List[vertex_index];
-      FREE(ZN->List);
-      FREE(ZN);
-    }
-    FREE(V->List);
-  }
-  FREE(forest->vert_table);
-  forest->vert_cap = forest->vert_pos = 0;
-  FREE(forest->rr_table);
-  forest->rr_cap = forest->rr_pos = 0;
-  FREE(forest->er_table);
-  forest->er_cap = forest->er_pos = 0;
+  return size;
 }
 
-static void add_shift_nodes(Forest* forest, struct Subnode* Sn, unsigned vertex_pos, Symbol* symbol) {
-  unsigned N = forest_add_subnode(forest, symbol, Sn);
+unsigned long forest_bytes(Forest* forest) {
+  return forest->node_cap * sizeof(struct Node)
+       + forest->vert_cap * sizeof(struct Vertex)
+       + forest->rr_cap * sizeof(struct RRed)
+       + forest->er_cap * sizeof(struct ERed)
+       + forest->path_size * sizeof(struct Path)
+       + forest->sub_cap * sizeof(struct Subnode)
+       + forest->zn_cap * sizeof(struct ZNode)
+       + forest->list_cap * sizeof(unsigned)
+       + arena_used(&forest->arena);
+}
+
+static void add_shift_nodes(Forest* forest, unsigned Sn, unsigned vertex_pos, Symbol* symbol) {
+  unsigned N = forest_add_subnode(forest, symbol, Sn, 0);
   for (unsigned vertex_index = vertex_pos; vertex_index < forest->vert_pos; ++vertex_index) {
     forest_add_vertex_node(forest, N, vertex_index);
   }
 }
 
 unsigned forest_parse(Forest* forest, Slice text) {
+  forest_begin(forest);
+  // find all the words at once, then push each of them
+  scanner_split(text, 0, SCANNER_NO_DELIMITER, &forest->words);
+  for (unsigned w = 0; w < forest->words.cap; ++w) {
+    unsigned beg = forest->words.table[2 * w + 0];
+    unsigned end = forest->words.table[2 * w + 1];
+    forest_push_word(forest, slice_from_memory(text.ptr + beg, end - beg));
+    // once the stack is empty, there is no point in looking at the rest
+    if (!forest_frontier_size(forest)) break;
+  }
+  return forest_end(forest);
+}
+
+void forest_begin(Forest* forest) {
   forest_clear(forest);
   forest_prepare(forest);
-  forest_add_parser_state(forest, &forest->parser->states[0]);
-  unsigned pos = 0;
-  while (1) {
-    /* REDUCE as much as possible */
-    while (forest->er_pos < forest->er_cap || forest->rr_pos < forest->rr_cap) {
-      // Run all possible regular reductions
-      for (; forest->rr_pos < forest->rr_cap; ++forest->rr_pos) {
-        struct RRed* rr = &forest->rr_table[forest->rr_pos];
-        // printf("Regular Reduce\n");
-        forest_reduce_one_regular_reduction(forest, rr);
+  forest->lookahead = 0;
+}
+
+void forest_push_symbol(Forest* forest, Symbol* symbol) {
+  forest_advance(forest, symbol);
+}
+
+void forest_push_token(Forest* forest, Slice token) {
+  forest_advance(forest, forest_word_symbol(forest, token));
+}
+
+unsigned forest_end(Forest* forest) {
+  // once the stack is dead, the pending token is never shifted
+  if (forest->vert_cap && !forest_frontier_size(forest)) return 1;
+  forest_advance(forest, 0);
+
+  /* ACCEPT if there is a final state */
+  // printf("\n");
+  for (unsigned vertex_index = forest->vert_pos; vertex_index < forest->vert_cap; ++vertex_index) {
+    struct Vertex* V = &forest->vert_table[vertex_index];
+    if (forest->parser->states[V->State].final) {
+      // printf("ACCEPT\n");
+      if (forest->fcb && forest->fct) {
+        forest->fcb->accept(forest->fct);
       }
-      // Run all possible epsilon reductions
-      for (; forest->er_pos < forest->er_cap; ++forest->er_pos) {
-        // printf("Epsilon Reduce\n");
-        unsigned N = forest_add_subnode(forest, forest->er_table[forest->er_pos].LHS, 0);
-        forest_add_vertex_node(forest, N, forest->er_table[forest->er_pos].vertex_index);
+      if (V->Size) {
+        forest->root = &forest->node_table[forest->zn_table[forest->list_table[V->List]].Index];
       }
+      return 0;
+    }
+  }
+  if (!forest->error_vert_cap) {
+    // the stack is alive, but the input ended too soon
+    forest->error_position = forest->position;
+    forest->error_vert_pos = forest->vert_pos;
+    forest->error_vert_cap = forest->vert_cap;
+  }
+  return 1;
+}
+
+unsigned forest_expected(Forest* forest, Symbol** symbols, unsigned cap) {
+  Parser* parser = forest->parser;
+  unsigned char* seen = 0;
+  MALLOC_N(unsigned char, seen, parser->symtab->symbol_counter);
+  unsigned count = 0;
+  for (unsigned V = forest->error_vert_pos; V < forest->error_vert_cap; ++V) {
+    struct ParserState* state = &parser->states[forest->vert_table[V].State];
+    for (unsigned X = 0; X < state->ss_cap; ++X) {
+      // gotos are for symbols with rules, which are never shifted from the input
+      Symbol* symbol = state->ss_table[X].symbol;
+      if (!symbol->literal && symbol->rs_cap != 0) continue;
+      count = expected_add(symbol, seen, symbols, cap, count);
     }
+    // reductions left out because of the next token, which their lookaheads allow
+    for (unsigned R = 0; R < state->rr_cap; ++R) {
+      count = expected_add_lookahead(parser, state->rr_table[R].la, seen, symbols, cap, count);
+    }
+    for (unsigned E = 0; E < state->er_cap; ++E) {
+      count = expected_add_lookahead(parser, state->er_table[E].la, seen, symbols, cap, count);
+    }
+  }
+  FREE(seen);
+  return count;
+}
+
+unsigned forest_evaluate(Forest* forest, ForestActions* actions, void* ctx, ForestValue* value) {
+  struct Evaluation ev = { .forest = forest, .actions = actions, .ctx = ctx };
+  do {
+    if (!forest->root) {
+      ++ev.errors;
+      break;
+    }
+    if (forest->value_size < forest->node_cap) {
+      forest->value_size = forest->node_cap;
+      REALLOC(ForestValue, forest->value_table, forest->value_size);
+      REALLOC(unsigned char, forest->value_state, forest->value_size);
+    }
+    memset(forest->value_state, VALUE_NONE, forest->node_cap);
+    forest->value_cap = forest->node_cap;
+
+    unsigned R = forest->root - forest->node_table;
+    evaluate_enter(&ev, R);
+    while (ev.frame_cap > 0) {
+      struct EvalFrame* F = &ev.frames[ev.frame_cap - 1];
+      if (F->next == F->count) {
+        evaluate_leave(&ev);
+        continue;
+      }
+      unsigned C = ev.kids[F->kids + F->next++];
+      if (forest->value_state[C] == VALUE_NONE) {
+        evaluate_enter(&ev, C);
+      } else if (forest->value_state[C] == VALUE_BUSY) {
+        LOG_WARN("derivation goes around a cycle at node %u", C);
+        ++ev.errors;
+      }
+    }
+    if (value) *value = forest->value_table[R];
+  } while (0);
+  FREE(ev.frames);
+  FREE(ev.kids);
+  FREE(ev.nodes);
+  FREE(ev.values);
+  return ev.errors;
+}
+
+ForestValue* forest_node_value(Forest* forest, struct Node* node) {
+  unsigned N = node - forest->node_table;
+  if (N >= forest->value_cap || forest->value_state[N] != VALUE_DONE) return 0;
+  return &forest->value_table[N];
+}
+
+// start evaluating a node: tokens are done right away, other nodes get a
+// frame with the children of their chosen branch
+static void evaluate_enter(struct Evaluation* ev, unsigned N) {
+  Forest* forest = ev->forest;
+  struct Node* Nd = &forest->node_table[N];
+  forest->value_table[N] = (ForestValue) { 0 };
+  if (Nd->symbol->literal) {
+    if (ev->actions->token) forest->value_table[N] = ev->actions->token(ev->ctx, Nd);
+    forest->value_state[N] = VALUE_DONE;
+    return;
+  }
+  forest->value_state[N] = VALUE_BUSY;
+  unsigned kids = ev->kid_cap;
+  unsigned rule = 0;
+  if (Nd->sub_cap > 0) {
+    unsigned Sn = forest->list_table[Nd->sub_list + evaluate_branch(ev, Nd)];
+    if (Sn) rule = forest->sub_table[Sn].rule;
+    evaluate_children(ev, Sn);
+  }
+  if (ev->frame_cap >= ev->frame_size) {
+    ev->frame_size = ev->frame_size ? 2 * ev->frame_size : 64;
+    REALLOC(struct EvalFrame, ev->frames, ev->frame_size);
+  }
+  struct EvalFrame* F = &ev->frames[ev->frame_cap++];
+  F->N = N;
+  F->kids = kids;
+  F->rule = rule;
+  F->count = ev->kid_cap - kids;
+  F->next = 0;
+}
+
+// finish evaluating a node, once all its children are done
+static void evaluate_leave(struct Evaluation* ev) {
+  Forest* forest = ev->forest;
+  struct EvalFrame* F = &ev->frames[--ev->frame_cap];
+  if (ev->arg_size < F->count) {
+    ev->arg_size = 2 * F->count;
+    REALLOC(struct Node*, ev->nodes, ev->arg_size);
+    REALLOC(ForestValue, ev->values, ev->arg_size);
+  }
+  unsigned* kids = &ev->kids[F->kids];
+  for (unsigned j = 0; j < F->count; ++j) {
+    ev->nodes[j] = &forest->node_table[kids[j]];
+    ev->values[j] = forest->value_table[kids[j]];
+  }
+  struct Node* Nd = &forest->node_table[F->N];
+  if (ev->actions->rule) {
+    RuleSet* rs = evaluate_rule(forest, Nd, F->rule);
+    forest->value_table[F->N] = ev->actions->rule(ev->ctx, Nd, rs, ev->nodes, ev->values, F->count);
+  }
+  forest->value_state[F->N] = VALUE_DONE;
+  ev->kid_cap = F->kids;
+}
+
+// gather the children in a branch; those of an intermediate node (in a
+// binarised forest) are gathered as well, in its place
+static void evaluate_children(struct Evaluation* ev, unsigned Sn) {
+  Forest* forest = ev->forest;
+  for (; Sn != 0; Sn = forest->sub_table[Sn].next) {
+    unsigned K = forest->sub_table[Sn].Cur;
+    struct Node* Kd = &forest->node_table[K];
+    if (Kd->rule) {
+      if (Kd->sub_cap > 0) {
+        evaluate_children(ev, forest->list_table[Kd->sub_list + evaluate_branch(ev, Kd)]);
+      }
+      continue;
+    }
+    if (ev->kid_cap >= ev->kid_size) {
+      ev->kid_size = ev->kid_size ? 2 * ev->kid_size : 64;
+      REALLOC(unsigned, ev->kids, ev->kid_size);
+    }
+    ev->kids[ev->kid_cap++] = K;
+  }
+}
+
+static unsigned evaluate_branch(struct Evaluation* ev, struct Node* Nd) {
+  if (Nd->sub_cap < 2 || !ev->actions->choose) return 0;
+  unsigned S = ev->actions->choose(ev->ctx, Nd, Nd->sub_cap);
+  return S < Nd->sub_cap ? S : 0;
+}
+
+// get the rule recorded for a branch; an empty branch (from an epsilon
+// reduction that was not right-nulled) records none, and only an empty rule
+// can have built it
+static RuleSet* evaluate_rule(Forest* forest, struct Node* Nd, unsigned rule) {
+  if (rule) return symtab_find_ruleset_by_index(forest->parser->symtab, rule - 1);
+  for (unsigned r = 0; r < Nd->symbol->rs_cap; ++r) {
+    RuleSet* rs = &Nd->symbol->rs_table[r];
+    if (rs->len == 0) return rs;
+  }
+  return 0;
+}
 
-    /* SHIFT next symbol; if none, stop */
-    Symbol* Word = 0;
-    pos = forest_next_symbol(forest, text, pos, &Word);
-    if (Word == 0) break;
+static unsigned expected_add(Symbol* symbol, unsigned char* seen, Symbol** symbols, unsigned cap, unsigned count) {
+  if (seen[symbol->index]) return count;
+  seen[symbol->index] = 1;
+  if (count < cap) symbols[count] = symbol;
+  return count + 1;
+}
+
+static unsigned expected_add_lookahead(Parser* parser, unsigned char* la, unsigned char* seen, Symbol** symbols, unsigned cap, unsigned count) {
+  if (!la) return count;
+  // the last bit stands for the end of the input
+  for (unsigned bit = 0; bit + 1 < parser->la_bits; ++bit) {
+    if (!PARSER_LOOKAHEAD_HAS(la, bit)) continue;
+    Symbol* symbol = symtab_find_symbol_by_index(parser->symtab, bit);
+    if (symbol) count = expected_add(symbol, seen, symbols, cap, count);
+  }
+  return count;
+}
+
+unsigned forest_frontier_size(Forest* forest) {
+  return forest->vert_cap - forest->vert_pos;
+}
+
+unsigned forest_frontier_state(Forest* forest, unsigned index) {
+  return forest->vert_table[forest->vert_pos + index].State;
+}
+
+// Take the next input symbol (0 at the end of the input): shift the symbol
+// before it, now that it is known what comes next, and then reduce as much as
+// possible.  Reductions are filtered by the next symbol, so that one is only
+// shifted when the one after it arrives.
+static void forest_advance(Forest* forest, Symbol* Next) {
+  // tokens pushed after the stack died are ignored
+  if (forest->vert_cap && !forest_frontier_size(forest)) return;
+  Symbol* Word = forest->lookahead;
+  forest->lookahead = Next;
+  if (forest->vert_cap == 0) {
+    // first symbol: start with the initial state
+    forest_add_parser_state(forest, 0);
+  } else if (Word != 0) {
+    /* SHIFT previous symbol */
+    ++forest->position;
     // printf("PUSH [%.*s]\n", Word->name.len, Word->name.ptr);
     if (forest->fcb && forest->fct) {
       forest->fcb->new_token(forest->fct, Word->name);
     }
     // symbol_show(Word, 0, 0);
-    struct Subnode* Sn = 0;
-    MALLOC(struct Subnode, Sn);
-    Sn->Size = 1;
-    Sn->Cur = forest_add_subnode(forest, Word, 0);
-    Sn->next = 0;
-    Sn->ref_cnt = 0;
+    unsigned Sn = subnode_create(forest, forest_add_subnode(forest, Word, 0, 0), 1, 0);
     unsigned VP = forest->vert_pos;
     forest->vert_pos = forest->vert_cap;
+    ++forest->frontier;
     forest->node_pos = forest->node_cap;
+    edge_reset(&forest->node_index);
+    edge_reset(&forest->inter_index);
     if (Word->rs_cap == 0) {
       // Treat the word as a new word.
-      for (Symbol* symbol = forest->parser->symtab->first; symbol != 0; symbol = symbol->nxt_list) {
-        if (symbol->rs_cap > 0) continue;
+      for (unsigned open_index = 0; open_index < forest->parser->open_cap; ++open_index) {
         // printf("SHIFT new word\n");
-        add_shift_nodes(forest, Sn, VP, symbol);
+        add_shift_nodes(forest, Sn, VP, forest->parser->open_table[open_index]);
       }
     } else {
       for (unsigned rs_index = 0; rs_index < Word->rs_cap; ++rs_index) {
@@ -229,24 +634,32 @@ unsigned forest_parse(Forest* forest, Slice text) {
         add_shift_nodes(forest, Sn, VP, symbol);
       }
     }
+    if (forest->vert_pos == forest->vert_cap && VP < forest->vert_pos) {
+      // the stack just died: remember where, and the last frontier alive
+      forest->error_position = forest->position - 1;
+      forest->error_symbol = Word;
+      forest->error_vert_pos = VP;
+      forest->error_vert_cap = forest->vert_pos;
+    }
   }
 
-  /* ACCEPT if there is a final state */
-  // printf("\n");
-  for (unsigned vertex_index = forest->vert_pos; vertex_index < forest->vert_cap; ++vertex_index) {
-    struct Vertex* V = &forest->vert_table[vertex_index];
-    if (V->State->final) {
-      // printf("ACCEPT\n");
-      if (forest->fcb && forest->fct) {
-        forest->fcb->accept(forest->fct);
-      }
-      if (V->List && V->List[0]) {
-        forest->root = &forest->node_table[V->List[0]->Index];
-      }
-      return 0;
+  /* REDUCE as much as possible */
+  while (forest->er_pos < forest->er_cap || forest->rr_pos < forest->rr_cap) {
+    // Run all possible regular reductions
+    for (; forest->rr_pos < forest->rr_cap; ++forest->rr_pos) {
+      struct RRed* rr = &forest->rr_table[forest->rr_pos];
+      // printf("Regular Reduce\n");
+      forest_reduce_one_regular_reduction(forest, rr);
+    }
+    // Run all possible epsilon reductions
+    for (; forest->er_pos < forest->er_cap; ++forest->er_pos) {
+      // printf("Epsilon Reduce\n");
+      Symbol* LHS = forest->er_table[forest->er_pos].LHS;
+      unsigned N = forest->parser->right_nulled ? forest_add_epsilon_node(forest, LHS)
+                 : forest_add_subnode(forest, LHS, 0, 0);
+      forest_add_vertex_node(forest, N, forest->er_table[forest->er_pos].vertex_index);
     }
   }
-  return 1;
 }
 
 static void forest_prepare(Forest* forest) {
@@ -256,106 +669,264 @@ static void forest_prepare(Forest* forest) {
 
   forest->position = 0;
   forest->root = 0;
-  forest->node_table = 0;
   forest->node_cap = 0;
   forest->node_pos = 0;
-  forest->vert_table = 0;
   forest->vert_cap = 0;
   forest->vert_pos = 0;
-  forest->path_table = 0;
   forest->path_cap = 0;
-  forest->rr_table = 0;
   forest->rr_cap = 0;
   forest->rr_pos = 0;
-  forest->er_table = 0;
   forest->er_cap = 0;
   forest->er_pos = 0;
+  forest->error_position = 0;
+  forest->error_symbol = 0;
+  forest->error_vert_pos = 0;
+  forest->error_vert_cap = 0;
+  // position 0 in the subnode and list pools stands for "none"
+  FOREST_TABLE_GROW(forest->sub_table, 0, forest->sub_size, struct Subnode);
+  memset(&forest->sub_table[0], 0, sizeof(struct Subnode));
+  forest->sub_cap = 1;
+  forest->zn_cap = 0;
+  FOREST_TABLE_GROW(forest->list_table, 0, forest->list_size, unsigned);
+  forest->list_table[0] = 0;
+  forest->list_cap = 1;
+
+  // parser states are stamped with a frontier number, no need to clear them
+  // unless the parser has grown, or the frontier number wraps around
+  Parser* parser = forest->parser;
+  if (forest->state_size < parser->state_cap || forest->frontier >= UINT_MAX - 1) {
+    FREE(forest->state_vertex);
+    FREE(forest->state_stamp);
+    forest->state_size = parser->state_cap;
+    MALLOC_N(unsigned, forest->state_vertex, forest->state_size);
+    MALLOC_N(unsigned, forest->state_stamp, forest->state_size);
+    forest->frontier = 0;
+  }
+  ++forest->frontier;
+  edge_reset(&forest->vert_nodes);
+  edge_reset(&forest->node_links);
+  edge_reset(&forest->node_index);
+  edge_reset(&forest->inter_index);
+}
+
+static void forest_update_high(Forest* forest) {
+  ForestStats* high = &forest->high;
+  if (high->nodes < forest->node_cap) high->nodes = forest->node_cap;
+  if (high->vertices < forest->vert_cap) high->vertices = forest->vert_cap;
+  if (high->rr < forest->rr_cap) high->rr = forest->rr_cap;
+  if (high->er < forest->er_cap) high->er = forest->er_cap;
+  // the path table is emptied after each reduction, so use its allocated size
+  if (high->paths < forest->path_size) high->paths = forest->path_size;
+  if (high->subnodes < forest->sub_cap) high->subnodes = forest->sub_cap;
+  if (high->znodes < forest->zn_cap) high->znodes = forest->zn_cap;
+  if (high->lists < forest->list_cap) high->lists = forest->list_cap;
+  unsigned long arena = arena_size(&forest->arena);
+  if (high->arena < arena) high->arena = arena;
+}
+
+static void forest_free_tables(Forest* forest) {
+  FREE(forest->node_table);
+  forest->node_size = 0;
+  FREE(forest->vert_table);
+  forest->vert_size = 0;
+  FREE(forest->rr_table);
+  forest->rr_size = 0;
+  FREE(forest->er_table);
+  forest->er_size = 0;
+  FREE(forest->path_table);
+  forest->path_size = 0;
+  FREE(forest->sub_table);
+  forest->sub_size = 0;
+  FREE(forest->zn_table);
+  forest->zn_size = 0;
+  FREE(forest->list_table);
+  forest->list_size = 0;
 }
 
 static void forest_show_vertex(Forest* forest, unsigned vertex_index) {
   struct Vertex* V = &forest->vert_table[vertex_index];
-  printf(" v_%d_%ld", V->Start, V->State - forest->parser->states);
+  printf(" v_%d_%u", V->Start, V->State);
 }
 
-static unsigned forest_next_symbol(Forest* forest, Slice text, unsigned pos, Symbol** symbol) {
-  *symbol = 0;
-  do {
-    // skip whitespace
-    while (pos < text.len && (text.ptr[pos] == ' ' || text.ptr[pos] == '\t')) ++pos;
+// The symbol table is never modified while parsing; a word that is not in it
+// gets a symbol that only lives until the forest is cleared.  Such a symbol
+// has no rulesets, so it can be any lexical category, and its index must not
+// clash with that of any other symbol.
+static Symbol* forest_unknown_word(Forest* forest, Slice name) {
+  unsigned h = symtab_hash(name, 1) % FOREST_UNKNOWN_MAX;
+  for (Symbol* word = forest->unknown[h]; word != 0; word = word->nxt_hash) {
+    if (slice_equal(word->name, name)) return word;
+  }
+  Symbol* word = arena_alloc(&forest->arena, sizeof(Symbol));
+  memset(word, 0, sizeof(Symbol));
+  word->index = forest->parser->symtab->symbol_counter + forest->unknown_cap++;
+  word->name = name;
+  word->literal = 1;
+  word->nxt_hash = forest->unknown[h];
+  forest->unknown[h] = word;
+  return word;
+}
 
-    // ran out? done
-    if (pos >= text.len) break;
+// find the symbol for a word, which is an unknown word if it is not a literal
+static Symbol* forest_word_symbol(Forest* forest, Slice name) {
+  Symbol* symbol = 0;
+  if (name.len && scanner_match(&forest->parser->scanner, name, 0, &symbol) == name.len) return symbol;
+  return forest_unknown_word(forest, name);
+}
+
+// push the symbols for a word: the literals it is made of, taking the longest
+// one each time, if it is made only of literals (as in "7+2"); otherwise the
+// word itself, as an unknown word.  A word is only split where one of the
+// two literals meeting there ends in punctuation, so that words made of
+// other words ("agirl", "into") are left alone.
+static void forest_push_word(Forest* forest, Slice word) {
+  Scanner* scanner = &forest->parser->scanner;
+  Symbol* symbol = 0;
+  unsigned len = scanner_match(scanner, word, 0, &symbol);
+  if (len == word.len) {
+    forest_advance(forest, symbol);
+    return;
+  }
 
-    // work line by line -- good for an interactive session
-    if (text.ptr[pos] == '\n') {
-      ++pos;
+  // make sure all of it is literals before pushing any of them
+  unsigned pos = len;
+  while (len && pos < word.len) {
+    if (isalnum((unsigned char) word.ptr[pos - 1]) && isalnum((unsigned char) word.ptr[pos])) {
+      len = 0;
       break;
     }
-
-    // gather non-space characters as symbol name
-    unsigned beg = pos;
-    while (pos < text.len && !isspace(text.ptr[pos])) ++pos;
-    Slice name = slice_from_memory(text.ptr + beg, pos - beg);
-    *symbol = symtab_lookup(forest->parser->symtab, name, 1, 1);
-    ++forest->position;
-  } while (0);
-
-  LOG_DEBUG("symbol %p [%.*s]", *symbol, *symbol ? (*symbol)->name.len : 0, *symbol ? (*symbol)->name.ptr : 0);
-  return pos;
+    len = scanner_match(scanner, word, pos, &symbol);
+    pos += len;
+  }
+  if (!len) {
+    forest_advance(forest, forest_unknown_word(forest, word));
+    return;
+  }
+  for (pos = 0; pos < word.len; pos += len) {
+    len = scanner_match(scanner, word, pos, &symbol);
+    LOG_DEBUG("literal [%.*s] in word [%.*s]", len, word.ptr + pos, word.len, word.ptr);
+    forest_advance(forest, symbol);
+    if (!forest_frontier_size(forest)) break;
+  }
 }
 
-static unsigned forest_add_subnode(Forest* forest, Symbol* symbol, struct Subnode* Sn) {
+static unsigned forest_add_subnode(Forest* forest, Symbol* symbol, unsigned Sn, RuleSet* rs) {
   unsigned Size = symbol->literal ? 1
        : (Sn == 0) ? 0
-       : Sn->Size;
-  struct Node* Nd = 0;
-  unsigned N = 0;
-  for (N = forest->node_pos; N < forest->node_cap; ++N) {
-    Nd = &forest->node_table[N];
-    if (Nd->symbol == symbol && Nd->Size == Size) break;
-  }
-  if (N >= forest->node_cap) {
-    TABLE_CHECK_GROW(forest->node_table, forest->node_cap, 8, struct Node);
-    N = forest->node_cap++;
-    Nd = &forest->node_table[N];
-    Nd->symbol = symbol;
-    Nd->Size = Size;
-    Nd->Start = symbol->literal ? forest->position - 1
-              : (Sn == 0) ? forest->position
-              : forest->node_table[Sn->Cur].Start;
-    Nd->sub_cap = 0;
-    Nd->sub_table = 0;
+       : forest->sub_table[Sn].Size;
+  // nodes are unique by symbol, start and size; all nodes in the current
+  // frontier end here, so symbol and size are enough to find them
+  unsigned N = forest->node_cap;
+  if (!edge_lookup(&forest->node_index, symbol->index, Size, &N)) {
+    unsigned Start = symbol->literal ? forest->position - 1
+                   : (Sn == 0) ? forest->position
+                   : forest->node_table[forest->sub_table[Sn].Cur].Start;
+    forest_add_node(forest, symbol, Start, Size);
   }
   if (!symbol->literal) {
-    unsigned S;
-    for (S = 0; S < Nd->sub_cap; ++S) {
-      if (subnode_equal(Nd->sub_table[S], Sn)) break;
-    }
-    if (S >= Nd->sub_cap) {
-      TABLE_CHECK_GROW(Nd->sub_table, Nd->sub_cap, 4, struct Subnode*);
-      // we are adding a reference to this Subnode, increment its reference count
-      // fix by gonzo
-      Nd->sub_table[Nd->sub_cap++] = REF(Sn);
-    } else {
-      subnode_free(Sn);
+    forest_add_branch(forest, &forest->node_table[N], Sn, rs);
+  }
+  return N;
+}
+
+static unsigned forest_add_node(Forest* forest, Symbol* symbol, unsigned Start, unsigned Size) {
+  FOREST_TABLE_GROW(forest->node_table, forest->node_cap, forest->node_size, struct Node);
+  unsigned N = forest->node_cap++;
+  struct Node* Nd = &forest->node_table[N];
+  Nd->symbol = symbol;
+  Nd->rule = 0;
+  Nd->dot = 0;
+  Nd->Start = Start;
+  Nd->Size = Size;
+  Nd->sub_cap = 0;
+  Nd->sub_list = 0;
+  Nd->sub_index = 0;
+  return N;
+}
+
+// add a branch to a node, built with a given rule (0 for lexical categories);
+// the rule is kept in the first subnode, and two rules with the same symbols
+// make two branches
+static void forest_add_branch(Forest* forest, struct Node* Nd, unsigned Sn, RuleSet* rs) {
+  if (Sn) forest->sub_table[Sn].rule = rs ? rs->index + 1 : 0;
+  if (node_has_branch(forest, Nd, Sn)) return;
+  Nd->sub_list = forest_list_grow(forest, Nd->sub_list, Nd->sub_cap);
+  forest->list_table[Nd->sub_list + Nd->sub_cap++] = Sn;
+  node_index_branches(forest, Nd);
+}
+
+// In a binarised forest, pack a tail with two or more nodes, starting at a
+// given position in a rule, into an intermediate node, so that all the ways
+// of parsing that tail over the same span are shared.
+static unsigned forest_pack_tail(Forest* forest, Symbol* lhs, RuleSet* rs, unsigned dot, unsigned Sn) {
+  if (!Sn || !forest->sub_table[Sn].next) return Sn;
+
+  // the position and size share a key; leave tails that do not fit as they are
+  unsigned Size = forest->sub_table[Sn].Size;
+  if (dot > 0xff || Size > 0xffffff) return Sn;
+  unsigned N = forest->node_cap;
+  if (!edge_lookup(&forest->inter_index, rs->index, Size << 8 | dot, &N)) {
+    forest_add_node(forest, lhs, forest->node_table[forest->sub_table[Sn].Cur].Start, Size);
+    struct Node* Nd = &forest->node_table[N];
+    Nd->rule = rs;
+    Nd->dot = dot;
+    if (forest->fcb && forest->fct && forest->fcb->intermediate) {
+      forest->fcb->intermediate(forest->fct, Nd->rule, dot);
     }
   }
+  forest_add_branch(forest, &forest->node_table[N], Sn, rs);
+  return subnode_create(forest, N, Size, 0);
+}
+
+// With a right-nulled parser, find or create the node for a nullable symbol
+// deriving the empty string here, with a branch for each of its rules that
+// can do so.  The node is complete as soon as it is created, and is shared
+// by all the reductions that need it.
+static unsigned forest_add_epsilon_node(Forest* forest, Symbol* symbol) {
+  unsigned N = forest->node_cap;
+  if (edge_lookup(&forest->node_index, symbol->index, 0, &N)) return N;
+  forest_add_node(forest, symbol, forest->position, 0);
+  // the node is already in the index, so that cyclic rules find it
+  for (unsigned rs_index = 0; rs_index < symbol->rs_cap; ++rs_index) {
+    RuleSet* rs = &symbol->rs_table[rs_index];
+    Symbol** R = rs->rules;
+    while (*R && parser_nullable(forest->parser, *R)) ++R;
+    if (*R) continue;
+    unsigned Sn = forest_nulled_tail(forest, symbol, rs, 0);
+    forest_add_branch(forest, &forest->node_table[N], Sn, rs);
+  }
   return N;
 }
 
-static unsigned forest_add_parser_state(Forest* forest, struct ParserState* state) {
-  for (unsigned V = forest->vert_pos; V < forest->vert_cap; ++V) {
-    struct Vertex* W = &forest->vert_table[V];
-    if (W->State == state) return V;
+// Build the tail of a rule from a given position, when it derives the empty
+// string, out of the nodes for each of its symbols.
+static unsigned forest_nulled_tail(Forest* forest, Symbol* lhs, RuleSet* rs, unsigned dot) {
+  unsigned Sn = 0;
+  for (unsigned pos = rs->len; pos > dot; --pos) {
+    if (forest->binarised) {
+      Sn = forest_pack_tail(forest, lhs, rs, pos, Sn);
+    }
+    Sn = subnode_create(forest, forest_add_epsilon_node(forest, rs->rules[pos - 1]), 0, Sn);
   }
-  TABLE_CHECK_GROW(forest->vert_table, forest->vert_cap, 8, struct Vertex);
+  return Sn;
+}
+
+static unsigned forest_add_parser_state(Forest* forest, unsigned state) {
+  // a state has at most one vertex in the current frontier
+  if (forest->state_stamp[state] == forest->frontier) return forest->state_vertex[state];
+  forest->state_stamp[state] = forest->frontier;
+  forest->state_vertex[state] = forest->vert_cap;
+  FOREST_TABLE_GROW(forest->vert_table, forest->vert_cap, forest->vert_size, struct Vertex);
   struct Vertex* W = &forest->vert_table[forest->vert_cap];
   W->State = state;
   W->Start = forest->position;
   W->Size = 0;
   W->List = 0;
-  for (unsigned E = 0; E < state->er_cap; ++E) {
-    forest_add_epsilon_reduction(forest, forest->vert_cap, state->er_table[E]);
+  struct ParserState* St = &forest->parser->states[state];
+  for (unsigned E = 0; E < St->er_cap; ++E) {
+    struct Epsilon* epsilon = &St->er_table[E];
+    if (!forest_lookahead_viable(forest, epsilon->la)) continue;
+    forest_add_epsilon_reduction(forest, forest->vert_cap, epsilon->lhs);
   }
   return forest->vert_cap++;
 }
@@ -367,23 +938,34 @@ static void forest_reduce_one_regular_reduction(Forest* forest, struct RRed* rr)
     forest->fcb->reduce_rule(forest->fct, rs);
   }
 
-  forest->path_table = 0;
   forest->path_cap = 0;
   unsigned path_index = 0;
-  struct ZNode* Zn = rr->Zn;
-  forest_add_subnode_link(forest, Zn, 0);
-  Symbol** R = rs->rules;
-  for (++R; *R != 0; ++R) {
+  // a right-nulled reduction pops fewer symbols than there are in its rule;
+  // the rest derives the empty string, and is the same for all paths
+  unsigned tail = 0;
+  if (Rd->len < rs->len) {
+    tail = forest_nulled_tail(forest, Rd->lhs, rs, Rd->len);
+    if (forest->binarised) {
+      tail = forest_pack_tail(forest, Rd->lhs, rs, Rd->len, tail);
+    }
+  }
+  forest_add_subnode_link(forest, rr->Zn, tail);
+  // position in rule where the tail in each path starts, for binarised forests
+  unsigned dot = Rd->len - 1;
+  for (unsigned popped = 1; popped < Rd->len; ++popped, --dot) {
     // NOTE: forest_add_subnode_link could change the value of forest->path_cap
     for (unsigned path_cap = forest->path_cap; path_index < path_cap; ++path_index) {
       struct Path* path = &forest->path_table[path_index];
-      struct Subnode* Sn = path->Sn;
-      Zn = path->Zn;
+      unsigned Sn = path->Sn;
+      struct ZNode* Zn = &forest->zn_table[path->Zn];
+      if (forest->binarised) {
+        Sn = forest_pack_tail(forest, Rd->lhs, rs, dot, Sn);
+      }
       for (unsigned vertex_pos = 0; vertex_pos < Zn->Size; ++vertex_pos) {
-        unsigned vertex_index = Zn->List[vertex_pos];
+        unsigned vertex_index = forest->list_table[Zn->List + vertex_pos];
         struct Vertex* V = &forest->vert_table[vertex_index];
         for (unsigned X = 0; X < V->Size; ++X) {
-          forest_add_subnode_link(forest, V->List[X], Sn);
+          forest_add_subnode_link(forest, forest->list_table[V->List + X], Sn);
         }
       }
     }
@@ -394,87 +976,75 @@ static void forest_reduce_one_regular_reduction(Forest* forest, struct RRed* rr)
   Symbol* L = Rd->lhs;
   for (; path_index < forest->path_cap; ++path_index) {
     struct Path* path = &forest->path_table[path_index];
-    struct Subnode* Sn = path->Sn;
-    Zn = path->Zn;
-    unsigned N = forest_add_subnode(forest, L, Sn);
+    unsigned N = forest_add_subnode(forest, L, path->Sn, rs);
+    struct ZNode* Zn = &forest->zn_table[path->Zn];
     for (unsigned vertex_pos = 0; vertex_pos < Zn->Size; ++vertex_pos) {
-      unsigned vertex_index = Zn->List[vertex_pos];
+      unsigned vertex_index = forest->list_table[Zn->List + vertex_pos];
       forest_add_vertex_node(forest, N, vertex_index);
+      // adding to the stack can move the stack node pool around
+      Zn = &forest->zn_table[path->Zn];
     }
   }
-  FREE(forest->path_table);
   forest->path_cap = 0;
 }
 
 static void forest_add_vertex_node(Forest* forest, unsigned N, unsigned vertex_index) {
   struct Node* Nd = &forest->node_table[N];
-  struct ParserState* S = forest_get_next_state(forest, forest->vert_table[vertex_index].State, Nd->symbol);
-  if (S == 0) return;
-#if 0
-  // on my M1 laptop, this does not work...
-  struct Vertex* W1 = &forest->vert_table[forest_add_parser_state(forest, S)];
-#else
-  // ... but this does -- compiler bug?
-  // fix by gonzo
+  unsigned S = parser_goto(forest->parser, forest->vert_table[vertex_index].State, Nd->symbol);
+  if (S == PARSER_NO_STATE) return;
   unsigned pos = forest_add_parser_state(forest, S);
   struct Vertex* W1 = &forest->vert_table[pos];
-#endif
-
-  struct ZNode* Z1 = 0;
-  unsigned Z;
-  for (Z = 0; Z < W1->Size; ++Z) {
-    Z1 = W1->List[Z];
-    if (Z1->Index == N) break;
-  }
-  if (Z >= W1->Size) {
-    TABLE_CHECK_GROW(W1->List, W1->Size, 4, struct ZNode*);
-    Z = W1->Size++;
-    Z1 = 0;
-    MALLOC(struct ZNode, Z1);
-    W1->List[Z] = Z1;
-    Z1->Index = N;
-    Z1->Size = 0;
-    Z1->List = 0;
-    for (unsigned R = 0; R < S->rr_cap; ++R) {
-      struct Reduce* Rd = &S->rr_table[R];
+
+  unsigned Z = W1->Size;
+  unsigned Z1 = forest->zn_cap;
+  if (edge_lookup(&forest->vert_nodes, pos, N, &Z)) {
+    Z1 = forest->list_table[W1->List + Z];
+  } else {
+    W1->List = forest_list_grow(forest, W1->List, W1->Size);
+    forest->list_table[W1->List + W1->Size++] = Z1;
+    FOREST_TABLE_GROW(forest->zn_table, forest->zn_cap, forest->zn_size, struct ZNode);
+    struct ZNode* Zn = &forest->zn_table[forest->zn_cap++];
+    Zn->Index = N;
+    Zn->Size = 0;
+    Zn->List = 0;
+    // with right-nulled reductions, those through an empty node were already
+    // done before getting here, with the node for the empty string
+    struct ParserState* St = &forest->parser->states[S];
+    unsigned reductions = St->rr_cap;
+    if (forest->parser->right_nulled && forest->node_table[N].Size == 0) reductions = 0;
+    for (unsigned R = 0; R < reductions; ++R) {
+      struct Reduce* Rd = &St->rr_table[R];
+      if (!forest_lookahead_viable(forest, Rd->la)) continue;
       // printf("AddRR for ruleset %u\n", Rd->rs.index);
       forest_add_regular_reduction(forest, Z1, Rd);
     }
   }
 
-  unsigned int I;
-  for (I = 0; I < Z1->Size; ++I) {
-    if (Z1->List[I] == vertex_index) break;
-  }
-  if (I >= Z1->Size) {
-    TABLE_CHECK_GROW(Z1->List, Z1->Size, 4, unsigned);
-    I = Z1->Size++;
-    Z1->List[I] = vertex_index;
+  struct ZNode* Zn = &forest->zn_table[Z1];
+  unsigned I = Zn->Size;
+  if (!edge_lookup(&forest->node_links, Z1, vertex_index, &I)) {
+    Zn->List = forest_list_grow(forest, Zn->List, Zn->Size);
+    forest->list_table[Zn->List + Zn->Size++] = vertex_index;
   }
 }
 
-static void forest_add_subnode_link(Forest* forest, struct ZNode* Zn, struct Subnode* Sn) {
-  struct Subnode* NewP = 0;
-  MALLOC(struct Subnode, NewP);
-  unsigned N = Zn->Index;
+static void forest_add_subnode_link(Forest* forest, unsigned Zn, unsigned Sn) {
+  unsigned N = forest->zn_table[Zn].Index;
   struct Node* Nd = &forest->node_table[N];
-  NewP->Size = Nd->Size;
+  unsigned Size = Nd->Size;
   if (Sn != 0) {
-    NewP->Size += Sn->Size;
-    REF(Sn);
-  }
-  NewP->Cur = N;
-  NewP->next = Sn;
-  NewP->ref_cnt = 0;
-  Sn = NewP;
-  TABLE_CHECK_GROW(forest->path_table, forest->path_cap, 8, struct Path);
+    Size += forest->sub_table[Sn].Size;
+  }
+  Sn = subnode_create(forest, N, Size, Sn);
+  // the path table is kept (and only grows) across reductions
+  FOREST_TABLE_GROW(forest->path_table, forest->path_cap, forest->path_size, struct Path);
   struct Path* path = &forest->path_table[forest->path_cap++];
   path->Zn = Zn;
   path->Sn = Sn;
 }
 
-static void forest_add_regular_reduction(Forest* forest, struct ZNode* Zn, struct Reduce* Rd) {
-  TABLE_CHECK_GROW(forest->rr_table, forest->rr_cap, 8, struct RRed);
+static void forest_add_regular_reduction(Forest* forest, unsigned Zn, struct Reduce* Rd) {
+  FOREST_TABLE_GROW(forest->rr_table, forest->rr_cap, forest->rr_size, struct RRed);
   struct RRed* rred = &forest->rr_table[forest->rr_cap];
   rred->Zn = Zn;
   rred->Rd = Rd;
@@ -482,42 +1052,204 @@ static void forest_add_regular_reduction(Forest* forest, struct ZNode* Zn, struc
 }
 
 static void forest_add_epsilon_reduction(Forest* forest, unsigned vertex_index, Symbol* LHS) {
-  TABLE_CHECK_GROW(forest->er_table, forest->er_cap, 8, struct ERed);
+  FOREST_TABLE_GROW(forest->er_table, forest->er_cap, forest->er_size, struct ERed);
   struct ERed* ered = &forest->er_table[forest->er_cap];
   ered->vertex_index = vertex_index;
   ered->LHS = LHS;
   ++forest->er_cap;
 }
 
-static struct ParserState* forest_get_next_state(Forest* forest, struct ParserState* state, Symbol* symbol) {
-  for (unsigned S = 0; S < state->ss_cap; ++S) {
-    struct Shift* Sh = &state->ss_table[S];
-    if (Sh->symbol == symbol) return &forest->parser->states[Sh->state];
+// Make room for one more element in a list in the list pool, with cap
+// elements from a given position.  As with arena_grow(), a full list (with a
+// power of 2 elements) is copied to the end of the pool, with twice the room.
+// Return the (possibly new) position of the list.
+static unsigned forest_list_grow(Forest* forest, unsigned list, unsigned cap) {
+  if (cap != 0 && (cap < FOREST_LIST_MIN || (cap & (cap - 1)) != 0)) return list;
+  unsigned grown = forest_list_alloc(forest, cap ? 2 * cap : FOREST_LIST_MIN);
+  if (cap) memcpy(&forest->list_table[grown], &forest->list_table[list], cap * sizeof(unsigned));
+  return grown;
+}
+
+// Take room for a number of elements at the end of the list pool.
+// Return the position of the first one.
+static unsigned forest_list_alloc(Forest* forest, unsigned room) {
+  while (forest->list_cap + room > forest->list_size) {
+    forest->list_size = forest->list_size ? 2 * forest->list_size : FOREST_TABLE_MIN;
+    REALLOC(unsigned, forest->list_table, forest->list_size);
   }
-  return 0;
+  unsigned list = forest->list_cap;
+  forest->list_cap += room;
+  return list;
 }
 
-static void subnode_free(struct Subnode* Sn) {
-  while (Sn != 0) {
-    struct Subnode* next = Sn->next;
-    UNREF(Sn);
-    if (Sn) break;
-    Sn = next;
+// A reduction is viable when one of the lexical categories of the next word
+// is in its lookahead set.  Unknown words can be any open category.
+static int forest_lookahead_viable(Forest* forest, unsigned char* la) {
+  if (!la) return 1;
+  Parser* parser = forest->parser;
+  unsigned eoi = parser->la_bits - 1;
+  Symbol* next = forest->lookahead;
+  if (!next) return !!PARSER_LOOKAHEAD_HAS(la, eoi);
+  if (next->rs_cap == 0) {
+    for (unsigned open_index = 0; open_index < parser->open_cap; ++open_index) {
+      Symbol* symbol = parser->open_table[open_index];
+      if (symbol->index < eoi && PARSER_LOOKAHEAD_HAS(la, symbol->index)) return 1;
+    }
+    return 0;
+  }
+  for (unsigned rs_index = 0; rs_index < next->rs_cap; ++rs_index) {
+    Symbol* symbol = *next->rs_table[rs_index].rules;
+    if (symbol->index < eoi && PARSER_LOOKAHEAD_HAS(la, symbol->index)) return 1;
   }
+  return 0;
+}
+
+static unsigned subnode_create(Forest* forest, unsigned N, unsigned Size, unsigned next) {
+  FOREST_TABLE_GROW(forest->sub_table, forest->sub_cap, forest->sub_size, struct Subnode);
+  unsigned S = forest->sub_cap++;
+  struct Subnode* Sn = &forest->sub_table[S];
+  Sn->Size = Size;
+  Sn->Cur = N;
+  Sn->next = next;
+  Sn->rule = 0;
+  uint64_t key = ((uint64_t) N << 32 | subnode_hash(forest, next)) * 0x9e3779b97f4a7c15ull;
+  Sn->hash = (unsigned) (key >> 32);
+  return S;
 }
 
-static int subnode_equal(struct Subnode* l, struct Subnode* r) {
-  for (; l != 0 && r != 0; l = l->next, r = r->next)
-    if (l->Size != r->Size || l->Cur != r->Cur) return 0;
+static int subnode_equal(Forest* forest, unsigned l, unsigned r) {
+  for (; l != 0 && r != 0; l = forest->sub_table[l].next, r = forest->sub_table[r].next) {
+    if (l == r) return 1; // shared tail
+    struct Subnode* L = &forest->sub_table[l];
+    struct Subnode* R = &forest->sub_table[r];
+    if (L->hash != R->hash || L->Size != R->Size || L->Cur != R->Cur) return 0;
+  }
   return l == r; // they were both exhausted at the same time
 }
 
+static unsigned subnode_hash(Forest* forest, unsigned Sn) {
+  return Sn ? forest->sub_table[Sn].hash : 0;
+}
+
+// branches are equal when they have the same rule and the same children
+static int branch_equal(Forest* forest, unsigned l, unsigned r) {
+  if (l && r && forest->sub_table[l].rule != forest->sub_table[r].rule) return 0;
+  return subnode_equal(forest, l, r);
+}
+
+// check whether a node already has a branch equal to a given subnode
+static int node_has_branch(Forest* forest, struct Node* Nd, unsigned Sn) {
+  unsigned hash = subnode_hash(forest, Sn);
+  unsigned* branches = &forest->list_table[Nd->sub_list];
+  if (!Nd->sub_index) {
+    for (unsigned S = 0; S < Nd->sub_cap; ++S) {
+      if (subnode_hash(forest, branches[S]) == hash && branch_equal(forest, branches[S], Sn)) return 1;
+    }
+    return 0;
+  }
+  unsigned* index = &forest->list_table[Nd->sub_index];
+  unsigned mask = node_index_mask(Nd->sub_cap);
+  for (unsigned pos = hash & mask; index[pos] != 0; pos = (pos + 1) & mask) {
+    unsigned other = branches[index[pos] - 1];
+    if (subnode_hash(forest, other) == hash && branch_equal(forest, other, Sn)) return 1;
+  }
+  return 0;
+}
+
+// add the last branch of a node to its hash index, building the index when
+// the node gets enough branches, and rebuilding it when it gets too full
+static void node_index_branches(Forest* forest, struct Node* Nd) {
+  unsigned cap = Nd->sub_cap;
+  if (cap < FOREST_BRANCH_INDEX) return;
+  unsigned mask = node_index_mask(cap);
+  unsigned first = cap - 1;
+  if (!Nd->sub_index || mask != node_index_mask(cap - 1)) {
+    Nd->sub_index = forest_list_alloc(forest, mask + 1);
+    memset(&forest->list_table[Nd->sub_index], 0, (mask + 1) * sizeof(unsigned));
+    first = 0;
+  }
+  unsigned* branches = &forest->list_table[Nd->sub_list];
+  unsigned* index = &forest->list_table[Nd->sub_index];
+  for (unsigned S = first; S < cap; ++S) {
+    unsigned pos = subnode_hash(forest, branches[S]) & mask;
+    while (index[pos] != 0) pos = (pos + 1) & mask;
+    index[pos] = S + 1;
+  }
+}
+
+// the branch index has room for (at least) twice the number of branches
+static unsigned node_index_mask(unsigned sub_cap) {
+  unsigned room = FOREST_BRANCH_INDEX;
+  while (room < sub_cap) room *= 2;
+  return 2 * room - 1;
+}
+
 static void node_show(struct Node* node) {
   Slice name = node->symbol->name;
-  if (node->symbol->literal) {
+  if (node->rule) {
+    // intermediate node: ruleset number and position, as in symbol_show()
+    printf(" %.*s#%u.%u_%d_%d", name.len, name.ptr, node->rule->index, node->dot, node->Start, node->Start + node->Size);
+  }
+  else if (node->symbol->literal) {
     printf(" \"%.*s\"", name.len, name.ptr);
   }
   else {
     printf(" %.*s_%d_%d", name.len, name.ptr, node->Start, node->Start + node->Size);
   }
 }
+
+// forget all entries in an edge hash table, in constant time
+static void edge_reset(EdgeHash* hash) {
+  hash->used = 0;
+  if (++hash->stamp == 0) {
+    if (hash->cap) memset(hash->table, 0, hash->cap * sizeof(struct Edge));
+    hash->stamp = 1;
+  }
+}
+
+static void edge_destroy(EdgeHash* hash) {
+  FREE(hash->table);
+  hash->cap = hash->used = 0;
+}
+
+// look for the value stored for a key, and return 1 if it was found;
+// otherwise store the given value for the key, and return 0
+static int edge_lookup(EdgeHash* hash, unsigned a, unsigned b, unsigned* value) {
+  if (2 * (hash->used + 1) > hash->cap) edge_grow(hash);
+  // multiplicative hashing of both numbers together, keeping the high bits
+  unsigned mask = hash->cap - 1;
+  uint64_t key = ((uint64_t) a << 32 | b) * 0x9e3779b97f4a7c15ull;
+  unsigned pos = (unsigned) (key >> 32) & mask;
+  for (;; pos = (pos + 1) & mask) {
+    struct Edge* edge = &hash->table[pos];
+    if (edge->stamp != hash->stamp) {
+      edge->a = a;
+      edge->b = b;
+      edge->value = *value;
+      edge->stamp = hash->stamp;
+      ++hash->used;
+      return 0;
+    }
+    if (edge->a == a && edge->b == b) {
+      *value = edge->value;
+      return 1;
+    }
+  }
+}
+
+// double the size of an edge hash table, keeping its current entries
+static void edge_grow(EdgeHash* hash) {
+  struct Edge* old = hash->table;
+  unsigned old_cap = hash->cap;
+  hash->cap = old_cap ? 2 * old_cap : 64;
+  hash->table = 0;
+  MALLOC_N(struct Edge, hash->table, hash->cap);
+  hash->used = 0;
+  for (unsigned E = 0; E < old_cap; ++E) {
+    struct Edge* edge = &old[E];
+    if (edge->stamp != hash->stamp) continue;
+    unsigned value = edge->value;
+    edge_lookup(hash, edge->a, edge->b, &value);
+  }
+  FREE(old);
+}
@@ -1,24 +1,83 @@
 #pragma once
 
 #include "slice.h"
+#include "arena.h"
+#include "scanner.h"
 
 struct RuleSet;
 
+enum {
+  FOREST_UNKNOWN_MAX = 0x40, // buckets for unknown words
+};
+
 // a node of a parse forest; it points to all possible parsed branches
+// in a binarised forest, the tail of a rule from a given position can also
+// get its own (intermediate) node, so that branches have at most two nodes
 struct Node {
   struct Symbol* symbol;     // symbol pointed to by this node
+  struct RuleSet* rule;      // rule for an intermediate node, 0 otherwise
+  unsigned dot;              //   position in rule where the node starts
   unsigned Start;
   unsigned Size;
-  struct Subnode** sub_table;// table of branches for node
-  unsigned sub_cap;          //   capacity of table
+  unsigned sub_list;         // list of branches for node, in forest list pool
+  unsigned sub_cap;          //   number of branches
+  unsigned sub_index;        //   positions in list, hashed by branch, for big lists; 0 if none
 };
 
+// Callbacks made while parsing: reduce_rule is called for every reduction
+// that is attempted, even those that end up in no parse, so values are best
+// computed afterwards, over a finished forest, with forest_evaluate().
 typedef struct ForestCallbacks {
   int (*new_token)(void* fct, Slice t);
   int (*reduce_rule)(void* fct, struct RuleSet* rs);
   int (*accept)(void* fct);
+  // optional, called when a binarised forest creates an intermediate node
+  int (*intermediate)(void* fct, struct RuleSet* rs, unsigned dot);
 } ForestCallbacks;
 
+// a semantic value, computed for a node by forest_evaluate()
+typedef union ForestValue {
+  long i;
+  double d;
+  void* p;
+} ForestValue;
+
+// Semantic actions for forest_evaluate(), which calls them for the nodes of
+// one derivation, children before parents, and each node only once.
+typedef struct ForestActions {
+  // compute the value of a token (a node for a literal)
+  ForestValue (*token)(void* ctx, struct Node* node);
+  // compute the value of a node from those of its children, left to right;
+  // rs is the rule the branch was built with, or null for a word in a lexical
+  // category
+  ForestValue (*rule)(void* ctx, struct Node* node, struct RuleSet* rs,
+                      struct Node** children, ForestValue* values, unsigned count);
+  // optional, pick a branch (from 0 to count - 1) of an ambiguous node;
+  // when missing, the first branch is used
+  unsigned (*choose)(void* ctx, struct Node* node, unsigned count);
+} ForestActions;
+
+// sizes of the tables used by a forest
+typedef struct ForestStats {
+  unsigned nodes;            // entries in node table
+  unsigned vertices;         // entries in vertex table
+  unsigned rr;               // entries in regular reductions table
+  unsigned er;               // entries in empty reductions table
+  unsigned paths;            // entries in path table
+  unsigned subnodes;         // entries in subnode pool
+  unsigned znodes;           // entries in stack node pool
+  unsigned lists;            // entries in list pool
+  unsigned long arena;       // bytes held by arena
+} ForestStats;
+
+// a hash table for the edges of the parsing stack, keyed by pairs of numbers
+typedef struct EdgeHash {
+  struct Edge* table;        // entries, a power of 2 of them
+  unsigned cap;              //   capacity of table
+  unsigned used;             //   entries in use
+  unsigned stamp;            //   entries with a different stamp are empty
+} EdgeHash;
+
 // a parse forest, which contains one or more parse trees
 typedef struct Forest {
   struct Parser* parser;     // the parser used to create this parse forest
@@ -26,25 +85,69 @@ typedef struct Forest {
   unsigned position;         // sequential position value
   ForestCallbacks* fcb;       // callbacks to execute
   void* fct;                 // context passed to callbacks
+  struct Symbol* lookahead;  // the next input symbol, not yet shifted
+  ScanWords words;           // words in the input, for one parse
+  int persistent;            // do tables keep their allocations across parses?
+  int binarised;             // build a binarised forest, with intermediate nodes?
+  ForestStats high;          // high-water marks for table sizes
+  unsigned error_position;   // position of the token where parsing failed, if it did
+  struct Symbol* error_symbol; //   that token, or 0 if the input ended too soon
+  unsigned error_vert_pos;   //   first vertex in the last frontier alive
+  unsigned error_vert_cap;   //   one past its last vertex
+  Arena arena;               // unknown words, for one parse
+  struct Symbol* unknown[FOREST_UNKNOWN_MAX]; // words not in the symbol table, for one parse
+  unsigned unknown_cap;      //   number of words
+
+  ForestValue* value_table;  // value of each node, set by forest_evaluate()
+  unsigned char* value_state;//   is it being evaluated, or done?
+  unsigned value_cap;        //   nodes in the last evaluation, 0 if none
+  unsigned value_size;       //   allocated elements in tables
 
   struct Node* root;         // root node of the forest
   struct Node* node_table;   // node table
   unsigned node_cap;         //   capacity of table
+  unsigned node_size;        //   allocated elements in table
   unsigned node_pos;         //   "current" element
 
   struct Vertex* vert_table; // vertex table
   unsigned vert_cap;         //   capacity of table
+  unsigned vert_size;        //   allocated elements in table
   unsigned vert_pos;         //   "current" element
 
-  struct Path* path_table;   // path table
+  unsigned* state_vertex;    // vertex for each parser state in current frontier
+  unsigned* state_stamp;     //   frontier where it was set, only valid if current
+  unsigned state_size;       //   allocated elements in tables
+  unsigned frontier;         // sequential number of current frontier, never reset
+
+  struct Subnode* sub_table; // subnode pool
+  unsigned sub_cap;          //   capacity of table
+  unsigned sub_size;         //   allocated elements in table
+
+  struct ZNode* zn_table;    // stack node pool
+  unsigned zn_cap;           //   capacity of table
+  unsigned zn_size;          //   allocated elements in table
+
+  unsigned* list_table;      // list pool: branches, stack nodes, predecessors
+  unsigned list_cap;         //   capacity of table
+  unsigned list_size;        //   allocated elements in table
+
+  EdgeHash vert_nodes;       // position of stack nodes in a vertex, by vertex and node
+  EdgeHash node_links;       // predecessor vertices of stack nodes, by stack node and vertex
+  EdgeHash node_index;       // nodes in current frontier, by symbol and size
+  EdgeHash inter_index;      // intermediate nodes in current frontier, by rule, size and position
+
+  struct Path* path_table;   // path table, reused by each reduction
   unsigned path_cap;         //   capacity of table
+  unsigned path_size;        //   allocated elements in table
 
   struct RRed* rr_table;     // regular reductions table (non-empty right-hand side)
   unsigned rr_cap;           //   capacity of table
+  unsigned rr_size;          //   allocated elements in table
   unsigned rr_pos;           //   "current" element
 
   struct ERed* er_table;     // empty reductions table (right-hand side empty)
   unsigned er_cap;           //   capacity of table
+  unsigned er_size;          //   allocated elements in table
   unsigned er_pos;           //   "current" element
 } Forest;
 
@@ -57,10 +160,63 @@ void forest_destroy(Forest* forest);
 // Clear all contents of a forest -- leave it as just created.
 void forest_clear(Forest* forest);
 
-// Parse some text, populating the parse forest, including its root node.
+// Keep the tables of a forest allocated across parses, pre-sizing them
+// for (at least) the given sizes, if any.
+void forest_reserve(Forest* forest, const ForestStats* stats);
+
+// Get the high-water marks for the table sizes of a forest, over all parses.
+void forest_stats(Forest* forest, ForestStats* stats);
+
+// Return the size of the current forest: its number of nodes, plus the
+// number of children in all the branches of all its nodes.
+unsigned long forest_size(Forest* forest);
+
+// Return the number of bytes taken by the nodes, branches and parsing stack
+// of the current forest.
+unsigned long forest_bytes(Forest* forest);
+
+// Parse some text as one sentence, populating the parse forest, including its
+// root node; newlines in the text are just white space.
 // Return 0 if all went well, or the number of errors found.
 unsigned forest_parse(Forest* forest, Slice text);
 
+// Parse input given one token at a time: call forest_begin(), then push each
+// token (as a symbol from the parser's symbol table, or as a word to look up
+// there), and finally call forest_end(), which works as forest_parse().
+// Reductions are filtered by the token that comes next, so each token is
+// shifted (and what it completes is reduced) when the next one is pushed.
+// Words must stay alive until the forest is cleared, as with forest_parse().
+// Once the stack dies, later tokens are ignored and make no callbacks.
+void forest_begin(Forest* forest);
+void forest_push_symbol(Forest* forest, struct Symbol* symbol);
+void forest_push_token(Forest* forest, Slice token);
+unsigned forest_end(Forest* forest);
+
+// Return the number of vertices in the current frontier of the parsing stack,
+// which holds all the tokens pushed but the last one; if it is 0 after a push,
+// the input can no longer be parsed.
+unsigned forest_frontier_size(Forest* forest);
+
+// Return the parser state for a vertex in the current frontier.
+unsigned forest_frontier_state(Forest* forest, unsigned index);
+
+// After a failed parse, find the symbols that would have been acceptable
+// where parsing failed (see error_position), by looking at the shifts from
+// the last frontier of the parsing stack still alive.  Store up to cap of them.
+// Return the number of symbols found, which can be more than cap.
+unsigned forest_expected(Forest* forest, struct Symbol** symbols, unsigned cap);
+
+// Evaluate one derivation of a parsed forest, calling the semantic actions
+// for its nodes with an explicit stack, so that deep forests are fine; the
+// value of each node is kept until the forest is cleared.  A derivation that
+// goes around a cycle gets an empty value where the cycle closes.
+// Return 0 if all went well, or the number of errors found.
+unsigned forest_evaluate(Forest* forest, ForestActions* actions, void* ctx, ForestValue* value);
+
+// Return the value computed for a node by the last forest_evaluate(), or 0
+// if the node was not part of the derivation evaluated.
+ForestValue* forest_node_value(Forest* forest, struct Node* node);
+
 // Print a forest in a human-readable format.
 void forest_show(Forest* forest);
 
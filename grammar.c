@@ -17,7 +17,7 @@
         .
  */
 
-typedef enum { EndT, StartT, EqTokenT, EqRuleT, OrT, IdenT, TermT } TokenType;
+typedef enum { EndT, StartT, OpenT, EqTokenT, EqRuleT, OrT, IdenT, TermT } TokenType;
 
 typedef struct Token {
   TokenType typ;
@@ -67,6 +67,14 @@ void grammar_show(Grammar* grammar) {
     printf("@ %.*s\n", grammar->start->name.len, grammar->start->name.ptr);
   }
 
+  unsigned open = 0;
+  for (Symbol* symbol = grammar->symtab->first; symbol != 0; symbol = symbol->nxt_list) {
+    if (!symbol->open) continue;
+    if (!open++) printf("\n%c open categories\n%c", FORMAT_COMMENT, GRAMMAR_OPEN);
+    printf(" %.*s", symbol->name.len, symbol->name.ptr);
+  }
+  if (open) printf("%c\n", GRAMMAR_TERMINATOR);
+
   printf("\n%c rules\n", FORMAT_COMMENT);
   for (Symbol* symbol = grammar->symtab->first; symbol != 0; symbol = symbol->nxt_list) {
     if (symbol->literal) continue;
@@ -124,6 +132,14 @@ unsigned grammar_compile_from_slice(Grammar* grammar, Slice source) {
         pos = input_flush(text, pos, &tok);
         break;
 
+      case OpenT:
+        // the lexical categories that unknown words can be
+        for (pos = input_token(text, pos, &tok); tok.typ == IdenT; pos = input_token(text, pos, &tok)) {
+          symtab_lookup(grammar->symtab, tok.val, 0, 1)->open = 1;
+        }
+        pos = input_flush(text, pos, &tok);
+        break;
+
       case OrT:
         LOG_WARN("corrupt rule");
         pos = input_flush(text, pos, &tok);
@@ -142,7 +158,7 @@ unsigned grammar_compile_from_slice(Grammar* grammar, Slice source) {
           sym_pos = sym_buf;
           *sym_pos++ = lhs;
           *sym_pos++ = 0;
-          symbol_insert_rule(symtab_lookup(grammar->symtab, lhs->name, 1, 1), sym_buf, sym_pos, &grammar->symtab->rules_counter, 0);
+          symbol_insert_rule(symtab_lookup(grammar->symtab, lhs->name, 1, 1), &grammar->symtab->rhs, sym_buf, sym_pos, &grammar->symtab->rules_counter, 0);
           break;
 
         case EqTokenT:
@@ -150,7 +166,7 @@ unsigned grammar_compile_from_slice(Grammar* grammar, Slice source) {
           *sym_pos++ = lhs;
           *sym_pos++ = 0;
           for (pos = input_token(text, pos, &tok); tok.typ == IdenT; pos = input_token(text, pos, &tok)) {
-            symbol_insert_rule(symtab_lookup(grammar->symtab, tok.val, 1, 1), sym_buf, sym_pos, &grammar->symtab->rules_counter, 0);
+            symbol_insert_rule(symtab_lookup(grammar->symtab, tok.val, 1, 1), &grammar->symtab->rhs, sym_buf, sym_pos, &grammar->symtab->rules_counter, 0);
           }
           break;
 
@@ -165,7 +181,7 @@ unsigned grammar_compile_from_slice(Grammar* grammar, Slice source) {
               exit(1);
             }
             *sym_pos++ = 0;
-            symbol_insert_rule(lhs, sym_buf, sym_pos, &grammar->symtab->rules_counter, 0);
+            symbol_insert_rule(lhs, &grammar->symtab->rhs, sym_buf, sym_pos, &grammar->symtab->rules_counter, 0);
           } while (tok.typ == OrT);
           break;
 
@@ -241,6 +257,10 @@ static unsigned grammar_check(Grammar* grammar) {
   for (Symbol* symbol = grammar->symtab->first; symbol != 0; symbol = symbol->nxt_list) {
     ++total;
     if (symbol->literal) continue;
+    if (symbol->open && symbol->rs_cap > 0) {
+      LOG_WARN("symbol [%.*s] has rules, it cannot be an open category.\n", symbol->name.len, symbol->name.ptr);
+      ++errors;
+    }
     if (symbol->defined) continue;
     LOG_WARN("symbol [%.*s] undefined.\n", symbol->name.len, symbol->name.ptr);
     ++errors;
@@ -347,6 +367,11 @@ static unsigned input_token(Slice text, unsigned pos, Token* tok) {
       ++pos;
       break;
     }
+    if (text.ptr[pos] == GRAMMAR_OPEN) {
+      tok->typ = OpenT;
+      ++pos;
+      break;
+    }
     if (text.ptr[pos] == GRAMMAR_EQ_TOKEN) {
       tok->typ = EqTokenT;
       ++pos;
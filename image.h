@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+
+// A binary image of a compiled parser and its symbol table, laid out so that
+// it can be mmap'ed and used right away, without any parsing.
+//
+// All integers are 32 bits, in native byte order (the magic number doubles as
+// a byte order mark).  Offsets are relative to the start of the image, and
+// every section is aligned to 4 bytes.  Entries refer to each other by their
+// position in the corresponding section.
+//
+// The symbol hash table holds the position of each symbol (or IMAGE_NONE, for
+// an empty slot), using linear probing from slot (hash & (slot_cap - 1)); it
+// always has some empty slots.
+
+enum {
+  IMAGE_MAGIC        = 0x544d5450,   // "TMTP"
+  IMAGE_VERSION      = 6,
+};
+
+// marks the end of a chain, or a missing entry
+#define IMAGE_NONE UINT32_MAX
+
+// the header, at offset 0
+typedef struct ImageHeader {
+  uint32_t magic;            // IMAGE_MAGIC
+  uint32_t version;          // IMAGE_VERSION
+  uint32_t size;             // size of the whole image in bytes
+
+  uint32_t symbol_cap;       // number of symbols
+  uint32_t rules_counter;    // counter for ruleset indexes
+  uint32_t ruleset_cap;      // number of rulesets
+  uint32_t rhs_cap;          // number of symbols in all right-hand sides
+  uint32_t slot_cap;         // number of slots in symbol hash table, a power of 2
+  uint32_t state_cap;        // number of states
+  uint32_t shift_cap;        // number of shifts (and gotos)
+  uint32_t reduce_cap;       // number of reductions
+  uint32_t epsilon_cap;      // number of epsilon reductions
+  uint32_t open_cap;         // number of open lexical categories
+  uint32_t la_bits;          // size of lookahead sets, 0 if there are none
+  uint32_t right_nulled;     // are there right-nulled reductions?
+  uint32_t goto_used;        // layout of goto table, see enum ParserGotoLayout
+  uint32_t goto_symbols;     // number of columns in goto table
+  uint32_t goto_cap;         // number of entries in goto table
+  uint32_t scan_state_cap;   // number of scanner states
+  uint32_t scan_edge_cap;    // number of scanner edges
+
+  uint32_t names;            // offset of symbol names, all together
+  uint32_t symbols;          // offset of ImageSymbol table
+  uint32_t rulesets;         // offset of ImageRuleSet table
+  uint32_t rhs;              // offset of right-hand sides, symbol positions
+  uint32_t slots;            // offset of symbol hash table, see symtab_hash()
+  uint32_t states;           // offset of ImageState table
+  uint32_t shifts;           // offset of ImageShift table
+  uint32_t reduces;          // offset of ImageReduce table
+  uint32_t epsilons;         // offset of ImageEpsilon table
+  uint32_t opens;            // offset of open lexical categories, symbol positions
+  uint32_t goto_base;        // offset of goto table base, for comb layout
+  uint32_t goto_next;        // offset of goto table entries
+  uint32_t goto_check;       // offset of goto table checks, for comb layout
+  uint32_t scan_states;      // offset of scanner states, see struct ScanState
+  uint32_t scan_edges;       // offset of scanner edges, see struct ScanEdge
+} ImageHeader;
+
+typedef struct ImageSymbol {
+  uint32_t name;             // offset of name
+  uint32_t name_len;         // length of name
+  uint32_t literal;          // is this a literal?
+  uint32_t defined;          // was there a definition for this symbol?
+  uint32_t open;             // was this declared an open lexical category?
+  uint32_t rs_first;         // position of first ruleset
+  uint32_t rs_cap;           // number of rulesets
+  uint32_t hash;             // hash of name and literal
+} ImageSymbol;
+
+typedef struct ImageRuleSet {
+  uint32_t index;            // sequential ruleset number
+  uint32_t rhs_first;        // position of first symbol, list ends with IMAGE_NONE
+  uint32_t rhs_len;          // number of symbols in right-hand side
+} ImageRuleSet;
+
+typedef struct ImageState {
+  uint32_t final;            // is this a final state?
+  uint32_t ss_first;         // position of first shift
+  uint32_t ss_cap;           // number of shifts
+  uint32_t rr_first;         // position of first reduction
+  uint32_t rr_cap;           // number of reductions
+  uint32_t er_first;         // position of first epsilon reduction
+  uint32_t er_cap;           // number of epsilon reductions
+} ImageState;
+
+typedef struct ImageShift {
+  uint32_t symbol;           // symbol causing the shift
+  uint32_t state;            // state to change to
+} ImageShift;
+
+typedef struct ImageReduce {
+  uint32_t lhs;              // left-hand side symbol
+  uint32_t ruleset;          // position of the ruleset
+  uint32_t len;              // number of symbols to pop
+  uint32_t la;               // offset of lookahead set, or IMAGE_NONE
+} ImageReduce;
+
+typedef struct ImageEpsilon {
+  uint32_t lhs;              // left-hand side symbol
+  uint32_t la;               // offset of lookahead set, or IMAGE_NONE
+} ImageEpsilon;
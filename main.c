@@ -1,114 +1,63 @@
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include "log.h"
 #include "buffer.h"
 #include "timer.h"
 #include "util.h"
 #include "symbol.h"
+#include "parser.h"
 #include "forest.h"
 #include "tomita.h"
 
-#define MAX_BUF (1024*1024)
+// passed as the sentence delimiter when sentences end with a blank line
+#define DELIMITER_BLANK_LINE (-1)
 
-#if 1
-#define PUSH(c, v) do { (c)->stack[(c)->spos++] = v; if ((c)->spos >= 100) printf("FUCK PUSH\n"); } while (0)
-#define POP(c) ((c)->spos == 0 ? printf("FUCK POP\n") : (c)->stack[--(c)->spos])
-#define CHECK(c, l) assert((c)->spos >= (l))
-#else
-#define PUSH(c, v) do { } while (0)
-#define POP(c) 0
-#define CHECK(c, l) 0
-#endif
-
-typedef struct Context {
-  int stack[100];
-  int spos;
-} Context;
-
-static int new_token(void* fct, Slice t) {
-  Context* context = (Context*) fct;
-  PUSH(context, t.ptr[0]);
-  printf("new_token: [%c] (%.*s)\n", t.ptr[0], t.len, t.ptr);
-  return 0;
+// Semantic actions to evaluate sentences for examples/expr.grammar, where the
+// rules are numbered like this:
+//   0: Expr : Term           3: Term : Factor         6: Factor : digit
+//   1:      | Expr '-' Term  4:      | Term '*' Factor 7:        | '(' Expr ')'
+//   2:      | Expr '+' Term  5:      | Term '/' Factor 8:        | '-' Factor
+static ForestValue expr_token(void* ctx, struct Node* node) {
+  UNUSED(ctx);
+  ForestValue value = { .i = 0 };
+  Slice name = node->symbol->name;
+  if (name.len == 1 && isdigit((unsigned char) name.ptr[0])) value.i = name.ptr[0] - '0';
+  return value;
 }
 
-static int reduce_rule(void* fct, RuleSet* rs) {
-  Context* context = (Context*) fct;
-  int s = context->spos;
+static ForestValue expr_rule(void* ctx, struct Node* node, RuleSet* rs,
+                             struct Node** children, ForestValue* values, unsigned count) {
+  UNUSED(ctx);
+  UNUSED(node);
+  UNUSED(children);
+  ForestValue value = { .i = count > 0 ? values[0].i : 0 };
+  if (!rs) return value;
   switch (rs->index) {
-    case 0:
-      CHECK(context, 1);
-      break;
-    case 1: {
-      CHECK(context, 3);
-      int t = POP(context);
-      POP(context); // -
-      int e = POP(context);
-      PUSH(context, e - t);
+    case 1:
+      value.i = values[0].i - values[2].i;
       break;
-    }
-    case 2: {
-      CHECK(context, 3);
-      int t = POP(context);
-      POP(context); // +
-      int e = POP(context);
-      PUSH(context, e + t);
+    case 2:
+      value.i = values[0].i + values[2].i;
       break;
-    }
-    case 3:
-      CHECK(context, 1);
+    case 4:
+      value.i = values[0].i * values[2].i;
       break;
-    case 4: {
-      CHECK(context, 3);
-      int f = POP(context);
-      POP(context); // *
-      int t = POP(context);
-      PUSH(context, t * f);
+    case 5:
+      value.i = values[2].i ? values[0].i / values[2].i : 0;
       break;
-    }
-    case 5: {
-      CHECK(context, 3);
-      int f = POP(context);
-      POP(context); // /
-      int t = POP(context);
-      PUSH(context, t / f);
+    case 7:
+      value.i = values[1].i;
       break;
-    }
-    case 6: {
-      CHECK(context, 1);
-      int d = POP(context);
-      PUSH(context, d - '0');
+    case 8:
+      value.i = -values[1].i;
       break;
-    }
-    case 7: {
-      CHECK(context, 3);
-      POP(context); // )
-      int e = POP(context);
-      POP(context); // (
-      PUSH(context, e);
-      break;
-    }
-    case 8: {
-      CHECK(context, 2);
-      int f = POP(context);
-      POP(context); // -
-      PUSH(context, -f);
-      break;
-    }
     default:
-      printf("WTF?!?\n");
       break;
   }
-  printf("reduce rule %u; %u -> %u\n", rs->index, s, context->spos);
-  return 0;
-}
-
-static int accept(void* fct) {
-  Context* context = (Context*) fct;
-  int v = POP(context);
-  printf("Final value: %d\n", v);
-  printf("Final stack pos: %d\n", context->spos);
-  return 0;
+  return value;
 }
 
 static char* opt_grammar_file = 0;
@@ -117,16 +66,78 @@ static int opt_compiled_grammar = 0;
 static int opt_stack = 0;
 static int opt_stdin = 0;
 static int opt_table = 0;
+static int opt_lr1 = 0;
+static int opt_binarised = 0;
+static int opt_compare = 0;
+static unsigned opt_synthetic = 0;
+static char* opt_parser_image = 0;
+static char* opt_write_image = 0;
+static int opt_map = 0;
+static int opt_evaluate = 0;
+static int opt_delimiter = '\n';
+static char* opt_cache_dir = 0;
+
+// Generate a grammar with a given number of rules, to time table
+// construction on something bigger than our examples.  Nonterminals refer
+// to each other after a leading category, so that closures stay small and
+// the number of states grows linearly with the number of rules.
+static void synthesize_grammar(unsigned rules, Buffer* b) {
+  unsigned categories = 16;
+  unsigned symbols = (rules + 2) / 3;
+  for (unsigned j = 0; j < symbols; ++j) {
+    unsigned c = j % categories;
+    buffer_format_print(b, "N%u : c%u N%u c%u\n", j, c, j + 1, (c + 3) % categories);
+    buffer_format_print(b, "   | N%u c%u\n", j, (c * 7 + 1) % categories);
+    buffer_format_print(b, "   | c%u N%u\n", (c + 5) % categories, (j * 13 + 5) % symbols);
+    buffer_format_print(b, "   ;\n");
+  }
+  buffer_format_print(b, "N%u : c0;\n", symbols);
+  buffer_format_print(b, "@ N0;\n");
+  for (unsigned c = 0; c < categories; ++c) {
+    buffer_format_print(b, "c%u = w%u;\n", c, c);
+  }
+}
+
+// tell where parsing failed, and what could have been there instead
+static void show_parse_error(Forest* forest) {
+  Symbol* expected[16];
+  unsigned count = forest_expected(forest, expected, ALEN(expected));
+  Buffer names; buffer_build(&names);
+  for (unsigned j = 0; j < count && j < ALEN(expected); ++j) {
+    buffer_format_print(&names, " %.*s", expected[j]->name.len, expected[j]->name.ptr);
+  }
+  if (count > ALEN(expected)) buffer_append_string(&names, " ...", 0);
+  Symbol* symbol = forest->error_symbol;
+  if (symbol) {
+    LOG_WARN("cannot parse token %u [%.*s], expected one of:%.*s",
+             forest->error_position, symbol->name.len, symbol->name.ptr, names.len, names.ptr);
+  } else {
+    LOG_WARN("input ended after %u tokens, expected one of:%.*s",
+             forest->error_position, names.len, names.ptr);
+  }
+  buffer_destroy(&names);
+}
 
 static unsigned process_line(Tomita* tomita, Slice line) {
   unsigned errors = 0;
   LOG_INFO("parsing line [%.*s]", line.len, line.ptr);
   do {
     errors = tomita_forest_parse_from_slice(tomita, line);
-    if (errors) break;
+    if (errors) {
+      show_parse_error(tomita->forest);
+      break;
+    }
     LOG_INFO("parsed input, got forest:");
     forest_show(tomita->forest);
 
+    if (opt_evaluate) {
+      ForestActions actions = { expr_token, expr_rule, 0 };
+      ForestValue value = { .i = 0 };
+      if (!forest_evaluate(tomita->forest, &actions, 0, &value)) {
+        printf("Final value: %ld\n", value.i);
+      }
+    }
+
     if (opt_stack) {
       LOG_INFO("parse stack:");
       forest_show_stack(tomita->forest);
@@ -135,26 +146,169 @@ static unsigned process_line(Tomita* tomita, Slice line) {
   return errors;
 }
 
+// read sentences from a stream, however long they are
 static unsigned process_file(Tomita* tomita, FILE* fp) {
+  char* buf = 0;
+  size_t cap = 0;
+  Buffer sentence; buffer_build(&sentence);
+  int delimiter = opt_delimiter == DELIMITER_BLANK_LINE ? '\n' : opt_delimiter;
   while (fp) {
-    char buf[MAX_BUF];
-    if (!fgets(buf, MAX_BUF, fp)) break;
-    Slice raw = slice_from_string(buf, 0);
-    Slice line = slice_trim(raw);
-    process_line(tomita, line);
+    ssize_t len = getdelim(&buf, &cap, delimiter, fp);
+    if (len < 0) break;
+    if (len > 0 && buf[len - 1] == delimiter) --len;
+    Slice chunk = slice_trim(slice_from_memory(buf, len));
+    if (opt_delimiter != DELIMITER_BLANK_LINE) {
+      // an empty sentence can be valid too
+      process_line(tomita, chunk);
+      continue;
+    }
+    // lines are gathered until a blank one
+    if (chunk.len) {
+      buffer_append_slice(&sentence, chunk);
+      buffer_append_byte(&sentence, '\n');
+      continue;
+    }
+    if (sentence.len) process_line(tomita, slice_trim(buffer_slice(&sentence)));
+    buffer_clear(&sentence);
+  }
+  if (sentence.len) process_line(tomita, slice_trim(buffer_slice(&sentence)));
+  buffer_destroy(&sentence);
+  free(buf);
+  return 0;
+}
+
+// find the end of the sentence that starts at pos, and where the next one
+// starts; a mapped file can be larger than a slice, so offsets are size_t
+static size_t sentence_end(const char* text, size_t len, size_t pos, size_t* next) {
+  int delimiter = opt_delimiter == DELIMITER_BLANK_LINE ? '\n' : opt_delimiter;
+  while (pos < len) {
+    const char* p = memchr(text + pos, delimiter, len - pos);
+    if (!p) break;
+    size_t end = p - text;
+    if (opt_delimiter != DELIMITER_BLANK_LINE) {
+      *next = end + 1;
+      return end;
+    }
+    // a blank line has nothing but white space up to its newline
+    size_t q = end + 1;
+    while (q < len && text[q] != '\n' && isspace((unsigned char) text[q])) ++q;
+    if (q < len && text[q] == '\n') {
+      *next = q + 1;
+      return end;
+    }
+    pos = q;
+  }
+  *next = len;
+  return len;
+}
+
+// map a file, and parse its sentences right where they are, without copies
+static unsigned process_map(Tomita* tomita, const char* path) {
+  size_t len = 0;
+  const char* text = file_map(path, &len);
+  if (!text) {
+    LOG_INFO("could not map input file [%s]", path);
+    return 0;
   }
+  for (size_t pos = 0; pos < len; ) {
+    size_t next = 0;
+    size_t end = sentence_end(text, len, pos, &next);
+    if (end - pos > UINT32_MAX) {
+      LOG_WARN("skipping sentence at offset %zu in [%s], too long: %zu bytes", pos, path, end - pos);
+    } else {
+      // runs of blank lines only separate sentences
+      Slice sentence = slice_trim(slice_from_memory(text + pos, end - pos));
+      if (sentence.len || opt_delimiter != DELIMITER_BLANK_LINE) process_line(tomita, sentence);
+    }
+    pos = next;
+  }
+  file_unmap(text, len);
   return 0;
 }
 
+static unsigned build_parser(Tomita* tomita, Buffer* data) {
+  unsigned errors = 0;
+  do {
+    Timer timer;
+
+    buffer_clear(data);
+    if (opt_synthetic) {
+      timer_start(&timer);
+      synthesize_grammar(opt_synthetic, data);
+      timer_stop(&timer);
+      LOG_INFO("generated %u bytes for synthetic grammar with %u rules in %luus",
+               data->len, opt_synthetic, timer_elapsed_us(&timer));
+    } else {
+      timer_start(&timer);
+      file_slurp(opt_grammar_file, data);
+      timer_stop(&timer);
+      if (data->len == 0) {
+        LOG_INFO("could not read grammar file [%s]", opt_grammar_file);
+        ++errors;
+        break;
+      };
+      LOG_INFO("read %u bytes from grammar file [%s] in %luus",
+               data->len, opt_grammar_file, timer_elapsed_us(&timer));
+    }
+    if (opt_read_grammar) {
+      LOG_INFO("read grammar:\n%.*s", data->len, data->ptr);
+    }
+
+    Slice source = buffer_slice(data);
+    Slice text_grammar = slice_trim(source);
+    if (opt_lr1) tomita_parser_set_mode(tomita, PARSER_MODE_LR1);
+
+    // the grammar itself is only needed to show it or to compare tables
+    if (opt_cache_dir && !opt_compiled_grammar && !opt_compare) {
+      unsigned hit = 0;
+      timer_start(&timer);
+      errors = tomita_parser_build_cached(tomita, text_grammar, opt_cache_dir, &hit);
+      timer_stop(&timer);
+      if (errors) break;
+      LOG_INFO("%s start: %s parser with %u states %s cache [%s] in %luus",
+               hit ? "warm" : "cold", parser_mode_name(tomita->parser->mode), tomita->parser->state_cap,
+               hit ? "mapped from" : "built and saved into", opt_cache_dir, timer_elapsed_us(&timer));
+      break;
+    }
+
+    timer_start(&timer);
+    errors = tomita_grammar_compile_from_slice(tomita, text_grammar);
+    timer_stop(&timer);
+    if (errors) break;
+    LOG_INFO("compiled grammar from source in %luus", timer_elapsed_us(&timer));
+
+    if (opt_compiled_grammar) tomita_grammar_show(tomita);
+    if (opt_compare) tomita_parser_report(tomita);
+
+    timer_start(&timer);
+    errors = tomita_parser_build_from_grammar(tomita);
+    timer_stop(&timer);
+    if (errors) break;
+    LOG_INFO("built %s parser with %u states from grammar in %luus",
+             parser_mode_name(tomita->parser->mode), tomita->parser->state_cap, timer_elapsed_us(&timer));
+  } while (0);
+  return errors;
+}
+
 static void show_usage(const char* prog) {
   printf(
-      "Usage: %s -f file [-gts] file ...\n"
+      "Usage: %s -f file [-gtsec1b] file ...\n"
       "   -f      use this grammar file (required)\n"
+      "   -S n    use a synthetic grammar with n rules instead of -f\n"
+      "   -p file map a binary parser image from this file instead of -f\n"
+      "   -w file write a binary parser image into this file\n"
+      "   -C dir  cache parsers built from grammar files in this directory\n"
       "   -r      display read grammar\n"
       "   -g      display compiled grammar\n"
       "   -t      display parsing table\n"
+      "   -1      build canonical LR(1) parsing table\n"
+      "   -c      compare parsing tables built in each mode\n"
+      "   -b      build binarised parse forests, with intermediate nodes\n"
       "   -s      display parsing stack\n"
+      "   -e      evaluate sentences for examples/expr.grammar\n"
       "   -n      use stdin for input\n"
+      "   -m      map input files into memory instead of reading them\n"
+      "   -d x    end sentences with x: line (default), blank (line), or a byte\n"
       "   -h, -?  print this help\n",
       prog
     );
@@ -162,7 +316,7 @@ static void show_usage(const char* prog) {
 
 int main(int argc, char **argv) {
   int c;
-  while ((c = getopt(argc, argv, "rgtsnf:h?")) != -1) {
+  while ((c = getopt(argc, argv, "rgt1bcsenmd:f:S:p:w:C:h?")) != -1) {
     switch (c) {
       case 'r':
         opt_read_grammar = 1;
@@ -173,15 +327,54 @@ int main(int argc, char **argv) {
       case 't':
         opt_table = 1;
         break;
+      case '1':
+        opt_lr1 = 1;
+        break;
+      case 'b':
+        opt_binarised = 1;
+        break;
+      case 'c':
+        opt_compare = 1;
+        break;
       case 's':
         opt_stack = 1;
         break;
+      case 'e':
+        opt_evaluate = 1;
+        break;
       case 'n':
         opt_stdin = 1;
         break;
+      case 'm':
+        opt_map = 1;
+        break;
+      case 'd':
+        if (strcmp(optarg, "line") == 0) {
+          opt_delimiter = '\n';
+        } else if (strcmp(optarg, "blank") == 0) {
+          opt_delimiter = DELIMITER_BLANK_LINE;
+        } else if (strlen(optarg) == 1) {
+          opt_delimiter = (unsigned char) optarg[0];
+        } else {
+          show_usage(argv[0]);
+          return 0;
+        }
+        break;
       case 'f':
         opt_grammar_file = optarg;
         break;
+      case 'S':
+        opt_synthetic = atoi(optarg);
+        break;
+      case 'p':
+        opt_parser_image = optarg;
+        break;
+      case 'w':
+        opt_write_image = optarg;
+        break;
+      case 'C':
+        opt_cache_dir = optarg;
+        break;
       case 'h':
       case '?':
       default:
@@ -189,7 +382,7 @@ int main(int argc, char **argv) {
         return 0;
     }
   }
-  if (!opt_grammar_file) {
+  if (!opt_grammar_file && !opt_synthetic && !opt_parser_image) {
     show_usage(argv[0]);
     return 0;
   }
@@ -202,31 +395,8 @@ int main(int argc, char **argv) {
     unsigned errors = 0;
     Timer timer;
 
-    buffer_clear(&data);
-    timer_start(&timer);
-    file_slurp(opt_grammar_file, &data);
-    timer_stop(&timer);
-    if (data.len == 0) {
-      LOG_INFO("could not read grammar file [%s]", opt_grammar_file);
-      break;
-    };
-    LOG_INFO("read %u bytes from grammar file [%s] in %luus",
-             data.len, opt_grammar_file, timer_elapsed_us(&timer));
-    if (opt_read_grammar) {
-      LOG_INFO("read grammar:\n%.*s", data.len, data.ptr);
-    }
-
-    ForestCallbacks cb = {
-      new_token,
-      reduce_rule,
-      accept,
-    };
-    Context context = {
-      .spos = 0,
-    };
     timer_start(&timer);
-    tomita = tomita_create(&cb, &context);
-    // tomita = tomita_create(0, 0);
+    tomita = tomita_create(0, 0);
     timer_stop(&timer);
     if (!tomita) {
       LOG_INFO("could not create tomita");
@@ -234,45 +404,54 @@ int main(int argc, char **argv) {
     };
     LOG_INFO("tomita created in %luus", timer_elapsed_us(&timer));
 
-    Slice source = buffer_slice(&data);
-    Slice text_grammar = slice_trim(source);
-    timer_start(&timer);
-    errors = tomita_grammar_compile_from_slice(tomita, text_grammar);
-    timer_stop(&timer);
-    if (errors) break;
-    LOG_INFO("compiled grammar from source in %luus", timer_elapsed_us(&timer));
-
-    if (opt_compiled_grammar) tomita_grammar_show(tomita);
-
-    timer_start(&timer);
-    errors = tomita_parser_build_from_grammar(tomita);
-    timer_stop(&timer);
-    if (errors) break;
-    LOG_INFO("built parser from grammar in %luus", timer_elapsed_us(&timer));
+    if (opt_parser_image) {
+      timer_start(&timer);
+      errors = tomita_parser_map_file(tomita, opt_parser_image);
+      timer_stop(&timer);
+      if (errors) break;
+      LOG_INFO("mapped parser with %u states from image file [%s] in %luus",
+               tomita->parser->state_cap, opt_parser_image, timer_elapsed_us(&timer));
+    } else {
+      errors = build_parser(tomita, &data);
+      if (errors) break;
+    }
 
-#if 0
-    Buffer tmp; buffer_build(&tmp);
-    tomita_parser_write_to_buffer(tomita, &tmp);
-    Slice written = buffer_slice(&tmp);
-    LOG_INFO("wrote parser\n%.*s\n", written.len, written.ptr);
-    tomita_clear(tomita);
-    tomita_parser_read_from_slice(tomita, written);
-    buffer_destroy(&tmp);
-#endif
+    if (opt_write_image) {
+      Buffer image; buffer_build(&image);
+      timer_start(&timer);
+      tomita_parser_write_image_to_buffer(tomita, &image);
+      unsigned written = file_spew(opt_write_image, buffer_slice(&image));
+      timer_stop(&timer);
+      LOG_INFO("wrote %u bytes to parser image file [%s] in %luus",
+               written, opt_write_image, timer_elapsed_us(&timer));
+      buffer_destroy(&image);
+    }
 
     if (opt_table) tomita_parser_show(tomita);
+    if (opt_binarised) tomita_forest_set_binarised(tomita, 1);
 
     if (opt_stdin) {
       errors = process_file(tomita, stdin);
     } else {
       for (int j = 0; j < argc; ++j) {
         LOG_INFO("ARG %u [%s]", j, argv[j]);
-        FILE* fp = fopen(argv[j], "r");
-        errors = process_file(tomita, fp);
-        fclose(fp);
+        if (opt_map) {
+          errors = process_map(tomita, argv[j]);
+        } else {
+          FILE* fp = fopen(argv[j], "r");
+          errors = process_file(tomita, fp);
+          if (fp) fclose(fp);
+        }
         if (errors) break;
       }
     }
+
+    if (tomita->forest) {
+      ForestStats high;
+      forest_stats(tomita->forest, &high);
+      LOG_INFO("forest high-water marks: %u nodes, %u vertices, %u + %u reductions, %u paths, %lu arena bytes",
+               high.nodes, high.vertices, high.rr, high.er, high.paths, high.arena);
+    }
   } while (0);
   buffer_destroy(&data);
   if (tomita) tomita_destroy(tomita);
@@ -1,13 +1,16 @@
+#include <limits.h>
 #include <stdio.h>
 #include "log.h"
 #include "mem.h"
+#include "arena.h"
 #include "util.h"
 #include "grammar.h"
+#include "image.h"
 #include "tomita.h"
 #include "symtab.h"
 #include "parser.h"
 
-// a reference-counted Item containing:
+// an Item containing:
 //   a LHS symbol
 //   a RHS ruleset
 //   a pointer to the current symbol in the ruleset being considered
@@ -15,31 +18,107 @@ struct Item {
   Symbol* lhs;               // left-hand side symbol
   RuleSet rs;                // ruleset in right-hand side
   Symbol** rhs_pos;          // pointer to "current" symbol
-  unsigned ref_cnt;          // reference count
 };
 
-// a list of Item pointers, with a Pre symbol
-// TODO: what is Pre?
+// a list of Items, with a Pre symbol: the symbol that was just before the
+// "current" symbol in all the items (the one shifted to get to them)
 struct Items {
-  Symbol* Pre;               // ???
-  struct Item** item_table;  // Item table
+  Symbol* Pre;               // symbol shifted into these items
+  struct Item* item_table;   // Item table
   unsigned item_cap;         //   capacity of table
 };
 
-static struct Item* item_make(Parser* parser, Symbol* LHS, Symbol** RHS, unsigned index);
-static struct Item* item_clone(struct Item* It);
-static void item_add(struct Items* Its, struct Item* It);
+// hash index for the kernels of the states built so far
+struct KernelIndex {
+  unsigned* bucket;          // first state in each bucket
+  unsigned bucket_cap;       //   capacity of table, a power of 2
+  unsigned* hash;            // hash of each state's kernel
+  unsigned* next;            // next state in the same bucket
+  unsigned size;             //   number of states indexed
+};
+
+// work area to build LR(0) tables
+struct Builder {
+  Parser* parser;
+  Arena arena;               // kernel items for all states
+  struct Items* kernels;     // kernel items for each state
+  struct KernelIndex index;  // to find states by their kernel
+  struct Item* closure;      // closure of the current state
+  unsigned closure_cap;      //   number of items
+  unsigned closure_max;      //   allocated items
+  unsigned* xpos;            // position in XTab plus one, per symbol index
+  struct Items* XTab;        // kernels reached from the current state
+  unsigned Xs;               //   number of kernels
+  unsigned XMax;             //   allocated kernels
+  struct Item* moved;        // storage for the items in XTab
+  unsigned moved_max;        //   allocated items
+};
+
+// the blocks holding the tables of a parser mapped from a binary image;
+// names, lookahead sets and the goto table are used in place
+struct ParserImage {
+  Slice file;                // mapped file, if we mapped it ourselves
+  struct Shift* shifts;      // all shifts, for all states
+  struct Reduce* reduces;    // all reductions, for all states
+  struct Epsilon* epsilons;  // all epsilon reductions, for all states
+};
+
+// work area to add right-nulled reductions, walking the gotos backwards;
+// there is no need to keep their symbols: all gotos into a state share one
+struct RightNulled {
+  Parser* parser;
+  unsigned* pred_first;      // first predecessor for each state (plus one sentinel)
+  unsigned* pred_state;      // predecessor states, for all states
+  unsigned added;            // number of reductions added
+};
+
 static int item_compare(struct Item* l, struct Item* r);
-static struct Items* items_get(Symbol* Pre, struct Items** XTab, unsigned* Xs, unsigned* XMax);
+static int item_sort(const void* l, const void* r);
+static unsigned item_hash(struct Item* It, unsigned hash);
+
+static void kernel_index_add(struct KernelIndex* index, unsigned state, unsigned hash);
+static void kernel_index_destroy(struct KernelIndex* index);
+
+static void builder_closure_add(struct Builder* work, struct Item* It);
+static unsigned builder_state_add(struct Builder* work, struct Item* items, unsigned item_cap);
 
 static void state_make(struct ParserState* state, unsigned char final, unsigned er_new, unsigned rr_new, unsigned ss_new);
-static int state_add(Parser* parser, struct Items** items_table, unsigned int Size, struct Item** List);
+static void state_conflicts(Parser* parser, struct ParserState* state, unsigned* sr, unsigned* rr);
+
+static unsigned goto_symbols(Parser* parser);
+static unsigned long goto_bytes(unsigned layout, unsigned states, unsigned long cap);
+static unsigned goto_comb(Parser* parser, unsigned symbols, unsigned** base, unsigned** next, unsigned** check);
+static void goto_compile(Parser* parser);
+static void goto_clear(Parser* parser);
+
+#if PARSER_LOOKAHEAD
+static struct ParserState* state_goto(Parser* parser, struct ParserState* state, Symbol* symbol);
+static void lookahead_compute(Parser* parser);
+static unsigned canonical_build(Parser* parser, Grammar* grammar);
+#endif
+static unsigned image_check(const ImageHeader* header, unsigned len);
+static unsigned image_check_entries(const ImageHeader* header);
+static unsigned image_check_goto(const ImageHeader* header);
+static unsigned image_bad(const char* what, unsigned j);
+
+static void nullable_compute(Parser* parser);
+static void open_compute(Parser* parser);
+static void right_nulled_build(Parser* parser);
+static void right_nulled_walk(struct RightNulled* work, unsigned state, struct Reduce* Rd, unsigned len);
+static void right_nulled_epsilon(Parser* parser, struct ParserState* state, Symbol* lhs, unsigned char* la);
+static unsigned char* right_nulled_la(Parser* parser, unsigned char* la);
+
+static void lookahead_show(Parser* parser, unsigned char* la);
+static void lookahead_save(Parser* parser, unsigned char* la, Buffer* b);
+static unsigned char* lookahead_load(Parser* parser, Slice line, unsigned pos);
 
 Parser* parser_create(SymTab* symtab) {
   Parser* parser = 0;
   MALLOC(Parser, parser);
   buffer_build(&parser->source);
+  scanner_build(&parser->scanner);
   parser->symtab = symtab;
+  parser->right_nulled = 1;
   return parser;
 }
 
@@ -50,59 +129,94 @@ void parser_destroy(Parser* parser) {
 }
 
 void parser_clear(Parser* parser) {
+  if (parser->image) {
+    // all tables are either in a few blocks or in the image itself
+    struct ParserImage* image = parser->image;
+    if (image->file.ptr && parser->symtab->image == (const ImageHeader*) image->file.ptr) {
+      // the symbols live in the file we are about to unmap
+      symtab_clear(parser->symtab);
+    }
+    FREE(image->shifts);
+    FREE(image->reduces);
+    FREE(image->epsilons);
+    file_unmap(image->file.ptr, image->file.len);
+    FREE(parser->image);
+    FREE(parser->states);
+    parser->goto_base = parser->goto_next = parser->goto_check = 0;
+  }
   if (parser->states) {
     for (unsigned j = 0; j < parser->state_cap; ++j) {
       struct ParserState* state = &parser->states[j];
+      for (unsigned k = 0; k < state->er_cap; ++k) {
+        FREE(state->er_table[k].la);
+      }
+      for (unsigned k = 0; k < state->rr_cap; ++k) {
+        FREE(state->rr_table[k].la);
+      }
       FREE(state->er_table);
       FREE(state->rr_table);
       FREE(state->ss_table);
     }
     FREE (parser->states);
   }
+  goto_clear(parser);
+  FREE(parser->nullable);
+  parser->nullable_cap = 0;
+  FREE(parser->open_table);
+  parser->open_cap = 0;
+  scanner_destroy(&parser->scanner);
   buffer_clear(&parser->source);
   parser->states = 0;
   parser->state_cap = 0;
+  parser->la_bits = 0;
 }
 
 unsigned parser_build_from_grammar(Parser* parser, Grammar* grammar) {
   parser_clear(parser);
   parser->symtab = grammar->symtab;
+  // all symbols are known by now; words in the input are looked up, never added
+  symtab_freeze(parser->symtab);
+  scanner_compile(&parser->scanner, parser->symtab);
+  nullable_compute(parser);
+  open_compute(parser);
+#if PARSER_LOOKAHEAD
+  if (parser->mode == PARSER_MODE_LR1) {
+    unsigned errors = canonical_build(parser, grammar);
+    right_nulled_build(parser);
+    goto_compile(parser);
+    return errors;
+  }
+#else
+  if (parser->mode != PARSER_MODE_LALR1) {
+    LOG_WARN("parser built without lookaheads, using %s", parser_mode_name(PARSER_MODE_LALR1));
+  }
+#endif
 
-  // Create initial state
-  Symbol** StartR = 0;
-  MALLOC_N(Symbol*, StartR, 2);
-  StartR[0] = grammar->start;
-  StartR[1] = 0;
-
-  struct Item** Its = 0;
-  MALLOC(struct Item*, Its);
-  Its[0] = item_make(parser, 0, StartR, 666);
-
-  struct Items* items_table = 0;
-  state_add(parser, &items_table, 1, Its);
-
-  struct Items* XTab = 0;
-  unsigned XMax = 0;
+  struct Builder work = {0};
+  work.parser = parser;
+  arena_build(&work.arena, 64 * 1024);
+  MALLOC_N(unsigned, work.xpos, parser->symtab->symbol_counter);
 
-  struct Item** QBuf = 0;
-  unsigned QMax = 0;
-  unsigned Qs = 0;
+  // Create initial state
+  Symbol* StartR[2] = { grammar->start, 0 };
+  struct Item start = { 0, { 666, 1, StartR }, StartR };
+  builder_state_add(&work, &start, 1);
 
   for (unsigned S = 0; S < parser->state_cap; ++S) {
-    struct Items* QS = &items_table[S];
-    if (QS->item_cap > QMax) {
-      QMax = QS->item_cap;
-      REALLOC(struct Item*, QBuf, QMax);
-    }
-    for (Qs = 0; Qs < QS->item_cap; ++Qs) {
-      QBuf[Qs] = REF(QS->item_table[Qs]);
+    // the closure: the kernel, plus the rules for every symbol after a dot;
+    // each such symbol also gets an entry in XTab
+    struct Items* kernel = &work.kernels[S];
+    work.closure_cap = 0;
+    for (unsigned K = 0; K < kernel->item_cap; ++K) {
+      builder_closure_add(&work, &kernel->item_table[K]);
     }
     unsigned ERs = 0;
     unsigned RRs = 0;
     unsigned char final = 0;
-    unsigned Xs = 0;
-    for (unsigned Q = 0; Q < Qs; ++Q) {
-      struct Item* It = QBuf[Q];
+    unsigned moved = 0;
+    work.Xs = 0;
+    for (unsigned Q = 0; Q < work.closure_cap; ++Q) {
+      struct Item* It = &work.closure[Q];
       if (*It->rhs_pos == 0) {
         if (It->lhs == 0) {
           ++final;
@@ -115,57 +229,93 @@ unsigned parser_build_from_grammar(Parser* parser, Grammar* grammar) {
         continue;
       }
 
-      Symbol* Pre = *It->rhs_pos++;
-      struct Items* IS = items_get(Pre, &XTab, &Xs, &XMax);
-      if (IS->item_cap == 0) {
-        if ((Qs + Pre->rs_cap) > QMax) {
-          QMax = Qs + Pre->rs_cap;
-          REALLOC(struct Item*, QBuf, QMax);
+      Symbol* Pre = *It->rhs_pos;
+      ++moved;
+      if (work.xpos[Pre->index] == 0) {
+        if (work.Xs >= work.XMax) {
+          work.XMax += 8;
+          REALLOC(struct Items, work.XTab, work.XMax);
         }
-        for (unsigned R = 0; R < Pre->rs_cap; ++R, ++Qs) {
-          QBuf[Qs] = item_make(parser, Pre, Pre->rs_table[R].rules, Pre->rs_table[R].index);
+        struct Items* IS = &work.XTab[work.Xs++];
+        IS->Pre = Pre;
+        IS->item_cap = 0;
+        work.xpos[Pre->index] = work.Xs;
+        for (unsigned R = 0; R < Pre->rs_cap; ++R) {
+          struct Item item = { Pre, Pre->rs_table[R], Pre->rs_table[R].rules };
+          builder_closure_add(&work, &item);
         }
       }
-      item_add(IS, It);
-      --It->rhs_pos;
+      ++work.XTab[work.xpos[Pre->index] - 1].item_cap;
     }
-    state_make(&parser->states[S], final, ERs, RRs, Xs);
+
+    // move the dot over Pre in all items, grouping them by Pre
+    if (moved > work.moved_max) {
+      work.moved_max = moved;
+      REALLOC(struct Item, work.moved, work.moved_max);
+    }
+    for (unsigned X = 0, pos = 0; X < work.Xs; ++X) {
+      work.XTab[X].item_table = work.moved + pos;
+      pos += work.XTab[X].item_cap;
+      work.XTab[X].item_cap = 0;
+    }
+    for (unsigned Q = 0; Q < work.closure_cap; ++Q) {
+      struct Item* It = &work.closure[Q];
+      if (*It->rhs_pos == 0) continue;
+      struct Items* IS = &work.XTab[work.xpos[(*It->rhs_pos)->index] - 1];
+      struct Item* next = &IS->item_table[IS->item_cap++];
+      *next = *It;
+      ++next->rhs_pos;
+    }
+
+    state_make(&parser->states[S], final, ERs, RRs, work.Xs);
     unsigned R = 0;
     unsigned E = 0;
-    for (unsigned Q = 0; Q < Qs; ++Q) {
-      struct Item* It = QBuf[Q];
+    for (unsigned Q = 0; Q < work.closure_cap; ++Q) {
+      struct Item* It = &work.closure[Q];
       if (*It->rhs_pos != 0 || It->lhs == 0) continue;
       if (*It->rs.rules == 0) {
-        parser->states[S].er_table[E++] = It->lhs;
+        parser->states[S].er_table[E++].lhs = It->lhs;
       } else {
         struct Reduce* Rd = &parser->states[S].rr_table[R++];
         Rd->lhs = It->lhs;
         Rd->rs = It->rs;
+        Rd->len = It->rhs_pos - It->rs.rules;
       }
     }
-    for (unsigned X = 0; X < Xs; ++X) {
-      struct Shift* Sh = &parser->states[S].ss_table[X];
-      Sh->symbol = XTab[X].Pre;
-      Sh->state = state_add(parser, &items_table, XTab[X].item_cap, XTab[X].item_table);
-    }
-    for (unsigned Q = 0; Q < Qs; ++Q) {
-        UNREF(QBuf[Q]);
-    }
-  }
-  FREE(XTab);
-  FREE(QBuf);
-  FREE(StartR);
+    for (unsigned X = 0; X < work.Xs; ++X) {
+      struct Items* IS = &work.XTab[X];
+      work.xpos[IS->Pre->index] = 0;
 
-  if (items_table) {
-    for (unsigned j = 0; j < parser->state_cap; ++j) {
-      struct Items* items = &items_table[j];
-      for (unsigned k = 0; k < items->item_cap; ++k) {
-        UNREF(items->item_table[k]);
+      // kernels are kept sorted and without duplicates
+      qsort(IS->item_table, IS->item_cap, sizeof(struct Item), item_sort);
+      unsigned size = 0;
+      for (unsigned I = 0; I < IS->item_cap; ++I) {
+        if (size > 0 && item_compare(&IS->item_table[size - 1], &IS->item_table[I]) == 0) continue;
+        IS->item_table[size++] = IS->item_table[I];
       }
-      FREE(items->item_table);
+      unsigned state = builder_state_add(&work, IS->item_table, size);
+
+      // careful: adding the state may have moved parser->states
+      struct Shift* Sh = &parser->states[S].ss_table[X];
+      Sh->symbol = IS->Pre;
+      Sh->state = state;
     }
-    FREE(items_table);
   }
+  LOG_DEBUG("built LR(0) table: %u states", parser->state_cap);
+
+  kernel_index_destroy(&work.index);
+  arena_destroy(&work.arena);
+  FREE(work.kernels);
+  FREE(work.closure);
+  FREE(work.xpos);
+  FREE(work.XTab);
+  FREE(work.moved);
+
+#if PARSER_LOOKAHEAD
+  lookahead_compute(parser);
+#endif
+  right_nulled_build(parser);
+  goto_compile(parser);
 
   return 0;
 }
@@ -176,6 +326,7 @@ void parser_show(Parser* parser) {
   printf("%c   normal shift:  t => state\n", FORMAT_COMMENT);
   printf("%c epsilon reduce:  [A -> state]\n", FORMAT_COMMENT);
   printf("%c  normal reduce:  [A => B t C]\n", FORMAT_COMMENT);
+  printf("%c      lookahead:  { t u $ }\n", FORMAT_COMMENT);
   printf("%c           goto:  A goto state\n", FORMAT_COMMENT);
   unsigned conflict_sr = 0;
   unsigned conflict_rr = 0;
@@ -184,8 +335,6 @@ void parser_show(Parser* parser) {
     printf("%d:\n", S);
 
     unsigned accept_count = 0;
-    unsigned reduce_count = 0;
-    unsigned shift_count = 0;
     for (unsigned pass = 0; pass < 5; ++pass) {
       switch (pass) {
         case 0:
@@ -197,10 +346,11 @@ void parser_show(Parser* parser) {
 
         case 2:
           for (unsigned j = 0; j < St->er_cap; ++j) {
-            Symbol* lhs = St->er_table[j];
-            Slice name = lhs->name;
-            printf("\t[%.*s -> 1]\n", name.len, name.ptr);
-            ++reduce_count;
+            struct Epsilon* epsilon = &St->er_table[j];
+            Slice name = epsilon->lhs->name;
+            printf("\t[%.*s -> 1]", name.len, name.ptr);
+            lookahead_show(parser, epsilon->la);
+            printf("\n");
           }
           break;
 
@@ -211,21 +361,27 @@ void parser_show(Parser* parser) {
             Slice ln = lhs->name;
             printf("\t[%.*s =>", ln.len, ln.ptr);
             for (Symbol** rhs = reduce->rs.rules; *rhs != 0; ++rhs) {
+              // right-nulled reductions show where they happen
+              if (rhs - reduce->rs.rules == reduce->len) printf(" .");
               Slice rn = (*rhs)->name;
               printf(" %.*s", rn.len, rn.ptr);
             }
-            printf("]\n");
-            ++reduce_count;
-          }
-          if (shift_count > 0 && reduce_count > 0) {
-            unsigned n = shift_count * reduce_count;
-            printf("\t\t*** %u shift/reduce conflict%s ***\n", n, n == 1 ? "" : "s");
-            conflict_sr += n;
+            printf("]");
+            lookahead_show(parser, reduce->la);
+            printf("\n");
           }
-          if (reduce_count > 1) {
-            unsigned n = reduce_count - 1;
-            printf("\t\t*** %u reduce/reduce conflict%s ***\n", n, n == 1 ? "" : "s");
-            conflict_rr += n;
+          {
+            unsigned sr = 0;
+            unsigned rr = 0;
+            state_conflicts(parser, St, &sr, &rr);
+            if (sr > 0) {
+              printf("\t\t*** %u shift/reduce conflict%s ***\n", sr, sr == 1 ? "" : "s");
+              conflict_sr += sr;
+            }
+            if (rr > 0) {
+              printf("\t\t*** %u reduce/reduce conflict%s ***\n", rr, rr == 1 ? "" : "s");
+              conflict_rr += rr;
+            }
           }
           break;
 
@@ -237,7 +393,6 @@ void parser_show(Parser* parser) {
             unsigned num_shift = symbol->literal ? 1 : !symbol->rs_cap;
             if (num_shift > 0) {
               printf("\t%.*s => %d\n", name.len, name.ptr, shift->state);
-              shift_count += num_shift;
             }
           }
           break;
@@ -257,8 +412,106 @@ void parser_show(Parser* parser) {
     }
   }
   printf("--------\n");
+  printf("%u total states\n", parser->state_cap);
   printf("%u total shift/reduce conflicts\n", conflict_sr);
   printf("%u total reduce/reduce conflicts\n", conflict_rr);
+  printf("%s goto table: %u states x %u symbols, %u entries, %lu bytes\n",
+         parser->goto_used == PARSER_GOTO_COMB ? "comb" : "dense",
+         parser->state_cap, parser->goto_symbols, parser->goto_cap,
+         goto_bytes(parser->goto_used, parser->state_cap, parser->goto_cap));
+}
+
+int parser_nullable(Parser* parser, Symbol* symbol) {
+  return symbol->index < parser->nullable_cap && parser->nullable[symbol->index];
+}
+
+unsigned parser_goto(Parser* parser, unsigned state, Symbol* symbol) {
+  unsigned column = symbol->index;
+  if (column >= parser->goto_symbols) return PARSER_NO_STATE;
+  if (parser->goto_used == PARSER_GOTO_COMB) {
+    unsigned pos = parser->goto_base[state] + column;
+    if (pos >= parser->goto_cap || parser->goto_check[pos] != state + 1) return PARSER_NO_STATE;
+    return parser->goto_next[pos] - 1;
+  }
+  return parser->goto_next[state * parser->goto_symbols + column] - 1;
+}
+
+const char* parser_mode_name(unsigned mode) {
+  switch (mode) {
+#if PARSER_LOOKAHEAD
+    case PARSER_MODE_LALR1: return "LALR(1)";
+#else
+    case PARSER_MODE_LALR1: return "LR(0)";
+#endif
+    case PARSER_MODE_LR1:   return "LR(1)";
+    default:                return "unknown";
+  }
+}
+
+void parser_stats(Parser* parser, ParserStats* stats) {
+  memset(stats, 0, sizeof(ParserStats));
+  stats->states = parser->state_cap;
+  stats->bytes = parser->state_cap * sizeof(struct ParserState);
+  unsigned la_bytes = PARSER_LOOKAHEAD_BYTES(parser->la_bits);
+  for (unsigned S = 0; S < parser->state_cap; ++S) {
+    struct ParserState* St = &parser->states[S];
+    for (unsigned j = 0; j < St->ss_cap; ++j) {
+      Symbol* symbol = St->ss_table[j].symbol;
+      if (symbol->literal || !symbol->rs_cap) {
+        ++stats->shifts;
+      } else {
+        ++stats->gotos;
+      }
+    }
+    stats->reduces += St->er_cap + St->rr_cap;
+    stats->bytes += St->ss_cap * sizeof(struct Shift);
+    stats->bytes += St->rr_cap * (sizeof(struct Reduce) + la_bytes);
+    stats->bytes += St->er_cap * (sizeof(struct Epsilon) + la_bytes);
+
+    unsigned sr = 0;
+    unsigned rr = 0;
+    state_conflicts(parser, St, &sr, &rr);
+    stats->conflict_sr += sr;
+    stats->conflict_rr += rr;
+  }
+
+  unsigned symbols = goto_symbols(parser);
+  stats->dense_bytes = goto_bytes(PARSER_GOTO_DENSE, parser->state_cap, (unsigned long) parser->state_cap * symbols);
+  unsigned* base = 0;
+  unsigned* next = 0;
+  unsigned* check = 0;
+  unsigned cap = goto_comb(parser, symbols, &base, &next, &check);
+  stats->comb_bytes = goto_bytes(PARSER_GOTO_COMB, parser->state_cap, cap);
+  FREE(check);
+  FREE(next);
+  FREE(base);
+}
+
+unsigned parser_report(Grammar* grammar) {
+  unsigned errors = 0;
+  printf("%c%c PARSER REPORT\n", FORMAT_COMMENT, FORMAT_COMMENT);
+  printf("%-8s %8s %8s %8s %8s %8s %8s %10s %10s %10s\n",
+         "mode", "states", "shifts", "gotos", "reduces", "s/r", "r/r", "bytes", "dense", "comb");
+  for (unsigned mode = 0; mode < PARSER_MODE_LAST; ++mode) {
+#if !PARSER_LOOKAHEAD
+    if (mode != PARSER_MODE_LALR1) continue;
+#endif
+    Parser* parser = parser_create(grammar->symtab);
+    parser->mode = mode;
+    unsigned e = parser_build_from_grammar(parser, grammar);
+    if (e) {
+      errors += e;
+    } else {
+      ParserStats stats;
+      parser_stats(parser, &stats);
+      printf("%-8s %8u %8u %8u %8u %8u %8u %10lu %10lu %10lu\n",
+             parser_mode_name(mode), stats.states, stats.shifts, stats.gotos,
+             stats.reduces, stats.conflict_sr, stats.conflict_rr, stats.bytes,
+             stats.dense_bytes, stats.comb_bytes);
+    }
+    parser_destroy(parser);
+  }
+  return errors;
 }
 
 unsigned parser_load_from_slice(Parser* parser, Slice source) {
@@ -266,6 +519,7 @@ unsigned parser_load_from_slice(Parser* parser, Slice source) {
   buffer_append_slice(&parser->source, source);
   Slice text = buffer_slice(&parser->source);
 
+  unsigned errors = 0;
   do {
     LOG_DEBUG("LOADING parser from slice");
     symtab_load_from_slice(parser->symtab, &text);
@@ -276,6 +530,7 @@ unsigned parser_load_from_slice(Parser* parser, Slice source) {
     unsigned rr_cap = 0;
     unsigned er_cap = 0;
     unsigned state_tot = 0;
+    unsigned open_loaded = 0;
     SliceLookup lookup_lines = {0};
     while (slice_tokenize_by_byte(text, '\n', &lookup_lines)) {
       Slice line = slice_trim(lookup_lines.result);
@@ -286,8 +541,18 @@ unsigned parser_load_from_slice(Parser* parser, Slice source) {
       ++pos;
 
       if (lead == FORMAT_PARSER) {
+        unsigned right_nulled = 0;
         pos = next_number(line, pos, &state_cap);
-        LOG_DEBUG("loaded parser: state_cap=%u", state_cap);
+        pos = next_number(line, pos, &parser->la_bits);
+        pos = next_number(line, pos, &right_nulled);
+        if (pos == 0) {
+          // older files have no length in their reductions, and cannot be used
+          LOG_WARN("parser: text parser has no right_nulled flag, it predates reduction lengths; rebuild it");
+          ++errors;
+          break;
+        }
+        parser->right_nulled = right_nulled;
+        LOG_DEBUG("loaded parser: state_cap=%u, la_bits=%u, right_nulled=%u", state_cap, parser->la_bits, right_nulled);
 
         // preallocate state table entries
         state_tot = parser->state_cap;
@@ -299,6 +564,21 @@ unsigned parser_load_from_slice(Parser* parser, Slice source) {
         state_tot = 0;
         continue;
       }
+      if (lead == FORMAT_OPEN) {
+        unsigned open_cap = 0;
+        pos = next_number(line, pos, &open_cap);
+        FREE(parser->open_table);
+        MALLOC_N(Symbol*, parser->open_table, open_cap);
+        for (parser->open_cap = 0; parser->open_cap < open_cap; ++parser->open_cap) {
+          unsigned index = 0;
+          pos = next_number(line, pos, &index);
+          if (pos == 0) break;
+          parser->open_table[parser->open_cap] = symtab_find_symbol_by_index(parser->symtab, index);
+        }
+        LOG_DEBUG("loaded %u open categories", parser->open_cap);
+        open_loaded = 1;
+        continue;
+      }
       if (lead == FORMAT_STATE) {
         ++state_tot;
         unsigned final = 0;
@@ -329,16 +609,20 @@ unsigned parser_load_from_slice(Parser* parser, Slice source) {
         int t = parser->states[state_tot-1].rr_cap++;
         unsigned lhs_index = 0;
         unsigned rs_index = 0;
+        unsigned len = 0;
         pos = next_number(line, pos, &lhs_index);
         pos = next_number(line, pos, &rs_index);
-        LOG_DEBUG("loaded reduce: lhs=%u rs=%u", lhs_index, rs_index);
+        pos = next_number(line, pos, &len);
+        LOG_DEBUG("loaded reduce: lhs=%u rs=%u len=%u", lhs_index, rs_index, len);
         struct Reduce* reduce = &parser->states[state_tot-1].rr_table[t];
         Symbol* lhs = symtab_find_symbol_by_index(parser->symtab, lhs_index);
         assert(lhs);
-        RuleSet* rs = symbol_find_ruleset_by_index(lhs, rs_index);
+        RuleSet* rs = symtab_find_ruleset_by_index(parser->symtab, rs_index);
         assert(rs);
         reduce->lhs = lhs;
         reduce->rs = *rs;
+        reduce->len = len;
+        reduce->la = lookahead_load(parser, line, pos);
         continue;
       }
       if (lead == FORMAT_EPSILON) {
@@ -346,9 +630,9 @@ unsigned parser_load_from_slice(Parser* parser, Slice source) {
         unsigned index = 0;
         pos = next_number(line, pos, &index);
         LOG_DEBUG("loaded epsilon: index=%u", index);
-        struct Symbol** epsilon = &parser->states[state_tot-1].er_table[t];
-        Symbol* symbol = symtab_find_symbol_by_index(parser->symtab, index);
-        *epsilon = symbol;
+        struct Epsilon* epsilon = &parser->states[state_tot-1].er_table[t];
+        epsilon->lhs = symtab_find_symbol_by_index(parser->symtab, index);
+        epsilon->la = lookahead_load(parser, line, pos);
         continue;
       }
       // found something else
@@ -357,10 +641,17 @@ unsigned parser_load_from_slice(Parser* parser, Slice source) {
       text.len -= used;
       break;
     }
+    if (errors) break;
     parser->state_cap = state_cap;
+    // older files have no open categories, find them as when building
+    if (!open_loaded) open_compute(parser);
+    symtab_freeze(parser->symtab);
+    scanner_compile(&parser->scanner, parser->symtab);
+    nullable_compute(parser);
+    goto_compile(parser);
   } while (0);
 
-  return 0;
+  return errors;
 }
 
 unsigned parser_save_to_buffer(Parser* parser, Buffer* b) {
@@ -369,12 +660,18 @@ unsigned parser_save_to_buffer(Parser* parser, Buffer* b) {
     errors = symtab_save_to_buffer(parser->symtab, b);
     if (errors) break;
 
-    buffer_format_print(b, "%c parser: table_size\n", FORMAT_COMMENT);
-    buffer_format_print(b, "%c %u\n", FORMAT_PARSER, parser->state_cap);;
+    buffer_format_print(b, "%c parser: table_size lookahead_bits right_nulled\n", FORMAT_COMMENT);
+    buffer_format_print(b, "%c %u %u %u\n", FORMAT_PARSER, parser->state_cap, parser->la_bits, parser->right_nulled);
+    buffer_format_print(b, "%c open categories: num_open symbol...\n", FORMAT_COMMENT);
+    buffer_format_print(b, "%c %u", FORMAT_OPEN, parser->open_cap);
+    for (unsigned j = 0; j < parser->open_cap; ++j) {
+      buffer_format_print(b, " %u", parser->open_table[j]->index);
+    }
+    buffer_format_print(b, "\n");
     buffer_format_print(b, "%c state (%u): final num_sa num_rr num_er\n", FORMAT_COMMENT, parser->state_cap);
     buffer_format_print(b, "%c   shift: symbol state\n", FORMAT_COMMENT);
-    buffer_format_print(b, "%c   reduce: lhs rule\n", FORMAT_COMMENT);
-    buffer_format_print(b, "%c   epsilon: symbol\n", FORMAT_COMMENT);
+    buffer_format_print(b, "%c   reduce: lhs rule len [num_la la...]\n", FORMAT_COMMENT);
+    buffer_format_print(b, "%c   epsilon: symbol [num_la la...]\n", FORMAT_COMMENT);
     for (unsigned j = 0; j < parser->state_cap; ++j) {
       struct ParserState* state = &parser->states[j];
       buffer_format_print(b, "%c %u %u %u %u\n", FORMAT_STATE, state->final, state->ss_cap, state->rr_cap, state->er_cap);
@@ -385,12 +682,16 @@ unsigned parser_save_to_buffer(Parser* parser, Buffer* b) {
 
       for (unsigned k = 0; k < state->rr_cap; ++k) {
         struct Reduce* reduce = &state->rr_table[k];
-        buffer_format_print(b, "%c %u %u\n", FORMAT_REDUCE, reduce->lhs->index, reduce->rs.index);
+        buffer_format_print(b, "%c %u %u %u", FORMAT_REDUCE, reduce->lhs->index, reduce->rs.index, reduce->len);
+        lookahead_save(parser, reduce->la, b);
+        buffer_format_print(b, "\n");
       }
 
       for (unsigned k = 0; k < state->er_cap; ++k) {
-        Symbol* symbol = state->er_table[k];
-        buffer_format_print(b, "%c %u\n", FORMAT_EPSILON, symbol->index);
+        struct Epsilon* epsilon = &state->er_table[k];
+        buffer_format_print(b, "%c %u", FORMAT_EPSILON, epsilon->lhs->index);
+        lookahead_save(parser, epsilon->la, b);
+        buffer_format_print(b, "\n");
       }
     }
   } while (0);
@@ -398,43 +699,295 @@ unsigned parser_save_to_buffer(Parser* parser, Buffer* b) {
   return errors;
 }
 
-static struct Item* item_make(Parser* parser, Symbol* LHS, Symbol** RHS, unsigned index) {
-  UNUSED(parser);
-  struct Item* It = 0;
-  MALLOC(struct Item, It);
-  REF(It);
-  It->lhs = LHS;
-  It->rs.index = index;
-  It->rhs_pos = It->rs.rules = RHS;
-  return It;
+unsigned parser_save_image(Parser* parser, Buffer* b) {
+  SymTab* symtab = parser->symtab;
+  unsigned errors = 0;
+  unsigned char* data = 0;
+  unsigned* rs_first = 0;
+  do {
+    // count everything, to lay out the sections
+    ImageHeader header = {0};
+    header.magic = IMAGE_MAGIC;
+    header.version = IMAGE_VERSION;
+    unsigned names_len = 0;
+    for (Symbol* symbol = symtab->first; symbol != 0; symbol = symbol->nxt_list) {
+      if (symbol->index != header.symbol_cap++) {
+        LOG_WARN("parser: symbol indexes are not sequential, cannot save image");
+        ++errors;
+        break;
+      }
+      names_len += symbol->name.len;
+      header.ruleset_cap += symbol->rs_cap;
+      for (unsigned R = 0; R < symbol->rs_cap; ++R) {
+        header.rhs_cap += symbol->rs_table[R].len + 1;
+      }
+    }
+    if (errors) break;
+    unsigned la_bytes = PARSER_LOOKAHEAD_BYTES(parser->la_bits);
+    unsigned la_cap = 0;
+    for (unsigned S = 0; S < parser->state_cap; ++S) {
+      struct ParserState* state = &parser->states[S];
+      header.shift_cap += state->ss_cap;
+      header.reduce_cap += state->rr_cap;
+      header.epsilon_cap += state->er_cap;
+      for (unsigned R = 0; R < state->rr_cap; ++R) la_cap += !!state->rr_table[R].la;
+      for (unsigned E = 0; E < state->er_cap; ++E) la_cap += !!state->er_table[E].la;
+    }
+    header.rules_counter = symtab->rules_counter;
+    header.slot_cap = 16;
+    while (header.slot_cap < 2 * header.symbol_cap) header.slot_cap *= 2;
+    header.state_cap = parser->state_cap;
+    header.la_bits = parser->la_bits;
+    header.right_nulled = parser->right_nulled;
+    header.goto_used = parser->goto_used;
+    header.goto_symbols = parser->goto_symbols;
+    header.goto_cap = parser->goto_cap;
+    header.open_cap = parser->open_cap;
+    header.scan_state_cap = parser->scanner.state_cap;
+    header.scan_edge_cap = parser->scanner.edge_cap;
+
+    unsigned pos = sizeof(ImageHeader);
+    header.symbols = pos;    pos += header.symbol_cap * sizeof(ImageSymbol);
+    header.rulesets = pos;   pos += header.ruleset_cap * sizeof(ImageRuleSet);
+    header.rhs = pos;        pos += header.rhs_cap * sizeof(uint32_t);
+    header.slots = pos;      pos += header.slot_cap * sizeof(uint32_t);
+    header.states = pos;     pos += header.state_cap * sizeof(ImageState);
+    header.shifts = pos;     pos += header.shift_cap * sizeof(ImageShift);
+    header.reduces = pos;    pos += header.reduce_cap * sizeof(ImageReduce);
+    header.epsilons = pos;   pos += header.epsilon_cap * sizeof(ImageEpsilon);
+    header.opens = pos;      pos += header.open_cap * sizeof(uint32_t);
+    header.goto_base = pos;  pos += (parser->goto_base ? header.state_cap : 0) * sizeof(uint32_t);
+    header.goto_next = pos;  pos += header.goto_cap * sizeof(uint32_t);
+    header.goto_check = pos; pos += (parser->goto_check ? header.goto_cap : 0) * sizeof(uint32_t);
+    header.scan_states = pos; pos += header.scan_state_cap * sizeof(struct ScanState);
+    header.scan_edges = pos; pos += header.scan_edge_cap * sizeof(struct ScanEdge);
+    unsigned la_pos = pos;   pos += (la_cap * la_bytes + 3) & ~3U;
+    header.names = pos;      pos += (names_len + 3) & ~3U;
+    header.size = pos;
+
+    MALLOC_N(unsigned char, data, header.size);
+    memcpy(data, &header, sizeof(ImageHeader));
+    ImageSymbol* symbols = (ImageSymbol*) (data + header.symbols);
+    ImageRuleSet* rulesets = (ImageRuleSet*) (data + header.rulesets);
+    uint32_t* rhs = (uint32_t*) (data + header.rhs);
+    uint32_t* slots = (uint32_t*) (data + header.slots);
+    memset(slots, 0xff, header.slot_cap * sizeof(uint32_t));
+
+    // symbols, their rulesets and their names
+    MALLOC_N(unsigned, rs_first, header.symbol_cap);
+    unsigned R = 0;
+    unsigned H = 0;
+    unsigned N = header.names;
+    for (Symbol* symbol = symtab->first; symbol != 0; symbol = symbol->nxt_list) {
+      ImageSymbol* is = &symbols[symbol->index];
+      is->name = N;
+      is->name_len = symbol->name.len;
+      memcpy(data + N, symbol->name.ptr, symbol->name.len);
+      N += symbol->name.len;
+      is->literal = symbol->literal;
+      is->defined = symbol->defined;
+      is->open = symbol->open;
+      is->rs_first = rs_first[symbol->index] = R;
+      is->rs_cap = symbol->rs_cap;
+      is->hash = symtab_hash(symbol->name, symbol->literal);
+      unsigned h = is->hash & (header.slot_cap - 1);
+      while (slots[h] != IMAGE_NONE) h = (h + 1) & (header.slot_cap - 1);
+      slots[h] = symbol->index;
+      for (unsigned k = 0; k < symbol->rs_cap; ++k, ++R) {
+        rulesets[R].index = symbol->rs_table[k].index;
+        rulesets[R].rhs_first = H;
+        rulesets[R].rhs_len = symbol->rs_table[k].len;
+        for (Symbol** rules = symbol->rs_table[k].rules; *rules; ++rules) {
+          rhs[H++] = (*rules)->index;
+        }
+        rhs[H++] = IMAGE_NONE;
+      }
+    }
+
+    // states and their actions
+    ImageState* states = (ImageState*) (data + header.states);
+    ImageShift* shifts = (ImageShift*) (data + header.shifts);
+    ImageReduce* reduces = (ImageReduce*) (data + header.reduces);
+    ImageEpsilon* epsilons = (ImageEpsilon*) (data + header.epsilons);
+    unsigned X = 0;
+    unsigned E = 0;
+    unsigned L = la_pos;
+    R = 0;
+    for (unsigned S = 0; S < parser->state_cap; ++S) {
+      struct ParserState* state = &parser->states[S];
+      states[S].final = state->final;
+      states[S].ss_first = X;
+      states[S].ss_cap = state->ss_cap;
+      states[S].rr_first = R;
+      states[S].rr_cap = state->rr_cap;
+      states[S].er_first = E;
+      states[S].er_cap = state->er_cap;
+      for (unsigned k = 0; k < state->ss_cap; ++k, ++X) {
+        shifts[X].symbol = state->ss_table[k].symbol->index;
+        shifts[X].state = state->ss_table[k].state;
+      }
+      for (unsigned k = 0; k < state->rr_cap; ++k, ++R) {
+        struct Reduce* reduce = &state->rr_table[k];
+        reduces[R].lhs = reduce->lhs->index;
+        reduces[R].ruleset = IMAGE_NONE;
+        for (unsigned r = 0; r < reduce->lhs->rs_cap; ++r) {
+          if (reduce->lhs->rs_table[r].index != reduce->rs.index) continue;
+          reduces[R].ruleset = rs_first[reduce->lhs->index] + r;
+          break;
+        }
+        reduces[R].len = reduce->len;
+        reduces[R].la = IMAGE_NONE;
+        if (reduce->la) {
+          reduces[R].la = L;
+          memcpy(data + L, reduce->la, la_bytes);
+          L += la_bytes;
+        }
+      }
+      for (unsigned k = 0; k < state->er_cap; ++k, ++E) {
+        struct Epsilon* epsilon = &state->er_table[k];
+        epsilons[E].lhs = epsilon->lhs->index;
+        epsilons[E].la = IMAGE_NONE;
+        if (epsilon->la) {
+          epsilons[E].la = L;
+          memcpy(data + L, epsilon->la, la_bytes);
+          L += la_bytes;
+        }
+      }
+    }
+
+    uint32_t* opens = (uint32_t*) (data + header.opens);
+    for (unsigned j = 0; j < parser->open_cap; ++j) {
+      opens[j] = parser->open_table[j]->index;
+    }
+
+    // the goto table, as it is
+    if (parser->goto_base) {
+      memcpy(data + header.goto_base, parser->goto_base, header.state_cap * sizeof(uint32_t));
+    }
+    if (parser->goto_next) {
+      memcpy(data + header.goto_next, parser->goto_next, header.goto_cap * sizeof(uint32_t));
+    }
+    if (parser->goto_check) {
+      memcpy(data + header.goto_check, parser->goto_check, header.goto_cap * sizeof(uint32_t));
+    }
+
+    // the scanner, also as it is
+    if (header.scan_state_cap) {
+      memcpy(data + header.scan_states, parser->scanner.states, header.scan_state_cap * sizeof(struct ScanState));
+    }
+    if (header.scan_edge_cap) {
+      memcpy(data + header.scan_edges, parser->scanner.edges, header.scan_edge_cap * sizeof(struct ScanEdge));
+    }
+
+    buffer_append_string(b, (const char*) data, header.size);
+    LOG_DEBUG("saved parser image: %u bytes, %u symbols, %u states", header.size, header.symbol_cap, header.state_cap);
+  } while (0);
+  FREE(rs_first);
+  FREE(data);
+  return errors;
 }
 
-static struct Item* item_clone(struct Item* It) {
-  struct Item* clone = 0;
-  MALLOC(struct Item, clone);
-  *clone = *It;
+unsigned parser_map_slice(Parser* parser, Slice image) {
+  parser_clear(parser);
+  unsigned errors = 0;
+  do {
+    const ImageHeader* header = (const ImageHeader*) image.ptr;
+    errors = image_check(header, image.len);
+    if (errors) break;
+    errors = symtab_map_image(parser->symtab, header);
+    if (errors) break;
 
-  // careful with the clone's reference count!
-  clone->ref_cnt = 0;
-  REF(clone);
+    // states and their actions go in one block each; no parsing, no lookups
+    const char* base = image.ptr;
+    const ImageState* states = (const ImageState*) (base + header->states);
+    const ImageShift* shifts = (const ImageShift*) (base + header->shifts);
+    const ImageReduce* reduces = (const ImageReduce*) (base + header->reduces);
+    const ImageEpsilon* epsilons = (const ImageEpsilon*) (base + header->epsilons);
+    Symbol* symbols = parser->symtab->image_symbols;
+    RuleSet* rulesets = parser->symtab->image_rulesets;
 
-  return clone;
+    struct ParserImage* mapped = 0;
+    MALLOC(struct ParserImage, mapped);
+    parser->image = mapped;
+    MALLOC_N(struct ParserState, parser->states, header->state_cap);
+    MALLOC_N(struct Shift, mapped->shifts, header->shift_cap);
+    MALLOC_N(struct Reduce, mapped->reduces, header->reduce_cap);
+    MALLOC_N(struct Epsilon, mapped->epsilons, header->epsilon_cap);
+    MALLOC_N(Symbol*, parser->open_table, header->open_cap);
+    for (unsigned X = 0; X < header->shift_cap; ++X) {
+      mapped->shifts[X].symbol = &symbols[shifts[X].symbol];
+      mapped->shifts[X].state = shifts[X].state;
+    }
+    for (unsigned R = 0; R < header->reduce_cap; ++R) {
+      mapped->reduces[R].lhs = &symbols[reduces[R].lhs];
+      mapped->reduces[R].rs = rulesets[reduces[R].ruleset];
+      mapped->reduces[R].len = reduces[R].len;
+      mapped->reduces[R].la = reduces[R].la == IMAGE_NONE ? 0 : (unsigned char*) (base + reduces[R].la);
+    }
+    for (unsigned E = 0; E < header->epsilon_cap; ++E) {
+      mapped->epsilons[E].lhs = &symbols[epsilons[E].lhs];
+      mapped->epsilons[E].la = epsilons[E].la == IMAGE_NONE ? 0 : (unsigned char*) (base + epsilons[E].la);
+    }
+    const uint32_t* opens = (const uint32_t*) (base + header->opens);
+    for (unsigned j = 0; j < header->open_cap; ++j) {
+      parser->open_table[j] = &symbols[opens[j]];
+    }
+    parser->open_cap = header->open_cap;
+    for (unsigned S = 0; S < header->state_cap; ++S) {
+      struct ParserState* state = &parser->states[S];
+      state->final = states[S].final;
+      state->ss_table = mapped->shifts + states[S].ss_first;
+      state->ss_cap = states[S].ss_cap;
+      state->rr_table = mapped->reduces + states[S].rr_first;
+      state->rr_cap = states[S].rr_cap;
+      state->er_table = mapped->epsilons + states[S].er_first;
+      state->er_cap = states[S].er_cap;
+    }
+    parser->state_cap = header->state_cap;
+    parser->la_bits = header->la_bits;
+    parser->right_nulled = header->right_nulled;
+    symtab_freeze(parser->symtab);
+    scanner_map(&parser->scanner, parser->symtab,
+                (const struct ScanState*) (base + header->scan_states), header->scan_state_cap,
+                (const struct ScanEdge*) (base + header->scan_edges), header->scan_edge_cap);
+    nullable_compute(parser);
+
+    parser->goto_used = header->goto_used;
+    parser->goto_symbols = header->goto_symbols;
+    parser->goto_cap = header->goto_cap;
+    parser->goto_next = (unsigned*) (base + header->goto_next);
+    if (header->goto_used == PARSER_GOTO_COMB) {
+      parser->goto_base = (unsigned*) (base + header->goto_base);
+      parser->goto_check = (unsigned*) (base + header->goto_check);
+    }
+    LOG_DEBUG("mapped parser image: %u bytes, %u states", header->size, header->state_cap);
+  } while (0);
+  return errors;
 }
 
-static void item_add(struct Items* Its, struct Item* It) {
-  unsigned I = 0;
-  for (I = 0; I < Its->item_cap; ++I) {
-    int Diff = item_compare(Its->item_table[I], It);
-    if (Diff == 0) return; // item exists
-    if (Diff > 0) break;   // found first greater item
-  }
-  TABLE_CHECK_GROW(Its->item_table, Its->item_cap, 4, struct Item*);
-  for (unsigned J = Its->item_cap++; J > I; --J) {
-    // make room for item
-    Its->item_table[J] = Its->item_table[J - 1];
-  }
-  // clone item into freed space
-  Its->item_table[I] = item_clone(It);
+unsigned parser_map_file(Parser* parser, const char* path) {
+  unsigned errors = 0;
+  size_t len = 0;
+  const char* ptr = file_map(path, &len);
+  do {
+    if (!ptr) {
+      LOG_WARN("parser: could not map file [%s]", path);
+      ++errors;
+      break;
+    }
+    if (len > UINT32_MAX) {
+      LOG_WARN("parser: image file [%s] is too large, %zu bytes", path, len);
+      ++errors;
+      break;
+    }
+    Slice file = slice_from_memory(ptr, len);
+    errors = parser_map_slice(parser, file);
+    if (errors) break;
+    parser->image->file = file;
+    ptr = 0;
+  } while (0);
+  file_unmap(ptr, len);
+  return errors;
 }
 
 static int item_compare(struct Item* l, struct Item* r) {
@@ -471,23 +1024,86 @@ static int item_compare(struct Item* l, struct Item* r) {
   return Diff;
 }
 
-static struct Items* items_get(Symbol* Pre, struct Items** XTab, unsigned* Xs, unsigned* XMax) {
-  LOG_DEBUG("items_get, Pre=%p, XTab=%p, Xs=%u, XMax=%u", Pre, *XTab, *Xs, *XMax);
-  unsigned X = 0;
-  for (X = 0; X < *Xs; ++X) {
-    if (Pre == (*XTab)[X].Pre) break;
+static int item_sort(const void* l, const void* r) {
+  return item_compare((struct Item*) l, (struct Item*) r);
+}
+
+static unsigned item_hash(struct Item* It, unsigned hash) {
+  hash = hash * 31 + (It->lhs ? It->lhs->index + 1 : 0);
+  hash = hash * 31 + (unsigned) (It->rhs_pos - It->rs.rules);
+  for (Symbol** rules = It->rs.rules; *rules; ++rules) {
+    hash = hash * 31 + (*rules)->index;
   }
-  if (X >= *Xs) {
-    if (*Xs >= *XMax) {
-      *XMax += 8;
-      REALLOC(struct Items, *XTab, *XMax);
+  return hash;
+}
+
+static void kernel_index_add(struct KernelIndex* index, unsigned state, unsigned hash) {
+  TABLE_CHECK_GROW(index->hash, index->size, 64, unsigned);
+  TABLE_CHECK_GROW(index->next, index->size, 64, unsigned);
+  index->hash[state] = hash;
+  ++index->size;
+  if (index->size > 2 * index->bucket_cap) {
+    // grow the buckets and put all states back in them
+    index->bucket_cap = index->bucket_cap ? 2 * index->bucket_cap : 64;
+    FREE(index->bucket);
+    MALLOC_N(unsigned, index->bucket, index->bucket_cap);
+    memset(index->bucket, 0xff, index->bucket_cap * sizeof(unsigned));
+    for (unsigned S = 0; S < index->size; ++S) {
+      unsigned B = index->hash[S] & (index->bucket_cap - 1);
+      index->next[S] = index->bucket[B];
+      index->bucket[B] = S;
     }
-    X = (*Xs)++;
-    (*XTab)[X].Pre = Pre;
-    (*XTab)[X].item_cap = 0;
-    (*XTab)[X].item_table = 0;
+    return;
   }
-  return &(*XTab)[X];
+  unsigned B = hash & (index->bucket_cap - 1);
+  index->next[state] = index->bucket[B];
+  index->bucket[B] = state;
+}
+
+static void kernel_index_destroy(struct KernelIndex* index) {
+  FREE(index->bucket);
+  FREE(index->hash);
+  FREE(index->next);
+}
+
+static void builder_closure_add(struct Builder* work, struct Item* It) {
+  if (work->closure_cap >= work->closure_max) {
+    work->closure_max += 64;
+    REALLOC(struct Item, work->closure, work->closure_max);
+  }
+  work->closure[work->closure_cap++] = *It;
+}
+
+// find or create the state with a given (sorted) kernel
+static unsigned builder_state_add(struct Builder* work, struct Item* items, unsigned item_cap) {
+  Parser* parser = work->parser;
+  unsigned hash = item_cap;
+  for (unsigned I = 0; I < item_cap; ++I) {
+    hash = item_hash(&items[I], hash);
+  }
+  struct KernelIndex* index = &work->index;
+  if (index->bucket_cap) {
+    for (unsigned S = index->bucket[hash & (index->bucket_cap - 1)]; S != PARSER_NO_STATE; S = index->next[S]) {
+      if (index->hash[S] != hash) continue;
+      struct Items* IS = &work->kernels[S];
+      if (IS->item_cap != item_cap) continue;
+      unsigned I = 0;
+      for (I = 0; I < item_cap; ++I) {
+        if (item_compare(&IS->item_table[I], &items[I]) != 0) break;
+      }
+      if (I >= item_cap) return S;
+    }
+  }
+
+  TABLE_CHECK_GROW(parser->states, parser->state_cap, 8, struct ParserState);
+  TABLE_CHECK_GROW(work->kernels, parser->state_cap, 8, struct Items);
+  struct Items* IS = &work->kernels[parser->state_cap];
+  IS->Pre = 0;
+  IS->item_cap = item_cap;
+  IS->item_table = arena_alloc(&work->arena, item_cap * sizeof(struct Item));
+  memcpy(IS->item_table, items, item_cap * sizeof(struct Item));
+  kernel_index_add(index, parser->state_cap, hash);
+  return parser->state_cap++;
 }
 
 static void state_make(struct ParserState* state, unsigned char final, unsigned er_new, unsigned rr_new, unsigned ss_new) {
@@ -498,32 +1114,1153 @@ static void state_make(struct ParserState* state, unsigned char final, unsigned
   state->er_table = 0;
   state->rr_table = 0;
   state->ss_table = 0;
-  MALLOC_N(Symbol*      , state->er_table, er_new);
-  MALLOC_N(struct Reduce, state->rr_table, rr_new);
-  MALLOC_N(struct Shift , state->ss_table, ss_new);
+  MALLOC_N(struct Epsilon, state->er_table, er_new);
+  MALLOC_N(struct Reduce , state->rr_table, rr_new);
+  MALLOC_N(struct Shift  , state->ss_table, ss_new);
+}
+
+static void state_conflicts(Parser* parser, struct ParserState* state, unsigned* sr, unsigned* rr) {
+  if (parser->la_bits == 0) {
+    // without lookaheads, every shift conflicts with every reduce
+    unsigned shift_count = 0;
+    for (unsigned j = 0; j < state->ss_cap; ++j) {
+      Symbol* symbol = state->ss_table[j].symbol;
+      shift_count += symbol->literal ? 1 : !symbol->rs_cap;
+    }
+    unsigned reduce_count = state->er_cap + state->rr_cap;
+    *sr = shift_count * reduce_count;
+    *rr = reduce_count > 1 ? reduce_count - 1 : 0;
+    return;
+  }
+
+  // with lookaheads, actions only conflict on a common symbol
+  unsigned char* shifts = 0;
+  MALLOC_N(unsigned char, shifts, PARSER_LOOKAHEAD_BYTES(parser->la_bits));
+  for (unsigned j = 0; j < state->ss_cap; ++j) {
+    Symbol* symbol = state->ss_table[j].symbol;
+    if (symbol->rs_cap > 0 && !symbol->literal) continue;
+    if (symbol->index + 1 >= parser->la_bits) continue;
+    PARSER_LOOKAHEAD_SET(shifts, symbol->index);
+  }
+  *sr = *rr = 0;
+  for (unsigned bit = 0; bit < parser->la_bits; ++bit) {
+    unsigned reduce_count = 0;
+    for (unsigned j = 0; j < state->er_cap; ++j) {
+      unsigned char* la = state->er_table[j].la;
+      if (!la || PARSER_LOOKAHEAD_HAS(la, bit)) ++reduce_count;
+    }
+    for (unsigned j = 0; j < state->rr_cap; ++j) {
+      unsigned char* la = state->rr_table[j].la;
+      if (!la || PARSER_LOOKAHEAD_HAS(la, bit)) ++reduce_count;
+    }
+    if (PARSER_LOOKAHEAD_HAS(shifts, bit)) *sr += reduce_count;
+    if (reduce_count > 1) *rr += reduce_count - 1;
+  }
+  FREE(shifts);
+}
+
+// the goto table is indexed by symbol index; it only needs columns up to
+// the largest symbol that appears in a shift or goto
+static unsigned goto_symbols(Parser* parser) {
+  unsigned symbols = 0;
+  for (unsigned S = 0; S < parser->state_cap; ++S) {
+    struct ParserState* state = &parser->states[S];
+    for (unsigned X = 0; X < state->ss_cap; ++X) {
+      unsigned index = state->ss_table[X].symbol->index;
+      if (symbols <= index) symbols = index + 1;
+    }
+  }
+  return symbols;
+}
+
+static unsigned long goto_bytes(unsigned layout, unsigned states, unsigned long cap) {
+  if (layout == PARSER_GOTO_COMB) {
+    return (states + 2 * cap) * sizeof(unsigned);
+  }
+  return cap * sizeof(unsigned);
 }
 
-static int state_add(Parser* parser, struct Items** items_table, unsigned int Size, struct Item** List) {
+// Row displacement: each state's row is placed at the first offset where its
+// entries do not collide with those already placed, so that the sparse rows
+// interleave like the teeth of a comb.  The check table tells which state
+// owns each entry.  Return the number of entries used.
+static unsigned goto_comb(Parser* parser, unsigned symbols, unsigned** base, unsigned** next, unsigned** check) {
+  unsigned cap = 0;
+  unsigned max = 0;
+  unsigned next_free = 0;    // no entry below this one is free
+  MALLOC_N(unsigned, *base, parser->state_cap);
   for (unsigned S = 0; S < parser->state_cap; ++S) {
-    struct Items* IS = &(*items_table)[S];
-    if (IS->item_cap != Size) continue;
-    unsigned I = 0;
-    for (I = 0; I < IS->item_cap; ++I) {
-      if (item_compare(IS->item_table[I], List[I]) != 0) break;
+    struct ParserState* state = &parser->states[S];
+    if (state->ss_cap == 0) continue;
+    unsigned lowest = state->ss_table[0].symbol->index;
+    for (unsigned X = 1; X < state->ss_cap; ++X) {
+      if (lowest > state->ss_table[X].symbol->index) lowest = state->ss_table[X].symbol->index;
     }
-    if (I >= IS->item_cap) {
-      for (I = 0; I < Size; ++I) {
-        UNREF(List[I]);
+    unsigned B = next_free > lowest ? next_free - lowest : 0;
+    for (; 1; ++B) {
+      unsigned X = 0;
+      for (X = 0; X < state->ss_cap; ++X) {
+        unsigned pos = B + state->ss_table[X].symbol->index;
+        if (pos < max && (*check)[pos]) break;
       }
-      FREE(List);
-      return S;
+      if (X >= state->ss_cap) break;
+    }
+    (*base)[S] = B;
+    for (unsigned X = 0; X < state->ss_cap; ++X) {
+      struct Shift* shift = &state->ss_table[X];
+      unsigned pos = B + shift->symbol->index;
+      if (pos >= max) {
+        unsigned old = max;
+        max = pos + 1 > max + symbols ? pos + 1 : max + symbols;
+        REALLOC(unsigned, *next, max);
+        REALLOC(unsigned, *check, max);
+        memset(*next + old, 0, (max - old) * sizeof(unsigned));
+        memset(*check + old, 0, (max - old) * sizeof(unsigned));
+      }
+      (*next)[pos] = shift->state + 1;
+      (*check)[pos] = S + 1;
+      if (cap <= pos) cap = pos + 1;
+    }
+    while (next_free < max && (*check)[next_free]) ++next_free;
+  }
+  return cap;
+}
+
+static void goto_compile(Parser* parser) {
+  goto_clear(parser);
+  parser->goto_symbols = goto_symbols(parser);
+  if (parser->state_cap == 0 || parser->goto_symbols == 0) return;
+
+  unsigned layout = parser->goto_layout;
+  unsigned long dense_cap = (unsigned long) parser->state_cap * parser->goto_symbols;
+  if (dense_cap > UINT_MAX) layout = PARSER_GOTO_COMB;
+  if (layout != PARSER_GOTO_DENSE) {
+    parser->goto_cap = goto_comb(parser, parser->goto_symbols,
+                                 &parser->goto_base, &parser->goto_next, &parser->goto_check);
+    if (layout == PARSER_GOTO_AUTO) {
+      // a dense table avoids one indirection and a check; take it while small
+      unsigned long dense = goto_bytes(PARSER_GOTO_DENSE, parser->state_cap, dense_cap);
+      unsigned long comb = goto_bytes(PARSER_GOTO_COMB, parser->state_cap, parser->goto_cap);
+      layout = dense <= 2 * comb ? PARSER_GOTO_DENSE : PARSER_GOTO_COMB;
+    }
+    if (layout == PARSER_GOTO_COMB) {
+      parser->goto_used = PARSER_GOTO_COMB;
+      return;
+    }
+    goto_clear(parser);
+    parser->goto_symbols = goto_symbols(parser);
+  }
+
+  parser->goto_used = PARSER_GOTO_DENSE;
+  parser->goto_cap = dense_cap;
+  MALLOC_N(unsigned, parser->goto_next, dense_cap);
+  for (unsigned S = 0; S < parser->state_cap; ++S) {
+    struct ParserState* state = &parser->states[S];
+    for (unsigned X = 0; X < state->ss_cap; ++X) {
+      struct Shift* shift = &state->ss_table[X];
+      parser->goto_next[S * parser->goto_symbols + shift->symbol->index] = shift->state + 1;
     }
   }
+}
+
+static void goto_clear(Parser* parser) {
+  FREE(parser->goto_base);
+  FREE(parser->goto_next);
+  FREE(parser->goto_check);
+  parser->goto_cap = 0;
+  parser->goto_symbols = 0;
+  parser->goto_used = 0;
+}
+
+// a symbol is nullable when one of its rules has only nullable symbols
+static void nullable_compute(Parser* parser) {
+  SymTab* symtab = parser->symtab;
+  FREE(parser->nullable);
+  parser->nullable_cap = symtab->symbol_counter;
+  MALLOC_N(unsigned char, parser->nullable, parser->nullable_cap);
+  for (int changed = 1; changed; ) {
+    changed = 0;
+    for (Symbol* symbol = symtab->first; symbol != 0; symbol = symbol->nxt_list) {
+      if (symbol->literal || symbol->rs_cap == 0) continue;
+      if (parser->nullable[symbol->index]) continue;
+      for (unsigned j = 0; j < symbol->rs_cap; ++j) {
+        Symbol** rules = symbol->rs_table[j].rules;
+        while (*rules && parser->nullable[(*rules)->index]) ++rules;
+        if (*rules) continue;
+        parser->nullable[symbol->index] = 1;
+        changed = 1;
+        break;
+      }
+    }
+  }
+}
+
+// An unknown word can be any lexical category (a symbol without rules), or
+// only any of the open ones, if the grammar declared some.
+static void open_compute(Parser* parser) {
+  SymTab* symtab = parser->symtab;
+  unsigned declared = 0;
+  unsigned categories = 0;
+  for (Symbol* symbol = symtab->first; symbol != 0; symbol = symbol->nxt_list) {
+    if (symbol->literal || symbol->rs_cap > 0) continue;
+    ++categories;
+    declared += symbol->open;
+  }
+  FREE(parser->open_table);
+  MALLOC_N(Symbol*, parser->open_table, declared ? declared : categories);
+  parser->open_cap = 0;
+  for (Symbol* symbol = symtab->first; symbol != 0; symbol = symbol->nxt_list) {
+    if (symbol->literal || symbol->rs_cap > 0) continue;
+    if (declared && !symbol->open) continue;
+    parser->open_table[parser->open_cap++] = symbol;
+  }
+}
+
+// The items are gone by the time the table is complete, but every state
+// with a goto into a state with a complete item has that same item, with
+// the dot one symbol back.  So we walk back from each complete reduction,
+// for as long as the symbols we walk over are nullable, and add the
+// right-nulled reductions (or epsilon reductions) with the same lookaheads.
+static void right_nulled_build(Parser* parser) {
+  if (!parser->right_nulled) return;
+
+  struct RightNulled work = {0};
+  work.parser = parser;
+  MALLOC_N(unsigned, work.pred_first, parser->state_cap + 1);
+  unsigned pred_cap = 0;
+  for (unsigned S = 0; S < parser->state_cap; ++S) {
+    struct ParserState* state = &parser->states[S];
+    for (unsigned X = 0; X < state->ss_cap; ++X) {
+      ++work.pred_first[state->ss_table[X].state];
+      ++pred_cap;
+    }
+  }
+  for (unsigned S = 1; S < parser->state_cap; ++S) {
+    work.pred_first[S] += work.pred_first[S - 1];
+  }
+  work.pred_first[parser->state_cap] = pred_cap;
+  MALLOC_N(unsigned, work.pred_state, pred_cap);
+  for (unsigned S = 0; S < parser->state_cap; ++S) {
+    struct ParserState* state = &parser->states[S];
+    for (unsigned X = 0; X < state->ss_cap; ++X) {
+      // fill backwards, so that pred_first ends up pointing to the first one
+      work.pred_state[--work.pred_first[state->ss_table[X].state]] = S;
+    }
+  }
+
+  for (unsigned S = 0; S < parser->state_cap; ++S) {
+    for (unsigned R = 0; R < parser->states[S].rr_cap; ++R) {
+      // a copy, because adding reductions moves the tables around
+      struct Reduce Rd = parser->states[S].rr_table[R];
+      if (Rd.len < Rd.rs.len) continue;
+      right_nulled_walk(&work, S, &Rd, Rd.len);
+    }
+  }
+  LOG_DEBUG("built right-nulled table: %u reductions added", work.added);
+
+  FREE(work.pred_state);
+  FREE(work.pred_first);
+}
+
+static void right_nulled_walk(struct RightNulled* work, unsigned state, struct Reduce* Rd, unsigned len) {
+  Parser* parser = work->parser;
+  if (!parser_nullable(parser, Rd->rs.rules[len - 1])) return;
+  for (unsigned P = work->pred_first[state]; P < work->pred_first[state + 1]; ++P) {
+    unsigned pred = work->pred_state[P];
+    struct ParserState* St = &parser->states[pred];
+    ++work->added;
+    if (len == 1) {
+      right_nulled_epsilon(parser, St, Rd->lhs, Rd->la);
+      continue;
+    }
+    REALLOC(struct Reduce, St->rr_table, St->rr_cap + 1);
+    struct Reduce* added = &St->rr_table[St->rr_cap++];
+    *added = *Rd;
+    added->len = len - 1;
+    added->la = right_nulled_la(parser, Rd->la);
+    right_nulled_walk(work, pred, Rd, len - 1);
+  }
+}
+
+// add an epsilon reduction to a state, or merge its lookaheads with the
+// one already there for the same symbol
+static void right_nulled_epsilon(Parser* parser, struct ParserState* state, Symbol* lhs, unsigned char* la) {
+  for (unsigned E = 0; E < state->er_cap; ++E) {
+    struct Epsilon* epsilon = &state->er_table[E];
+    if (epsilon->lhs != lhs) continue;
+    if (!epsilon->la) return;
+    if (!la) {
+      FREE(epsilon->la);
+      return;
+    }
+    for (unsigned j = 0; j < PARSER_LOOKAHEAD_BYTES(parser->la_bits); ++j) {
+      epsilon->la[j] |= la[j];
+    }
+    return;
+  }
+  REALLOC(struct Epsilon, state->er_table, state->er_cap + 1);
+  struct Epsilon* epsilon = &state->er_table[state->er_cap++];
+  epsilon->lhs = lhs;
+  epsilon->la = right_nulled_la(parser, la);
+}
+
+// every reduction owns its lookahead set
+static unsigned char* right_nulled_la(Parser* parser, unsigned char* la) {
+  if (!la) return 0;
+  unsigned char* copy = 0;
+  MALLOC_N(unsigned char, copy, PARSER_LOOKAHEAD_BYTES(parser->la_bits));
+  memcpy(copy, la, PARSER_LOOKAHEAD_BYTES(parser->la_bits));
+  return copy;
+}
+
+#if PARSER_LOOKAHEAD
+
+static struct ParserState* state_goto(Parser* parser, struct ParserState* state, Symbol* symbol) {
+  for (unsigned S = 0; S < state->ss_cap; ++S) {
+    struct Shift* Sh = &state->ss_table[S];
+    if (Sh->symbol == symbol) return &parser->states[Sh->state];
+  }
+  return 0;
+}
+
+// LALR(1) lookaheads are computed from the LR(0) automaton as described in
+// DeRemer & Pennello, "Efficient Computation of LALR(1) Look-Ahead Sets"
+// (TOPLAS, 1982).  Everything is expressed in terms of the nonterminal
+// transitions (p, A) of the automaton:
+//
+//   DR(p, A)     terminals shifted right after the transition
+//   reads        (p, A) reads (r, C) if p -A-> r -C-> and C is nullable
+//   Read(p, A)   DR closed over reads
+//   includes     (p', B) includes (p, A) if A -> B' B C', C' nullable, p -B'-> p'
+//   Follow(p, A) Read closed over includes
+//   lookback     (q, A -> w) lookback (p, A) if p -w-> q
+//   LA(q, A -> w) union of Follow(p, A) over lookback
+
+// a pair of related transitions
+struct Edge {
+  unsigned from;
+  unsigned to;
+};
+
+// a relation between transitions, stored as adjacency lists
+struct Relation {
+  struct Edge* edge_table;   // table of edges, as they were found
+  unsigned edge_cap;         //   capacity of table
+  unsigned* first;           // index in list of first edge for each transition
+  unsigned* list;            // transitions related to each transition
+};
+
+// a pending lookback from a reduction to a transition
+struct Lookback {
+  unsigned char** la;        // lookahead set in the reduction
+  unsigned trans;            // transition whose Follow set goes into la
+};
+
+// work area to compute the lookaheads
+struct Lookahead {
+  Parser* parser;
+  unsigned bytes;            // size of each set in bytes
+  unsigned char* nullable;   // nullable flag for each symbol, by index
+  unsigned* trans_first;     // first transition for each state (plus one sentinel)
+  Symbol** trans_symbol;     // nonterminal for each transition
+  unsigned* trans_target;    // target state for each transition
+  unsigned trans_cap;        //   number of transitions
+  unsigned char* sets;       // one set for each transition
+  struct Relation reads;
+  struct Relation includes;
+  struct Lookback* lb_table; // table of lookbacks
+  unsigned lb_cap;           //   capacity of table
+  unsigned* depth;           // digraph traversal depth, per transition
+  unsigned* stack;           // digraph traversal stack
+  unsigned stack_pos;        //   "current" element
+};
+
+static int lookahead_is_terminal(Symbol* symbol) {
+  return symbol->literal || symbol->rs_cap == 0;
+}
+
+// the nullable flags were computed along with the table
+static void lookahead_nullable(struct Lookahead* work) {
+  work->nullable = work->parser->nullable;
+}
+
+static unsigned lookahead_find_transition(struct Lookahead* work, unsigned state, Symbol* symbol) {
+  for (unsigned T = work->trans_first[state]; T < work->trans_first[state + 1]; ++T) {
+    if (work->trans_symbol[T] == symbol) return T;
+  }
+  return work->trans_cap;
+}
+
+static void lookahead_transitions(struct Lookahead* work) {
+  Parser* parser = work->parser;
+  MALLOC_N(unsigned, work->trans_first, parser->state_cap + 1);
+  for (unsigned S = 0; S < parser->state_cap; ++S) {
+    work->trans_first[S] = work->trans_cap;
+    struct ParserState* state = &parser->states[S];
+    for (unsigned X = 0; X < state->ss_cap; ++X) {
+      if (lookahead_is_terminal(state->ss_table[X].symbol)) continue;
+      ++work->trans_cap;
+    }
+  }
+  work->trans_first[parser->state_cap] = work->trans_cap;
+
+  MALLOC_N(Symbol*, work->trans_symbol, work->trans_cap);
+  MALLOC_N(unsigned, work->trans_target, work->trans_cap);
+  MALLOC_N(unsigned char, work->sets, work->trans_cap * work->bytes);
+  for (unsigned S = 0, T = 0; S < parser->state_cap; ++S) {
+    struct ParserState* state = &parser->states[S];
+    for (unsigned X = 0; X < state->ss_cap; ++X) {
+      struct Shift* shift = &state->ss_table[X];
+      if (lookahead_is_terminal(shift->symbol)) continue;
+      work->trans_symbol[T] = shift->symbol;
+      work->trans_target[T] = shift->state;
+      ++T;
+    }
+  }
+}
+
+static void relation_add(struct Relation* rel, unsigned from, unsigned to) {
+  TABLE_CHECK_GROW(rel->edge_table, rel->edge_cap, 64, struct Edge);
+  struct Edge* edge = &rel->edge_table[rel->edge_cap++];
+  edge->from = from;
+  edge->to = to;
+}
+
+static void relation_pack(struct Relation* rel, unsigned size) {
+  MALLOC_N(unsigned, rel->first, size + 1);
+  MALLOC_N(unsigned, rel->list, rel->edge_cap);
+  for (unsigned E = 0; E < rel->edge_cap; ++E) {
+    ++rel->first[rel->edge_table[E].from + 1];
+  }
+  for (unsigned T = 0; T < size; ++T) {
+    rel->first[T + 1] += rel->first[T];
+  }
+  unsigned* used = 0;
+  MALLOC_N(unsigned, used, size);
+  for (unsigned E = 0; E < rel->edge_cap; ++E) {
+    struct Edge* edge = &rel->edge_table[E];
+    rel->list[rel->first[edge->from] + used[edge->from]++] = edge->to;
+  }
+  FREE(used);
+  FREE(rel->edge_table);
+}
+
+static void relation_destroy(struct Relation* rel) {
+  FREE(rel->edge_table);
+  FREE(rel->first);
+  FREE(rel->list);
+}
+
+static void lookahead_direct_reads(struct Lookahead* work) {
+  Parser* parser = work->parser;
+  for (unsigned T = 0; T < work->trans_cap; ++T) {
+    unsigned char* set = &work->sets[T * work->bytes];
+    struct ParserState* target = &parser->states[work->trans_target[T]];
+    if (target->final) {
+      PARSER_LOOKAHEAD_SET(set, parser->la_bits - 1);
+    }
+    for (unsigned X = 0; X < target->ss_cap; ++X) {
+      Symbol* symbol = target->ss_table[X].symbol;
+      if (lookahead_is_terminal(symbol)) {
+        PARSER_LOOKAHEAD_SET(set, symbol->index);
+      } else if (work->nullable[symbol->index]) {
+        unsigned U = lookahead_find_transition(work, work->trans_target[T], symbol);
+        assert(U < work->trans_cap);
+        relation_add(&work->reads, T, U);
+      }
+    }
+  }
+  relation_pack(&work->reads, work->trans_cap);
+}
+
+static void lookahead_add_lookback(struct Lookahead* work, unsigned char** la, unsigned T) {
+  TABLE_CHECK_GROW(work->lb_table, work->lb_cap, 64, struct Lookback);
+  struct Lookback* lb = &work->lb_table[work->lb_cap++];
+  lb->la = la;
+  lb->trans = T;
+}
+
+static void lookahead_includes_and_lookbacks(struct Lookahead* work) {
+  Parser* parser = work->parser;
+  for (unsigned from = 0, T = 0; T < work->trans_cap; ++T) {
+    while (work->trans_first[from + 1] <= T) ++from;
+    Symbol* lhs = work->trans_symbol[T];
+    for (unsigned R = 0; R < lhs->rs_cap; ++R) {
+      RuleSet* rs = &lhs->rs_table[R];
+      struct ParserState* state = &parser->states[from];
+      for (Symbol** rules = rs->rules; *rules && state; ++rules) {
+        Symbol* symbol = *rules;
+        if (!lookahead_is_terminal(symbol)) {
+          Symbol** rest = rules + 1;
+          while (*rest && work->nullable[(*rest)->index]) ++rest;
+          if (*rest == 0) {
+            unsigned U = lookahead_find_transition(work, state - parser->states, symbol);
+            assert(U < work->trans_cap);
+            relation_add(&work->includes, U, T);
+          }
+        }
+        state = state_goto(parser, state, symbol);
+      }
+      if (!state) continue;
+
+      // state is now where we reduce by lhs -> rs
+      if (*rs->rules == 0) {
+        for (unsigned E = 0; E < state->er_cap; ++E) {
+          struct Epsilon* epsilon = &state->er_table[E];
+          if (epsilon->lhs != lhs) continue;
+          lookahead_add_lookback(work, &epsilon->la, T);
+        }
+      } else {
+        for (unsigned E = 0; E < state->rr_cap; ++E) {
+          struct Reduce* reduce = &state->rr_table[E];
+          if (reduce->lhs != lhs || reduce->rs.index != rs->index) continue;
+          lookahead_add_lookback(work, &reduce->la, T);
+        }
+      }
+    }
+  }
+  relation_pack(&work->includes, work->trans_cap);
+}
+
+static void lookahead_union(struct Lookahead* work, unsigned char* dst, unsigned char* src) {
+  for (unsigned j = 0; j < work->bytes; ++j) {
+    dst[j] |= src[j];
+  }
+}
+
+// the digraph algorithm: close sets over a relation, one SCC at a time
+static void lookahead_traverse(struct Lookahead* work, struct Relation* rel, unsigned T) {
+  work->stack[work->stack_pos++] = T;
+  unsigned depth = work->stack_pos;
+  work->depth[T] = depth;
+  unsigned char* set = &work->sets[T * work->bytes];
+  for (unsigned E = rel->first[T]; E < rel->first[T + 1]; ++E) {
+    unsigned U = rel->list[E];
+    if (work->depth[U] == 0) {
+      lookahead_traverse(work, rel, U);
+    }
+    if (work->depth[U] < work->depth[T]) {
+      work->depth[T] = work->depth[U];
+    }
+    lookahead_union(work, set, &work->sets[U * work->bytes]);
+  }
+  if (work->depth[T] != depth) return;
+  while (1) {
+    unsigned U = work->stack[--work->stack_pos];
+    work->depth[U] = UINT_MAX;
+    if (U == T) break;
+    memcpy(&work->sets[U * work->bytes], set, work->bytes);
+  }
+}
+
+static void lookahead_digraph(struct Lookahead* work, struct Relation* rel) {
+  memset(work->depth, 0, work->trans_cap * sizeof(unsigned));
+  work->stack_pos = 0;
+  for (unsigned T = 0; T < work->trans_cap; ++T) {
+    if (work->depth[T] == 0) {
+      lookahead_traverse(work, rel, T);
+    }
+  }
+}
+
+static void lookahead_compute(Parser* parser) {
+  // lookahead sets only need to cover the symbols the parser can shift,
+  // which keeps them small even with a huge lexicon of literals
+  unsigned max_terminal = 0;
+  for (unsigned S = 0; S < parser->state_cap; ++S) {
+    struct ParserState* state = &parser->states[S];
+    for (unsigned X = 0; X < state->ss_cap; ++X) {
+      Symbol* symbol = state->ss_table[X].symbol;
+      if (!lookahead_is_terminal(symbol)) continue;
+      if (max_terminal < symbol->index) max_terminal = symbol->index;
+    }
+  }
+  parser->la_bits = max_terminal + 2;
+
+  struct Lookahead work = {0};
+  work.parser = parser;
+  work.bytes = PARSER_LOOKAHEAD_BYTES(parser->la_bits);
+
+  // every reduction starts with an empty lookahead set
+  for (unsigned S = 0; S < parser->state_cap; ++S) {
+    struct ParserState* state = &parser->states[S];
+    for (unsigned E = 0; E < state->er_cap; ++E) {
+      MALLOC_N(unsigned char, state->er_table[E].la, work.bytes);
+    }
+    for (unsigned R = 0; R < state->rr_cap; ++R) {
+      MALLOC_N(unsigned char, state->rr_table[R].la, work.bytes);
+    }
+  }
+
+  lookahead_nullable(&work);
+  lookahead_transitions(&work);
+  if (work.trans_cap > 0) {
+    MALLOC_N(unsigned, work.depth, work.trans_cap);
+    MALLOC_N(unsigned, work.stack, work.trans_cap);
+    lookahead_direct_reads(&work);
+    lookahead_digraph(&work, &work.reads);
+    lookahead_includes_and_lookbacks(&work);
+    lookahead_digraph(&work, &work.includes);
+    for (unsigned L = 0; L < work.lb_cap; ++L) {
+      struct Lookback* lb = &work.lb_table[L];
+      lookahead_union(&work, *lb->la, &work.sets[lb->trans * work.bytes]);
+    }
+  }
+  LOG_DEBUG("computed lookaheads: %u bits, %u transitions, %u reads, %u includes, %u lookbacks",
+            parser->la_bits, work.trans_cap, work.reads.edge_cap, work.includes.edge_cap, work.lb_cap);
+
+  relation_destroy(&work.reads);
+  relation_destroy(&work.includes);
+  FREE(work.lb_table);
+  FREE(work.depth);
+  FREE(work.stack);
+  FREE(work.sets);
+  FREE(work.trans_target);
+  FREE(work.trans_symbol);
+  FREE(work.trans_first);
+}
+
+// Canonical LR(1) tables, as in Knuth's original construction: every item
+// carries its own lookahead set, and states are only merged when both their
+// items and their lookaheads match.  This splits the LALR(1) states whose
+// merged lookaheads create spurious conflicts, at the cost of more states;
+// for a GLR parser each conflict avoided is a stack fork avoided.
+
+// an LR(1) item: an LR(0) item plus its lookahead set
+struct Canon {
+  struct Item item;          // the LR(0) part; rhs_pos is the dot
+  unsigned char* la;         // lookahead set
+};
+
+// the kernel of an LR(1) state
+struct CanonState {
+  struct Canon* kernel;      // kernel items, sorted
+  unsigned kernel_cap;       //   capacity of table
+};
+
+// work area to build canonical LR(1) tables
+struct Canonical {
+  struct Lookahead work;     // for the nullable flags and set size
+  unsigned char* first;      // FIRST set for each symbol, by index
+  Arena arena;               // kernel items and their lookaheads
+  struct CanonState* kernels;// kernel of each state
+  struct KernelIndex index;  // to find states by their kernel
+  struct Item* closure;      // closure of the current state
+  unsigned char* closure_la; //   lookahead set of each item
+  unsigned closure_cap;      //   number of items
+  unsigned closure_max;      //   allocated items
+  unsigned* rule_pos;        // position in closure plus one, per ruleset index
+  unsigned* pending;         // closure items whose lookaheads must be propagated
+  unsigned pending_cap;      //   number of items
+  unsigned char* queued;     // whether each closure item is pending
+  unsigned* xpos;            // position in shifted symbols plus one, per symbol index
+  struct Canon* moved;       // storage for the items of one kernel
+  unsigned moved_max;        //   allocated items
+};
+
+static int canonical_is_nonterminal(Symbol* symbol) {
+  return !symbol->literal && symbol->rs_cap > 0;
+}
+
+static unsigned char* canonical_first_set(struct Canonical* canon, Symbol* symbol) {
+  return &canon->first[symbol->index * canon->work.bytes];
+}
+
+static void canonical_first(struct Canonical* canon) {
+  SymTab* symtab = canon->work.parser->symtab;
+  MALLOC_N(unsigned char, canon->first, symtab->symbol_counter * canon->work.bytes);
+  for (int changed = 1; changed; ) {
+    changed = 0;
+    for (Symbol* symbol = symtab->first; symbol != 0; symbol = symbol->nxt_list) {
+      if (!canonical_is_nonterminal(symbol)) continue;
+      unsigned char* set = canonical_first_set(canon, symbol);
+      for (unsigned j = 0; j < symbol->rs_cap; ++j) {
+        for (Symbol** rules = symbol->rs_table[j].rules; *rules; ++rules) {
+          Symbol* rhs = *rules;
+          if (lookahead_is_terminal(rhs)) {
+            if (!PARSER_LOOKAHEAD_HAS(set, rhs->index)) {
+              PARSER_LOOKAHEAD_SET(set, rhs->index);
+              changed = 1;
+            }
+            break;
+          }
+          unsigned char* src = canonical_first_set(canon, rhs);
+          for (unsigned k = 0; k < canon->work.bytes; ++k) {
+            if ((set[k] | src[k]) == set[k]) continue;
+            set[k] |= src[k];
+            changed = 1;
+          }
+          if (!canon->work.nullable[rhs->index]) break;
+        }
+      }
+    }
+  }
+}
+
+// compute FIRST(rules la) into set
+static void canonical_follow(struct Canonical* canon, Symbol** rules, unsigned char* la, unsigned char* set) {
+  memset(set, 0, canon->work.bytes);
+  for (; *rules; ++rules) {
+    Symbol* symbol = *rules;
+    if (lookahead_is_terminal(symbol)) {
+      PARSER_LOOKAHEAD_SET(set, symbol->index);
+      return;
+    }
+    lookahead_union(&canon->work, set, canonical_first_set(canon, symbol));
+    if (!canon->work.nullable[symbol->index]) return;
+  }
+  lookahead_union(&canon->work, set, la);
+}
+
+static unsigned char* canonical_closure_la(struct Canonical* canon, unsigned C) {
+  return &canon->closure_la[C * canon->work.bytes];
+}
+
+// add an item to the closure, or merge its lookaheads into an existing one;
+// items whose lookaheads changed are queued to propagate them
+static void canonical_closure_add(struct Canonical* canon, struct Item* item, unsigned char* la) {
+  unsigned C = canon->closure_cap;
+  unsigned* rule_pos = 0;
+  if (item->lhs && item->rhs_pos == item->rs.rules) {
+    // an item with the dot at the start can only be in the closure once
+    rule_pos = &canon->rule_pos[item->rs.index];
+    if (*rule_pos) C = *rule_pos - 1;
+  }
+  if (C < canon->closure_cap) {
+    unsigned char* dst = canonical_closure_la(canon, C);
+    int changed = 0;
+    for (unsigned k = 0; k < canon->work.bytes; ++k) {
+      if ((dst[k] | la[k]) == dst[k]) continue;
+      dst[k] |= la[k];
+      changed = 1;
+    }
+    if (!changed || canon->queued[C]) return;
+  } else {
+    if (canon->closure_cap >= canon->closure_max) {
+      canon->closure_max += 64;
+      REALLOC(struct Item, canon->closure, canon->closure_max);
+      REALLOC(unsigned char, canon->closure_la, canon->closure_max * canon->work.bytes);
+      REALLOC(unsigned, canon->pending, canon->closure_max);
+      REALLOC(unsigned char, canon->queued, canon->closure_max);
+    }
+    ++canon->closure_cap;
+    canon->closure[C] = *item;
+    memcpy(canonical_closure_la(canon, C), la, canon->work.bytes);
+    if (rule_pos) *rule_pos = C + 1;
+  }
+  canon->queued[C] = 1;
+  canon->pending[canon->pending_cap++] = C;
+}
+
+static void canonical_closure(struct Canonical* canon, struct CanonState* state) {
+  canon->closure_cap = 0;
+  canon->pending_cap = 0;
+  for (unsigned K = 0; K < state->kernel_cap; ++K) {
+    canonical_closure_add(canon, &state->kernel[K].item, state->kernel[K].la);
+  }
+
+  unsigned char* set = 0;
+  MALLOC_N(unsigned char, set, canon->work.bytes);
+  while (canon->pending_cap > 0) {
+    unsigned C = canon->pending[--canon->pending_cap];
+    canon->queued[C] = 0;
+    Symbol* symbol = *canon->closure[C].rhs_pos;
+    if (!symbol || !canonical_is_nonterminal(symbol)) continue;
+    canonical_follow(canon, canon->closure[C].rhs_pos + 1, canonical_closure_la(canon, C), set);
+    for (unsigned R = 0; R < symbol->rs_cap; ++R) {
+      struct Item item = { symbol, symbol->rs_table[R], symbol->rs_table[R].rules };
+      canonical_closure_add(canon, &item, set);
+    }
+  }
+  FREE(set);
+
+  for (unsigned C = 0; C < canon->closure_cap; ++C) {
+    struct Item* It = &canon->closure[C];
+    if (It->lhs && It->rhs_pos == It->rs.rules) canon->rule_pos[It->rs.index] = 0;
+  }
+}
+
+// find or create the state with a given (sorted) kernel
+static unsigned canonical_state_add(struct Canonical* canon, struct Canon* kernel, unsigned kernel_cap) {
+  Parser* parser = canon->work.parser;
+  unsigned bytes = canon->work.bytes;
+  unsigned hash = kernel_cap;
+  for (unsigned K = 0; K < kernel_cap; ++K) {
+    hash = item_hash(&kernel[K].item, hash);
+    for (unsigned k = 0; k < bytes; ++k) {
+      hash = hash * 31 + kernel[K].la[k];
+    }
+  }
+  struct KernelIndex* index = &canon->index;
+  if (index->bucket_cap) {
+    for (unsigned S = index->bucket[hash & (index->bucket_cap - 1)]; S != PARSER_NO_STATE; S = index->next[S]) {
+      if (index->hash[S] != hash) continue;
+      struct CanonState* state = &canon->kernels[S];
+      if (state->kernel_cap != kernel_cap) continue;
+      unsigned K = 0;
+      for (K = 0; K < kernel_cap; ++K) {
+        if (item_compare(&state->kernel[K].item, &kernel[K].item) != 0) break;
+        if (memcmp(state->kernel[K].la, kernel[K].la, bytes) != 0) break;
+      }
+      if (K >= kernel_cap) return S;
+    }
+  }
+
   TABLE_CHECK_GROW(parser->states, parser->state_cap, 8, struct ParserState);
-  TABLE_CHECK_GROW(*items_table, parser->state_cap, 8, struct Items);
-  struct Items* IS = &(*items_table)[parser->state_cap];
-  IS->Pre = 0;
-  IS->item_cap = Size;
-  IS->item_table = List;
+  TABLE_CHECK_GROW(canon->kernels, parser->state_cap, 8, struct CanonState);
+  struct CanonState* state = &canon->kernels[parser->state_cap];
+  state->kernel_cap = kernel_cap;
+  state->kernel = arena_alloc(&canon->arena, kernel_cap * (sizeof(struct Canon) + bytes));
+  unsigned char* la = (unsigned char*) (state->kernel + kernel_cap);
+  for (unsigned K = 0; K < kernel_cap; ++K, la += bytes) {
+    state->kernel[K].item = kernel[K].item;
+    state->kernel[K].la = la;
+    memcpy(la, kernel[K].la, bytes);
+  }
+  kernel_index_add(index, parser->state_cap, hash);
   return parser->state_cap++;
 }
+
+static int canonical_sort(const void* l, const void* r) {
+  return item_compare(&((struct Canon*) l)->item, &((struct Canon*) r)->item);
+}
+
+static unsigned char* canonical_la_clone(struct Canonical* canon, unsigned char* la) {
+  unsigned char* clone = 0;
+  MALLOC_N(unsigned char, clone, canon->work.bytes);
+  memcpy(clone, la, canon->work.bytes);
+  return clone;
+}
+
+static unsigned canonical_build(Parser* parser, Grammar* grammar) {
+  // lookahead sets cover all symbols that rules can shift, as with LALR(1)
+  unsigned max_terminal = 0;
+  unsigned max_rule = 0;
+  for (Symbol* symbol = parser->symtab->first; symbol != 0; symbol = symbol->nxt_list) {
+    if (!canonical_is_nonterminal(symbol)) continue;
+    for (unsigned j = 0; j < symbol->rs_cap; ++j) {
+      if (max_rule < symbol->rs_table[j].index) max_rule = symbol->rs_table[j].index;
+      for (Symbol** rules = symbol->rs_table[j].rules; *rules; ++rules) {
+        if (!lookahead_is_terminal(*rules)) continue;
+        if (max_terminal < (*rules)->index) max_terminal = (*rules)->index;
+      }
+    }
+  }
+  parser->la_bits = max_terminal + 2;
+
+  struct Canonical canon = {0};
+  canon.work.parser = parser;
+  canon.work.bytes = PARSER_LOOKAHEAD_BYTES(parser->la_bits);
+  arena_build(&canon.arena, 64 * 1024);
+  MALLOC_N(unsigned, canon.rule_pos, max_rule + 1);
+  MALLOC_N(unsigned, canon.xpos, parser->symtab->symbol_counter);
+  lookahead_nullable(&canon.work);
+  canonical_first(&canon);
+
+  // initial state: the start item, followed by the end of input
+  Symbol* StartR[2] = { grammar->start, 0 };
+  struct Canon start = { { 0, { 666, 1, StartR }, StartR }, 0 };
+  MALLOC_N(unsigned char, start.la, canon.work.bytes);
+  PARSER_LOOKAHEAD_SET(start.la, parser->la_bits - 1);
+  canonical_state_add(&canon, &start, 1);
+  FREE(start.la);
+
+  Symbol** XTab = 0;
+  unsigned* XCount = 0;
+  unsigned XMax = 0;
+  for (unsigned S = 0; S < parser->state_cap; ++S) {
+    canonical_closure(&canon, &canon.kernels[S]);
+
+    // count actions and collect the shifted symbols, in order of appearance
+    unsigned char final = 0;
+    unsigned ERs = 0;
+    unsigned RRs = 0;
+    unsigned Xs = 0;
+    for (unsigned C = 0; C < canon.closure_cap; ++C) {
+      struct Item* It = &canon.closure[C];
+      if (*It->rhs_pos == 0) {
+        if (It->lhs == 0) {
+          ++final;
+        } else if (*It->rs.rules == 0) {
+          ++ERs;
+        } else {
+          ++RRs;
+        }
+        continue;
+      }
+      unsigned X = canon.xpos[(*It->rhs_pos)->index];
+      if (X == 0) {
+        if (Xs >= XMax) {
+          XMax += 8;
+          REALLOC(Symbol*, XTab, XMax);
+          REALLOC(unsigned, XCount, XMax);
+        }
+        XTab[Xs] = *It->rhs_pos;
+        XCount[Xs] = 0;
+        X = canon.xpos[(*It->rhs_pos)->index] = ++Xs;
+      }
+      ++XCount[X - 1];
+    }
+
+    state_make(&parser->states[S], final, ERs, RRs, Xs);
+    unsigned R = 0;
+    unsigned E = 0;
+    for (unsigned C = 0; C < canon.closure_cap; ++C) {
+      struct Item* It = &canon.closure[C];
+      if (*It->rhs_pos != 0 || It->lhs == 0) continue;
+      if (*It->rs.rules == 0) {
+        struct Epsilon* Ep = &parser->states[S].er_table[E++];
+        Ep->lhs = It->lhs;
+        Ep->la = canonical_la_clone(&canon, canonical_closure_la(&canon, C));
+      } else {
+        struct Reduce* Rd = &parser->states[S].rr_table[R++];
+        Rd->lhs = It->lhs;
+        Rd->rs = It->rs;
+        Rd->len = It->rhs_pos - It->rs.rules;
+        Rd->la = canonical_la_clone(&canon, canonical_closure_la(&canon, C));
+      }
+    }
+
+    for (unsigned X = 0; X < Xs; ++X) {
+      // the kernel of the target state, sorted as LR(0) items are; its
+      // lookaheads stay in the closure until the state is added
+      if (XCount[X] > canon.moved_max) {
+        canon.moved_max = XCount[X];
+        REALLOC(struct Canon, canon.moved, canon.moved_max);
+      }
+      unsigned kernel_cap = 0;
+      for (unsigned C = 0; C < canon.closure_cap; ++C) {
+        struct Item* It = &canon.closure[C];
+        if (*It->rhs_pos != XTab[X]) continue;
+        struct Canon* next = &canon.moved[kernel_cap++];
+        next->item = *It;
+        ++next->item.rhs_pos;
+        next->la = canonical_closure_la(&canon, C);
+      }
+      qsort(canon.moved, kernel_cap, sizeof(struct Canon), canonical_sort);
+      unsigned target = canonical_state_add(&canon, canon.moved, kernel_cap);
+      canon.xpos[XTab[X]->index] = 0;
+
+      // careful: adding the state may have moved parser->states
+      struct Shift* Sh = &parser->states[S].ss_table[X];
+      Sh->symbol = XTab[X];
+      Sh->state = target;
+    }
+  }
+  LOG_DEBUG("built canonical LR(1) table: %u states, %u bits", parser->state_cap, parser->la_bits);
+
+  kernel_index_destroy(&canon.index);
+  arena_destroy(&canon.arena);
+  FREE(canon.kernels);
+  FREE(canon.closure);
+  FREE(canon.closure_la);
+  FREE(canon.pending);
+  FREE(canon.queued);
+  FREE(canon.rule_pos);
+  FREE(canon.xpos);
+  FREE(canon.moved);
+  FREE(canon.first);
+  FREE(XTab);
+  FREE(XCount);
+  return 0;
+}
+
+#endif
+
+static void lookahead_show(Parser* parser, unsigned char* la) {
+  if (!la) return;
+  printf(" {");
+  for (unsigned bit = 0; bit + 1 < parser->la_bits; ++bit) {
+    if (!PARSER_LOOKAHEAD_HAS(la, bit)) continue;
+    Symbol* symbol = symtab_find_symbol_by_index(parser->symtab, bit);
+    printf(" %.*s", symbol->name.len, symbol->name.ptr);
+  }
+  if (PARSER_LOOKAHEAD_HAS(la, parser->la_bits - 1)) {
+    printf(" $");
+  }
+  printf(" }");
+}
+
+static void lookahead_save(Parser* parser, unsigned char* la, Buffer* b) {
+  if (!la) return;
+  unsigned count = 0;
+  for (unsigned bit = 0; bit < parser->la_bits; ++bit) {
+    if (PARSER_LOOKAHEAD_HAS(la, bit)) ++count;
+  }
+  buffer_format_print(b, " %u", count);
+  for (unsigned bit = 0; bit < parser->la_bits; ++bit) {
+    if (PARSER_LOOKAHEAD_HAS(la, bit)) buffer_format_print(b, " %u", bit);
+  }
+}
+
+static unsigned char* lookahead_load(Parser* parser, Slice line, unsigned pos) {
+  if (parser->la_bits == 0) return 0;
+  unsigned count = 0;
+  pos = next_number(line, pos, &count);
+  if (pos == 0) return 0;
+  unsigned char* la = 0;
+  MALLOC_N(unsigned char, la, PARSER_LOOKAHEAD_BYTES(parser->la_bits));
+  for (unsigned j = 0; j < count; ++j) {
+    unsigned bit = 0;
+    pos = next_number(line, pos, &bit);
+    assert(bit < parser->la_bits);
+    PARSER_LOOKAHEAD_SET(la, bit);
+  }
+  return la;
+}
+
+static unsigned image_check(const ImageHeader* header, unsigned len) {
+  unsigned errors = 0;
+  do {
+    if (((uintptr_t) header & 3) || len < sizeof(ImageHeader)) {
+      LOG_WARN("parser: image is misaligned or too short");
+      ++errors;
+      break;
+    }
+    if (header->magic != IMAGE_MAGIC || header->version != IMAGE_VERSION) {
+      LOG_WARN("parser: image has magic %08x version %u, expected %08x version %u",
+               header->magic, header->version, IMAGE_MAGIC, IMAGE_VERSION);
+      ++errors;
+      break;
+    }
+    if (header->size > len) {
+      LOG_WARN("parser: image needs %u bytes, only got %u", header->size, len);
+      ++errors;
+      break;
+    }
+    if (header->goto_used != PARSER_GOTO_DENSE && header->goto_used != PARSER_GOTO_COMB) {
+      LOG_WARN("parser: image has invalid goto table layout %u", header->goto_used);
+      ++errors;
+      break;
+    }
+
+    // every section must lie within the image
+    struct { uint32_t pos; uint32_t count; unsigned size; } sections[] = {
+      { header->symbols,    header->symbol_cap,  sizeof(ImageSymbol)  },
+      { header->rulesets,   header->ruleset_cap, sizeof(ImageRuleSet) },
+      { header->rhs,        header->rhs_cap,     sizeof(uint32_t)     },
+      { header->slots,      header->slot_cap,    sizeof(uint32_t)     },
+      { header->states,     header->state_cap,   sizeof(ImageState)   },
+      { header->shifts,     header->shift_cap,   sizeof(ImageShift)   },
+      { header->reduces,    header->reduce_cap,  sizeof(ImageReduce)  },
+      { header->epsilons,   header->epsilon_cap, sizeof(ImageEpsilon) },
+      { header->opens,      header->open_cap,    sizeof(uint32_t)     },
+      { header->goto_next,  header->goto_cap,    sizeof(uint32_t)     },
+      { header->goto_base,  header->goto_used == PARSER_GOTO_COMB ? header->state_cap : 0, sizeof(uint32_t) },
+      { header->goto_check, header->goto_used == PARSER_GOTO_COMB ? header->goto_cap : 0,  sizeof(uint32_t) },
+      { header->scan_states, header->scan_state_cap, sizeof(struct ScanState) },
+      { header->scan_edges,  header->scan_edge_cap,  sizeof(struct ScanEdge)  },
+    };
+    for (unsigned j = 0; j < ALEN(sections); ++j) {
+      unsigned long end = sections[j].pos + (unsigned long) sections[j].count * sections[j].size;
+      if ((sections[j].pos & 3) || end > header->size) {
+        LOG_WARN("parser: image section %u is out of bounds", j);
+        ++errors;
+        break;
+      }
+    }
+    if (errors) break;
+
+    // entries are used in place, and refer to each other without checks
+    errors = image_check_entries(header);
+    if (errors) break;
+    errors = image_check_goto(header);
+    if (errors) break;
+  } while (0);
+  return errors;
+}
+
+// every position stored in an entry must be within the table it refers to,
+// and every offset within the image
+static unsigned image_check_entries(const ImageHeader* header) {
+  const char* base = (const char*) header;
+  const ImageSymbol* symbols = (const ImageSymbol*) (base + header->symbols);
+  const ImageRuleSet* rulesets = (const ImageRuleSet*) (base + header->rulesets);
+  const uint32_t* rhs = (const uint32_t*) (base + header->rhs);
+  const uint32_t* slots = (const uint32_t*) (base + header->slots);
+  const ImageState* states = (const ImageState*) (base + header->states);
+  const ImageShift* shifts = (const ImageShift*) (base + header->shifts);
+  const ImageReduce* reduces = (const ImageReduce*) (base + header->reduces);
+  const ImageEpsilon* epsilons = (const ImageEpsilon*) (base + header->epsilons);
+  const uint32_t* opens = (const uint32_t*) (base + header->opens);
+  const struct ScanState* scan_states = (const struct ScanState*) (base + header->scan_states);
+  const struct ScanEdge* scan_edges = (const struct ScanEdge*) (base + header->scan_edges);
+  unsigned long size = header->size;
+  unsigned long la_bytes = PARSER_LOOKAHEAD_BYTES((unsigned long) header->la_bits);
+
+  for (unsigned j = 0; j < header->symbol_cap; ++j) {
+    if (symbols[j].name + (unsigned long) symbols[j].name_len > size) return image_bad("symbol name", j);
+    if (symbols[j].rs_first + (unsigned long) symbols[j].rs_cap > header->ruleset_cap) return image_bad("symbol ruleset", j);
+  }
+  for (unsigned j = 0; j < header->rhs_cap; ++j) {
+    if (rhs[j] != IMAGE_NONE && rhs[j] >= header->symbol_cap) return image_bad("right-hand side symbol", j);
+  }
+  for (unsigned j = 0; j < header->ruleset_cap; ++j) {
+    // the symbols in a right-hand side are followed by its end mark
+    unsigned long end = rulesets[j].rhs_first + (unsigned long) rulesets[j].rhs_len;
+    if (end >= header->rhs_cap || rhs[end] != IMAGE_NONE) return image_bad("ruleset", j);
+    for (unsigned k = rulesets[j].rhs_first; k < end; ++k) {
+      if (rhs[k] == IMAGE_NONE) return image_bad("ruleset", j);
+    }
+  }
+  unsigned empty = 0;
+  for (unsigned j = 0; j < header->slot_cap; ++j) {
+    if (slots[j] == IMAGE_NONE) ++empty;
+    else if (slots[j] >= header->symbol_cap) return image_bad("hash slot", j);
+  }
+  if (header->slot_cap && !empty) return image_bad("hash table without empty slots", 0);
+  for (unsigned j = 0; j < header->state_cap; ++j) {
+    if (states[j].ss_first + (unsigned long) states[j].ss_cap > header->shift_cap ||
+        states[j].rr_first + (unsigned long) states[j].rr_cap > header->reduce_cap ||
+        states[j].er_first + (unsigned long) states[j].er_cap > header->epsilon_cap) return image_bad("state", j);
+  }
+  for (unsigned j = 0; j < header->shift_cap; ++j) {
+    if (shifts[j].symbol >= header->symbol_cap || shifts[j].state >= header->state_cap) return image_bad("shift", j);
+  }
+  for (unsigned j = 0; j < header->reduce_cap; ++j) {
+    if (reduces[j].lhs >= header->symbol_cap || reduces[j].ruleset >= header->ruleset_cap) return image_bad("reduction", j);
+    if (reduces[j].len > rulesets[reduces[j].ruleset].rhs_len) return image_bad("reduction length", j);
+    if (reduces[j].la != IMAGE_NONE && (!la_bytes || reduces[j].la + la_bytes > size)) return image_bad("reduction lookahead", j);
+  }
+  for (unsigned j = 0; j < header->epsilon_cap; ++j) {
+    if (epsilons[j].lhs >= header->symbol_cap) return image_bad("epsilon reduction", j);
+    if (epsilons[j].la != IMAGE_NONE && (!la_bytes || epsilons[j].la + la_bytes > size)) return image_bad("epsilon reduction lookahead", j);
+  }
+  for (unsigned j = 0; j < header->open_cap; ++j) {
+    if (opens[j] >= header->symbol_cap) return image_bad("open lexical category", j);
+  }
+  for (unsigned j = 0; j < header->scan_state_cap; ++j) {
+    if (scan_states[j].first + (unsigned long) scan_states[j].count > header->scan_edge_cap ||
+        scan_states[j].symbol > header->symbol_cap) return image_bad("scanner state", j);
+  }
+  for (unsigned j = 0; j < header->scan_edge_cap; ++j) {
+    if (scan_edges[j].next >= header->scan_state_cap || scan_edges[j].byte > 255) return image_bad("scanner edge", j);
+  }
+  return 0;
+}
+
+// lookups in the goto table must stay within it, and lead to actual states
+static unsigned image_check_goto(const ImageHeader* header) {
+  const char* base = (const char*) header;
+  const uint32_t* next = (const uint32_t*) (base + header->goto_next);
+  if (header->goto_symbols > header->symbol_cap) return image_bad("goto table width", header->goto_symbols);
+  if (header->goto_used == PARSER_GOTO_DENSE) {
+    if ((unsigned long) header->state_cap * header->goto_symbols > header->goto_cap) {
+      return image_bad("dense goto table size", header->goto_cap);
+    }
+  } else {
+    const uint32_t* goto_base = (const uint32_t*) (base + header->goto_base);
+    for (unsigned j = 0; j < header->state_cap; ++j) {
+      if (goto_base[j] > header->goto_cap) return image_bad("goto table base", j);
+    }
+  }
+  for (unsigned j = 0; j < header->goto_cap; ++j) {
+    if (next[j] > header->state_cap) return image_bad("goto table entry", j);
+  }
+  return 0;
+}
+
+static unsigned image_bad(const char* what, unsigned j) {
+  LOG_WARN("parser: image has an invalid %s, at %u", what, j);
+  return 1;
+}
@@ -1,9 +1,56 @@
 #pragma once
 
 #include "buffer.h"
+#include "scanner.h"
 #include "symbol.h"
 
 struct Grammar;
+struct ParserImage;
+
+// Compile-time switch for LALR(1) lookaheads.  By default every reduction
+// carries the set of symbols that may follow it, so the forest only attempts
+// it when the next token can be one of those.  Build with
+//
+//   $ make LR0=1
+//
+// (or -DPARSER_LOOKAHEAD=0) to get the original LR(0) tables, where every
+// reduction is always attempted.
+#if !defined(PARSER_LOOKAHEAD)
+#define PARSER_LOOKAHEAD 1
+#endif
+
+// Lookahead sets are bitmaps indexed by symbol index; the last bit in the set
+// stands for the end of the input.
+#define PARSER_LOOKAHEAD_BYTES(bits) (((bits) + 7) / 8)
+#define PARSER_LOOKAHEAD_HAS(la, bit) ((la)[(bit) >> 3] & (1U << ((bit) & 7)))
+#define PARSER_LOOKAHEAD_SET(la, bit) do { (la)[(bit) >> 3] |= (1U << ((bit) & 7)); } while (0)
+
+// the ways to build the parsing table for a grammar
+enum ParserMode {
+  PARSER_MODE_LALR1,         // LR(0) states with LALR(1) lookaheads (default)
+  PARSER_MODE_LR1,           // canonical LR(1) states: more states, fewer conflicts
+  PARSER_MODE_LAST,
+};
+
+// the layouts for the compiled goto table
+enum ParserGotoLayout {
+  PARSER_GOTO_AUTO,          // pick dense unless it is much bigger than comb
+  PARSER_GOTO_DENSE,         // a full state x symbol matrix
+  PARSER_GOTO_COMB,          // rows overlapped by displacement, with a check
+  PARSER_GOTO_LAST,
+};
+
+// Right-nulled tables, as in the RNGLR algorithm by Scott and Johnstone: when
+// the rest of a rule derives the empty string, the rule is also reduced right
+// before that rest, popping only the symbols already seen; the forest then
+// completes it with shared nodes for the empty string.  A rule that derives
+// the empty string as a whole becomes an epsilon reduction.  This way, the
+// forest never reduces through a node for the empty string, which saves lots
+// of work with optional constituents.  Parsers are built like this unless
+// right_nulled is cleared before building them.
+
+// returned by parser_goto() when there is no transition
+#define PARSER_NO_STATE ((unsigned) -1)
 
 // a Shift action
 // also used to represent gotos, when symbol is a non-terminal
@@ -13,9 +60,20 @@ struct Shift {
 };
 
 // a Reduce action
+// in a right-nulled table, a rule can be reduced before its end, when the
+// rest of it derives the empty string; then len is less than the rule length
 struct Reduce {
   Symbol* lhs;               // the left-hand side of the rule being reduced
   RuleSet rs;                // the right-hand side ruleset
+  unsigned len;              // number of symbols to pop from the stack
+  unsigned char* la;         // lookahead set; null means any symbol
+};
+
+// an epsilon Reduce action
+// in a right-nulled table, lhs can be any symbol deriving the empty string
+struct Epsilon {
+  Symbol* lhs;               // the left-hand side of the empty rule
+  unsigned char* la;         // lookahead set; null means any symbol
 };
 
 // a State in the parsing table
@@ -25,7 +83,7 @@ struct ParserState {
   unsigned ss_cap;           //   capacity of table
   struct Reduce* rr_table;   // table of Reduce actions
   unsigned rr_cap;           //   capacity of table
-  Symbol** er_table;         // table of epsilon reductions
+  struct Epsilon* er_table;  // table of epsilon reductions
   unsigned er_cap;           //   capacity of table
 };
 
@@ -35,8 +93,37 @@ typedef struct Parser {
   struct SymTab* symtab;     // the symbol table
   struct ParserState* states;// the state table
   unsigned state_cap;        //   capacity of state and items tables
+  unsigned la_bits;          // size of lookahead sets, 0 if there are none
+  unsigned char mode;        // how to build the table, see enum ParserMode
+  unsigned char goto_layout; // requested layout for goto table, see enum ParserGotoLayout
+  unsigned char goto_used;   // layout actually used for goto table
+  unsigned char right_nulled;// build (or got) right-nulled reductions?
+  unsigned char* nullable;   // nullable flag for each symbol, by index
+  unsigned nullable_cap;     //   capacity of table
+  Symbol** open_table;       // lexical categories an unknown word can be
+  unsigned open_cap;         //   capacity of table
+  Scanner scanner;           // DFA for the literals, derived from the symtab or mapped
+  unsigned goto_symbols;     // number of columns (symbol indexes) in goto table
+  unsigned* goto_base;       // comb: offset of each state's row in goto_next
+  unsigned* goto_next;       // target state + 1 for each entry, 0 if none
+  unsigned* goto_check;      // comb: state + 1 owning each entry
+  unsigned goto_cap;         //   capacity of goto_next (and goto_check)
+  struct ParserImage* image; // tables mapped from a binary image, if any
 } Parser;
 
+// a summary of the tables of a parser
+typedef struct ParserStats {
+  unsigned states;           // number of states
+  unsigned shifts;           // number of shifts on terminals
+  unsigned gotos;            // number of gotos on non-terminals
+  unsigned reduces;          // number of reductions, including epsilon ones
+  unsigned conflict_sr;      // number of shift/reduce conflicts
+  unsigned conflict_rr;      // number of reduce/reduce conflicts
+  unsigned long bytes;       // memory used by the tables
+  unsigned long dense_bytes; // memory for a dense goto table
+  unsigned long comb_bytes;  // memory for a comb-compressed goto table
+} ParserStats;
+
 
 // Create a parser that uses a given SymTab.
 Parser* parser_create(struct SymTab* symtab);
@@ -50,7 +137,26 @@ void parser_clear(Parser* parser);
 // Print a parser in a human-readable format.
 void parser_show(Parser* parser);
 
+// Return a human-readable name for a parser mode.
+const char* parser_mode_name(unsigned mode);
+
+// Gather a summary of the tables of a parser.
+void parser_stats(Parser* parser, ParserStats* stats);
+
+// Build a grammar's parsing table in every mode and print a report comparing
+// their number of states and conflicts -- each conflict forks the forest stack.
+// Return number of errors found (so 0 => ok)
+unsigned parser_report(struct Grammar* grammar);
+
+// Return whether a symbol can derive the empty string.
+int parser_nullable(Parser* parser, Symbol* symbol);
+
+// Return the state reached from a state through a symbol, using the
+// compiled goto table; PARSER_NO_STATE if there is no such transition.
+unsigned parser_goto(Parser* parser, unsigned state, Symbol* symbol);
+
 // Build a parser from a given grammar.
+// The table is built according to parser->mode.
 // Return number of errors found (so 0 => ok)
 unsigned parser_build_from_grammar(Parser* parser, struct Grammar* grammar);
 
@@ -63,3 +169,18 @@ unsigned parser_load_from_slice(Parser* parser, Slice source);
 // Format for saved contents are "proprietary".
 // Return number of errors found (so 0 => ok)
 unsigned parser_save_to_buffer(Parser* parser, Buffer* b);
+
+// Save a parser into a buffer, as a binary image that can be used directly
+// by parser_map_slice() or parser_map_file().
+// Return number of errors found (so 0 => ok)
+unsigned parser_save_image(Parser* parser, Buffer* b);
+
+// Use a binary image in memory as a parser, including its symbol table.
+// The image must be aligned to 4 bytes, and outlive the parser contents.
+// Return number of errors found (so 0 => ok)
+unsigned parser_map_slice(Parser* parser, Slice image);
+
+// Map a file with a binary image into memory and use it as a parser,
+// including its symbol table.  The file is unmapped when the parser is cleared.
+// Return number of errors found (so 0 => ok)
+unsigned parser_map_file(Parser* parser, const char* path);
@@ -0,0 +1,277 @@
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include "log.h"
+#include "mem.h"
+#include "symbol.h"
+#include "symtab.h"
+#include "scanner.h"
+
+// vector instructions, if asked for (see scanner.h) and available
+#if SCANNER_SIMD && defined(__AVX2__)
+#include <immintrin.h>
+#elif SCANNER_SIMD && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// bytes looked at in one go when splitting text into words, one bit each
+#define SCAN_BLOCK 64
+
+// a node in the trie used while compiling a scanner; children of a node are
+// linked as siblings, sorted by byte, and become the edges of its state
+struct TrieNode {
+  unsigned child;            // first child, 0 if none (the root is nobody's child)
+  unsigned sibling;          // next sibling, 0 if none
+  unsigned char byte;        // byte to get here from the parent
+  Symbol* symbol;            // literal that ends here, if any
+};
+
+// a trie being built
+struct Trie {
+  struct TrieNode* nodes;    // nodes, the root is the first one
+  unsigned cap;              //   capacity of table
+  unsigned size;             //   allocated elements in table
+};
+
+static void trie_insert(struct Trie* trie, Symbol* symbol);
+static unsigned trie_child(struct Trie* trie, unsigned parent, unsigned char byte);
+
+static void scan_block(const unsigned char* p, int delimiter, uint64_t* space, uint64_t* end);
+static unsigned scan_lowest(uint64_t bits);
+static void words_add(ScanWords* words, unsigned beg, unsigned end);
+
+void scanner_build(Scanner* scanner) {
+  scanner->symtab = 0;
+  scanner->states = 0;
+  scanner->state_cap = 0;
+  scanner->edges = 0;
+  scanner->edge_cap = 0;
+  scanner->mapped = 0;
+}
+
+void scanner_destroy(Scanner* scanner) {
+  if (scanner->mapped) {
+    scanner->states = 0;
+    scanner->edges = 0;
+  }
+  FREE(scanner->states);
+  scanner->state_cap = 0;
+  FREE(scanner->edges);
+  scanner->edge_cap = 0;
+  scanner->mapped = 0;
+}
+
+unsigned scanner_compile(Scanner* scanner, SymTab* symtab) {
+  scanner_destroy(scanner);
+  scanner->symtab = symtab;
+  struct Trie trie = {0};
+  trie.size = 64;
+  MALLOC_N(struct TrieNode, trie.nodes, trie.size);
+  trie.cap = 1;
+  for (Symbol* symbol = symtab->first; symbol != 0; symbol = symbol->nxt_list) {
+    if (!symbol->literal || !symbol->name.len) continue;
+    trie_insert(&trie, symbol);
+  }
+
+  // each node becomes a state, with its children as consecutive edges
+  scanner->state_cap = trie.cap;
+  MALLOC_N(struct ScanState, scanner->states, scanner->state_cap);
+  scanner->edge_cap = trie.cap - 1;
+  MALLOC_N(struct ScanEdge, scanner->edges, scanner->edge_cap);
+  unsigned E = 0;
+  for (unsigned N = 0; N < trie.cap; ++N) {
+    struct ScanState* state = &scanner->states[N];
+    state->first = E;
+    state->symbol = trie.nodes[N].symbol ? trie.nodes[N].symbol->index + 1 : 0;
+    for (unsigned C = trie.nodes[N].child; C != 0; C = trie.nodes[C].sibling) {
+      scanner->edges[E].next = C;
+      scanner->edges[E].byte = trie.nodes[C].byte;
+      ++E;
+    }
+    state->count = E - state->first;
+  }
+  FREE(trie.nodes);
+  LOG_DEBUG("compiled scanner: states=%u", scanner->state_cap);
+  return 0;
+}
+
+void scanner_map(Scanner* scanner, SymTab* symtab,
+                 const struct ScanState* states, unsigned state_cap,
+                 const struct ScanEdge* edges, unsigned edge_cap) {
+  scanner_destroy(scanner);
+  scanner->symtab = symtab;
+  scanner->states = (struct ScanState*) states;
+  scanner->state_cap = state_cap;
+  scanner->edges = (struct ScanEdge*) edges;
+  scanner->edge_cap = edge_cap;
+  scanner->mapped = 1;
+  LOG_DEBUG("mapped scanner: states=%u", scanner->state_cap);
+}
+
+unsigned scanner_match(Scanner* scanner, Slice text, unsigned pos, Symbol** symbol) {
+  *symbol = 0;
+  if (!scanner->state_cap) return 0;
+  unsigned len = 0;
+  unsigned found = 0;
+  struct ScanState* state = &scanner->states[0];
+  for (unsigned p = pos; p < text.len && state->count; ++p) {
+    // binary search for the byte among the edges, which are sorted
+    unsigned char byte = (unsigned char) text.ptr[p];
+    struct ScanEdge* edges = &scanner->edges[state->first];
+    unsigned lo = 0;
+    unsigned hi = state->count;
+    while (lo < hi) {
+      unsigned mid = (lo + hi) / 2;
+      if (edges[mid].byte < byte) lo = mid + 1;
+      else hi = mid;
+    }
+    if (lo == state->count || edges[lo].byte != byte) break;
+    state = &scanner->states[edges[lo].next];
+    if (state->symbol) {
+      found = state->symbol;
+      len = p + 1 - pos;
+    }
+  }
+  if (found) *symbol = symtab_find_symbol_by_index(scanner->symtab, found - 1);
+  return len;
+}
+
+unsigned scanner_split(Slice text, unsigned pos, int delimiter, ScanWords* words) {
+  words->cap = 0;
+  unsigned beg = 0;
+  int inside = 0; // are we inside a word?
+  for (unsigned base = pos; base < text.len; base += SCAN_BLOCK) {
+    const unsigned char* p = (const unsigned char*) text.ptr + base;
+    unsigned char tail[SCAN_BLOCK];
+    unsigned left = text.len - base;
+    if (left < SCAN_BLOCK) {
+      // never read past the text: pad its last block with white space
+      memset(tail, ' ', SCAN_BLOCK);
+      memcpy(tail, p, left);
+      p = tail;
+    }
+    uint64_t space = 0;
+    uint64_t end = 0;
+    scan_block(p, delimiter, &space, &end);
+    if (left < SCAN_BLOCK) end &= ((uint64_t) 1 << left) - 1;
+
+    // jump from one word boundary to the next, up to the end of the sentence
+    unsigned stop = end ? scan_lowest(end) : SCAN_BLOCK;
+    unsigned j = 0;
+    while (1) {
+      uint64_t change = (inside ? space : ~space) >> j;
+      if (!change) break;
+      j += scan_lowest(change);
+      if (j >= stop) break;
+      if (inside) {
+        words_add(words, beg, base + j);
+      } else {
+        beg = base + j;
+      }
+      inside = !inside;
+    }
+    if (stop < SCAN_BLOCK) {
+      if (inside) words_add(words, beg, base + stop);
+      return base + stop + 1;
+    }
+  }
+  if (inside) words_add(words, beg, text.len);
+  return text.len;
+}
+
+void scanner_words_destroy(ScanWords* words) {
+  FREE(words->table);
+  words->cap = 0;
+  words->size = 0;
+}
+
+static void trie_insert(struct Trie* trie, Symbol* symbol) {
+  unsigned N = 0;
+  for (unsigned j = 0; j < symbol->name.len; ++j) {
+    N = trie_child(trie, N, (unsigned char) symbol->name.ptr[j]);
+  }
+  trie->nodes[N].symbol = symbol;
+}
+
+// find the child of a node for a byte, creating it if needed
+static unsigned trie_child(struct Trie* trie, unsigned parent, unsigned char byte) {
+  unsigned prev = 0;
+  unsigned C = trie->nodes[parent].child;
+  for (; C != 0 && trie->nodes[C].byte < byte; C = trie->nodes[C].sibling) prev = C;
+  if (C != 0 && trie->nodes[C].byte == byte) return C;
+
+  if (trie->cap >= trie->size) {
+    trie->size *= 2;
+    REALLOC(struct TrieNode, trie->nodes, trie->size);
+  }
+  unsigned N = trie->cap++;
+  struct TrieNode* node = &trie->nodes[N];
+  node->child = 0;
+  node->sibling = C;
+  node->byte = byte;
+  node->symbol = 0;
+  if (prev) {
+    trie->nodes[prev].sibling = N;
+  } else {
+    trie->nodes[parent].child = N;
+  }
+  return N;
+}
+
+// find the white space (' ', or '\t' to '\r', as isspace() does) and the
+// delimiters in a block of bytes, and set one bit for each of them; the
+// delimiter, if any, counts as white space as well
+static void scan_block(const unsigned char* p, int delimiter, uint64_t* space, uint64_t* end) {
+#if SCANNER_SIMD && defined(__AVX2__)
+  for (unsigned j = 0; j < SCAN_BLOCK; j += 32) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i*) (p + j));
+    // bytes from '\t' to '\r' are those that stay small after subtracting '\t'
+    __m256i low = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+    __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(low, _mm256_set1_epi8('\r' - '\t')), low);
+    __m256i blank = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '));
+    *space |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(ctrl, blank)) << j;
+    if (delimiter < 0) continue;
+    __m256i delim = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8((char) delimiter));
+    *end |= (uint64_t) (uint32_t) _mm256_movemask_epi8(delim) << j;
+  }
+#elif SCANNER_SIMD && defined(__SSE2__)
+  for (unsigned j = 0; j < SCAN_BLOCK; j += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*) (p + j));
+    // bytes from '\t' to '\r' are those that stay small after subtracting '\t'
+    __m128i low = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+    __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(low, _mm_set1_epi8('\r' - '\t')), low);
+    __m128i blank = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '));
+    *space |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_or_si128(ctrl, blank)) << j;
+    if (delimiter < 0) continue;
+    __m128i delim = _mm_cmpeq_epi8(bytes, _mm_set1_epi8((char) delimiter));
+    *end |= (uint64_t) (uint16_t) _mm_movemask_epi8(delim) << j;
+  }
+#else
+  for (unsigned j = 0; j < SCAN_BLOCK; ++j) {
+    if (p[j] == ' ' || (unsigned char) (p[j] - '\t') <= '\r' - '\t') *space |= (uint64_t) 1 << j;
+    if (delimiter >= 0 && p[j] == (unsigned char) delimiter) *end |= (uint64_t) 1 << j;
+  }
+#endif
+  *space |= *end;
+}
+
+// return the position of the lowest bit set, which must exist
+static unsigned scan_lowest(uint64_t bits) {
+#if defined(__GNUC__)
+  return (unsigned) __builtin_ctzll(bits);
+#else
+  unsigned j = 0;
+  for (; !(bits & 1); bits >>= 1) ++j;
+  return j;
+#endif
+}
+
+static void words_add(ScanWords* words, unsigned beg, unsigned end) {
+  if (words->cap >= words->size) {
+    words->size = words->size ? 2 * words->size : 64;
+    REALLOC(unsigned, words->table, 2 * words->size);
+  }
+  words->table[2 * words->cap + 0] = beg;
+  words->table[2 * words->cap + 1] = end;
+  ++words->cap;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include "slice.h"
+
+struct Symbol;
+struct SymTab;
+
+// Compile-time switch for vector instructions when splitting text into words.
+// By default, white space is found with SSE2 16 bytes at a time (or with AVX2
+// 32 bytes at a time, when the compiler targets it).  Build with
+//
+//   $ make SIMD=0
+//
+// (or -DSCANNER_SIMD=0) to look at one byte at a time, as on other machines.
+#if !defined(SCANNER_SIMD)
+#define SCANNER_SIMD 1
+#endif
+
+// A scanner recognises the literals of a symbol table in some text, with a
+// DFA (a trie, since literals are just strings) that maps each literal
+// straight into its symbol, without hashing.  The symbol table must outlive
+// the scanner.  States and edges are all 32-bit integers, so that they are
+// saved as they are in a parser image, and used in place when it is mapped.
+
+// a state in the DFA
+struct ScanState {
+  uint32_t first;            // position of first edge out of this state
+  uint32_t count;            //   number of edges, sorted by byte
+  uint32_t symbol;           // index of the literal that ends here, plus 1; 0 if none
+};
+
+// an edge in the DFA
+struct ScanEdge {
+  uint32_t next;             // state to go to
+  uint32_t byte;             // byte to go there with
+};
+
+typedef struct Scanner {
+  struct SymTab* symtab;     // symbol table for the literals
+  struct ScanState* states;  // states, the start state is the first one
+  unsigned state_cap;        //   capacity of table
+  struct ScanEdge* edges;    // edges out of all states, grouped by state
+  unsigned edge_cap;         //   capacity of table
+  int mapped;                // do the tables belong to someone else?
+} Scanner;
+
+// passed to scanner_split() when only the end of the text ends a sentence
+#define SCANNER_NO_DELIMITER (-1)
+
+// the words in a sentence of text
+typedef struct ScanWords {
+  unsigned* table;           // offsets where each word begins and ends, in pairs
+  unsigned cap;              //   number of words
+  unsigned size;             //   allocated pairs in table
+} ScanWords;
+
+// Build an empty scanner, which recognises nothing.
+void scanner_build(Scanner* scanner);
+
+// Release all the memory held by a scanner.
+void scanner_destroy(Scanner* scanner);
+
+// Compile the literals in a symbol table into a scanner.
+// Return number of errors found (so 0 => ok)
+unsigned scanner_compile(Scanner* scanner, struct SymTab* symtab);
+
+// Use tables for a scanner compiled for a symbol table, as they were saved
+// in a parser image; they are not copied, and must outlive the scanner.
+void scanner_map(Scanner* scanner, struct SymTab* symtab,
+                 const struct ScanState* states, unsigned state_cap,
+                 const struct ScanEdge* edges, unsigned edge_cap);
+
+// Find the longest literal in a slice, starting at pos.
+// Return its length (0 if there is none), and store its symbol.
+unsigned scanner_match(Scanner* scanner, Slice text, unsigned pos, struct Symbol** symbol);
+
+// Find the words in a sentence of text, starting at pos: they are separated
+// by white space, and the sentence ends with a delimiter byte (which can be
+// SCANNER_NO_DELIMITER) or with the text.
+// Return the position right after the sentence.
+unsigned scanner_split(Slice text, unsigned pos, int delimiter, ScanWords* words);
+
+// Release the memory held by a list of words.
+void scanner_words_destroy(ScanWords* words);
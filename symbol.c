@@ -3,6 +3,7 @@
 #include "log.h"
 #include "mem.h"
 #include "buffer.h"
+#include "arena.h"
 #include "tomita.h"
 #include "symbol.h"
 
@@ -17,9 +18,6 @@ Symbol* symbol_create(Slice name, unsigned literal, unsigned* counter) {
 }
 
 void symbol_destroy(Symbol* symbol) {
-  for (unsigned j = 0; j < symbol->rs_cap; ++j) {
-    FREE(symbol->rs_table[j].rules);
-  }
   FREE(symbol->rs_table);
   FREE(symbol);
 }
@@ -46,7 +44,7 @@ void symbol_show(Symbol* symbol, Symbol* first, Symbol* last) {
   printf("\n");
 }
 
-void symbol_insert_rule(Symbol* symbol, Symbol** SymBuf, Symbol** SymP, unsigned* counter, unsigned index) {
+void symbol_insert_rule(Symbol* symbol, Arena* arena, Symbol** SymBuf, Symbol** SymP, unsigned* counter, unsigned index) {
   if (counter) {
     index = (*counter)++;
   }
@@ -77,8 +75,8 @@ void symbol_insert_rule(Symbol* symbol, Symbol** SymBuf, Symbol** SymP, unsigned
   }
 
   symbol->rs_table[k].index = index;
-  Symbol** rules = 0;
-  MALLOC_N(Symbol*, rules, size);
+  symbol->rs_table[k].len = size - 1;
+  Symbol** rules = (Symbol**) arena_alloc(arena, size * sizeof(Symbol*));
   symbol->rs_table[k].rules = rules;
   LOG_DEBUG("SYMBOL %p index %u ruleset %u at %p with index %u", symbol, symbol->index, k, rules, index);
   for (k = 0; k < size; ++k) {
@@ -89,7 +87,7 @@ void symbol_insert_rule(Symbol* symbol, Symbol** SymBuf, Symbol** SymP, unsigned
 }
 
 void symbol_save_definition(Symbol* symbol, Buffer* b) {
-  buffer_format_print(b, "%c %u [%.*s] %u %u\n", FORMAT_SYMBOL, symbol->index, symbol->name.len, symbol->name.ptr, (unsigned) symbol->literal, (unsigned) symbol->defined);
+  buffer_format_print(b, "%c %u [%.*s] %u %u %u\n", FORMAT_SYMBOL, symbol->index, symbol->name.len, symbol->name.ptr, (unsigned) symbol->literal, (unsigned) symbol->defined, (unsigned) symbol->open);
 }
 
 void symbol_save_rules(Symbol* symbol, Buffer* b) {
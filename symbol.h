@@ -3,15 +3,17 @@
 #include "slice.h"
 
 struct Buffer;
+struct Arena;
 
 typedef struct RuleSet {
   unsigned index;          // sequential ruleset number
+  unsigned len;            // number of symbols in right-hand side
   struct Symbol** rules;   // null-terminated list of symbols in right-hand side
 } RuleSet;
 
 // The rules of a symbol point to other symbols.
-// These pointers (and their containing array) are dynamically allocated,
-// but the symbols themselves just live in the symbol table.
+// These pointers are stored one rule after the other in an arena owned by the
+// symbol table, and the symbols themselves just live in the symbol table.
 // Therefore, we can simply delete the table at the end.
 
 // a Symbol in the grammar
@@ -20,9 +22,10 @@ typedef struct Symbol {
   Slice name;              // name for symbol
   unsigned char literal;   // is this a terminal (literal) or a non-terminal symbol?
   unsigned char defined;   // was there a definition for this symbol?
+  unsigned char open;      // was this declared an open lexical category?
   RuleSet* rs_table;       // table of RuleSets
   unsigned rs_cap;         //   capacity of table
-  struct Symbol* nxt_hash; // for symbol table chaining
+  struct Symbol* nxt_hash; // for chaining unknown words in a forest
   struct Symbol* nxt_list; // for linked list of all symbols
 } Symbol;
 
@@ -35,8 +38,9 @@ void symbol_destroy(Symbol* symbol);
 // Print a symbol in a human-readable format.
 void symbol_show(Symbol* symbol, Symbol* first, Symbol* last);
 
-// Insert the right-hand side rule that defines a (non-terminal) symbol.
-void symbol_insert_rule(Symbol* symbol, Symbol** SymBuf, Symbol** SymP, unsigned* counter, unsigned index);
+// Insert the right-hand side rule that defines a (non-terminal) symbol,
+// copying it into an arena.
+void symbol_insert_rule(Symbol* symbol, struct Arena* arena, Symbol** SymBuf, Symbol** SymP, unsigned* counter, unsigned index);
 
 // Save the symbol's definitions into a buffer.
 void symbol_save_definition(Symbol* symbol, struct Buffer* b);
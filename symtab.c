@@ -1,10 +1,10 @@
 #include <stdio.h>
 #include "mem.h"
 #include "log.h"
-#include "numtab.h"
 #include "util.h"
 #include "buffer.h"
 #include "tomita.h"
+#include "image.h"
 #include "symbol.h"
 #include "symtab.h"
 
@@ -13,79 +13,128 @@
 // copies all the pointers into rules, and then reset the work buffer.
 enum {
   SYMTAB_MAX_SYM = 0x100,
+  SYMTAB_RHS_CHUNK = 0x1000,   // bytes per chunk of right-hand sides
 };
 static Symbol* sym_buf[SYMTAB_MAX_SYM];
 static Symbol** sym_pos;
 
-static unsigned djb2(Slice s);
+static void symtab_insert(SymTab* symtab, unsigned hash, Symbol* symbol);
+static void symtab_grow(SymTab* symtab);
+static void symtab_index_rulesets(SymTab* symtab);
 
 SymTab* symtab_create(void) {
   SymTab* symtab = 0;
-  do {
-    MALLOC(SymTab, symtab);
-    if (!symtab) break;
-    symtab->idx2sym = numtab_create();
-  } while (0);
+  MALLOC(SymTab, symtab);
+  arena_build(&symtab->rhs, SYMTAB_RHS_CHUNK);
   return symtab;
 }
 
 void symtab_destroy(SymTab* symtab) {
   symtab_clear(symtab);
-  numtab_destroy(symtab->idx2sym);
+  FREE(symtab->table);
+  FREE(symtab->symbols);
+  FREE(symtab->rulesets);
+  arena_destroy(&symtab->rhs);
   FREE(symtab);
 }
 
 void symtab_clear(SymTab* symtab) {
-  for (unsigned h = 0; h < SYMTAB_HASH_MAX; ++h) {
-    for (Symbol* sym = symtab->table[h]; sym != 0; ) {
-      Symbol* tmp = sym;
-      sym = sym->nxt_hash;
-      symbol_destroy(tmp);
-    }
-    symtab->table[h] = 0;
+  for (unsigned h = 0; h < symtab->table_cap; ++h) {
+    struct SymSlot* slot = &symtab->table[h];
+    if (!slot->symbol) continue;
+    symbol_destroy(slot->symbol);
+    slot->symbol = 0;
   }
+  symtab->table_used = 0;
+  arena_reset(&symtab->rhs);
+  FREE(symtab->image_symbols);
+  FREE(symtab->image_rulesets);
+  FREE(symtab->image_rhs);
+  symtab->image = 0;
+  symtab->image_symbol_cap = 0;
   symtab->first = symtab->last = 0;
+  symtab->frozen = 0;
   symtab->symbol_counter = 0;
   symtab->rules_counter = 0;
-  numtab_clear(symtab->idx2sym);
+  symtab->rulesets_indexed = 0;
 }
 
 void symtab_show(SymTab* symtab) {
   printf("%c%c SYMTAB\n", FORMAT_COMMENT, FORMAT_COMMENT);
-  printf("table size: %u, symbol counter: %u, rules counter: %u\n",
-         SYMTAB_HASH_MAX, symtab->symbol_counter, symtab->rules_counter);
-  for (unsigned h = 0; h < SYMTAB_HASH_MAX; ++h) {
-    Symbol* bucket = symtab->table[h];
-    if (!bucket) continue;
-    printf("== bucket %u ==\n", h);
-    for (Symbol* sym = symtab->table[h]; sym != 0; sym = sym->nxt_hash) {
-      symbol_show(sym, symtab->first, symtab->last);
+  printf("table size: %u, used: %u, symbol counter: %u, rules counter: %u\n",
+         symtab->table_cap, symtab->table_used, symtab->symbol_counter, symtab->rules_counter);
+  if (symtab->image_symbol_cap) {
+    printf("== image ==\n");
+    for (unsigned j = 0; j < symtab->image_symbol_cap; ++j) {
+      symbol_show(&symtab->image_symbols[j], symtab->first, symtab->last);
     }
   }
+  for (unsigned h = 0; h < symtab->table_cap; ++h) {
+    struct SymSlot* slot = &symtab->table[h];
+    if (!slot->symbol) continue;
+    printf("== slot %u, hash %08x ==\n", h, slot->hash);
+    symbol_show(slot->symbol, symtab->first, symtab->last);
+  }
+}
+
+void symtab_freeze(SymTab* symtab) {
+  // no more rulesets either, so index them now; once frozen, lookups by
+  // index only read, and can be made from many threads
+  if (symtab->rulesets_indexed != symtab->rules_counter) symtab_index_rulesets(symtab);
+  symtab->frozen = 1;
 }
 
 Symbol* symtab_lookup(SymTab* symtab, Slice name, unsigned char literal, unsigned char insert) {
   Symbol* s = 0;
-  unsigned char h = djb2(name);
+  unsigned hash = symtab_hash(name, literal);
 
-  // try to locate first
-  for (s = symtab->table[h]; s != 0; s = s->nxt_hash) {
-    if (s->literal != literal) continue;        // different literal
-    if (!slice_equal(s->name, name)) continue;  // different name
-    return s;
+  // try to locate first, in the image and then in the table
+  if (symtab->image) {
+    // linear probing, until an empty slot
+    const char* base = (const char*) symtab->image;
+    const uint32_t* slots = (const uint32_t*) (base + symtab->image->slots);
+    const ImageSymbol* symbols = (const ImageSymbol*) (base + symtab->image->symbols);
+    unsigned mask = symtab->image->slot_cap - 1;
+    for (unsigned pos = hash & mask; slots[pos] != IMAGE_NONE; pos = (pos + 1) & mask) {
+      uint32_t j = slots[pos];
+      if (symbols[j].hash != hash) continue;
+      s = &symtab->image_symbols[j];
+      if (s->literal != literal) continue;
+      if (!slice_equal(s->name, name)) continue;
+      return s;
+    }
+  }
+  if (symtab->table_cap) {
+    // no symbol can be further away from its home slot than the one we
+    // are looking for would be, if it were there
+    unsigned mask = symtab->table_cap - 1;
+    unsigned pos = hash & mask;
+    for (unsigned dist = 0;; pos = (pos + 1) & mask, ++dist) {
+      struct SymSlot* slot = &symtab->table[pos];
+      if (!slot->symbol) break;
+      if (((pos - slot->hash) & mask) < dist) break;
+      if (slot->hash != hash) continue;           // different hash
+      s = slot->symbol;
+      if (s->literal != literal) continue;        // different literal
+      if (!slice_equal(s->name, name)) continue;  // different name
+      return s;
+    }
   }
 
   // not found
-  if (!insert) return 0;
+  if (!insert || symtab->frozen) return 0;
 
-  // must create and chain
+  // must create and insert
   s = symbol_create(name, literal, &symtab->symbol_counter);
-  Number* num = numtab_lookup(symtab->idx2sym, s->index, 1);
-  assert(num);
-  num->ptr = s;
+  if (s->index >= symtab->symbols_size) {
+    symtab->symbols_size = symtab->symbols_size ? 2 * symtab->symbols_size : 256;
+    while (symtab->symbols_size <= s->index) symtab->symbols_size *= 2;
+    REALLOC(Symbol*, symtab->symbols, symtab->symbols_size);
+  }
+  symtab->symbols[s->index] = s;
 
-  s->nxt_hash = symtab->table[h];
-  symtab->table[h] = s;
+  if (4 * (symtab->table_used + 1) > 3 * symtab->table_cap) symtab_grow(symtab);
+  symtab_insert(symtab, hash, s);
   if (symtab->first) {
     symtab->last->nxt_list = s;
   } else {
@@ -127,6 +176,7 @@ unsigned symtab_load_from_slice(SymTab* symtab, Slice* text) {
         Slice name;
         unsigned literal = 0;
         unsigned defined = 0;
+        unsigned open = 0;
         pos = next_number(line, pos, &index);
         LOG_DEBUG("INDEX=%u, SEQ=%u", index, sym_seq);
         assert(index == sym_seq);
@@ -134,10 +184,12 @@ unsigned symtab_load_from_slice(SymTab* symtab, Slice* text) {
         pos = next_string(line, pos, &name);
         pos = next_number(line, pos, &literal);
         pos = next_number(line, pos, &defined);
+        pos = next_number(line, pos, &open);
         Symbol* sym = symtab_lookup(symtab, name, literal, 1);
         LOG_DEBUG("loaded symbol: index=%u, name=[%.*s], literal=%u, defined=%u", index, name.len, name.ptr, literal, defined);
         assert(index == sym->index);
         sym->defined = defined;
+        sym->open = open;
         if (prev) prev->nxt_list = sym;
         prev = sym;
         continue;
@@ -159,7 +211,7 @@ unsigned symtab_load_from_slice(SymTab* symtab, Slice* text) {
           *sym_pos++ = symtab_find_symbol_by_index(symtab, rhs_index);
         }
         *sym_pos++ = 0;
-        symbol_insert_rule(lhs, sym_buf, sym_pos, 0, rs_index);
+        symbol_insert_rule(lhs, &symtab->rhs, sym_buf, sym_pos, 0, rs_index);
         ++symtab->rules_counter;
         continue;
       }
@@ -186,7 +238,7 @@ unsigned symtab_save_to_buffer(SymTab* symtab, Buffer* b) {
 
   buffer_format_print(b, "%c symtab: num_symbols num_rules\n", FORMAT_COMMENT);
   buffer_format_print(b, "%c %u %u\n", FORMAT_SYMTAB, total_symbols, total_rules);
-  buffer_format_print(b, "%c symbols (%u): index name literal defined\n", FORMAT_COMMENT, total_symbols);
+  buffer_format_print(b, "%c symbols (%u): index name literal defined open\n", FORMAT_COMMENT, total_symbols);
   for (Symbol* symbol = symtab->first; symbol != 0; symbol = symbol->nxt_list) {
     symbol_save_definition(symbol, b);
   }
@@ -198,18 +250,141 @@ unsigned symtab_save_to_buffer(SymTab* symtab, Buffer* b) {
   return 0;
 }
 
-Symbol* symtab_find_symbol_by_index(SymTab* symtab, unsigned index) {
-  Number* num = numtab_lookup(symtab->idx2sym, index, 0);
-  assert(num);
-  LOG_DEBUG("NUMTAB %u => %p", index, num->ptr);
-  return num->ptr;
+unsigned symtab_map_image(SymTab* symtab, const ImageHeader* image) {
+  symtab_clear(symtab);
+  unsigned errors = 0;
+  do {
+    if (!image->slot_cap || (image->slot_cap & (image->slot_cap - 1)) || image->slot_cap <= image->symbol_cap) {
+      LOG_WARN("symtab: image has %u hash slots for %u symbols", image->slot_cap, image->symbol_cap);
+      ++errors;
+      break;
+    }
+    const char* base = (const char*) image;
+    const ImageSymbol* symbols = (const ImageSymbol*) (base + image->symbols);
+    const ImageRuleSet* rulesets = (const ImageRuleSet*) (base + image->rulesets);
+    const uint32_t* rhs = (const uint32_t*) (base + image->rhs);
+
+    MALLOC_N(Symbol*, symtab->image_rhs, image->rhs_cap);
+    MALLOC_N(RuleSet, symtab->image_rulesets, image->ruleset_cap);
+    MALLOC_N(Symbol, symtab->image_symbols, image->symbol_cap);
+    for (unsigned j = 0; j < image->rhs_cap; ++j) {
+      symtab->image_rhs[j] = rhs[j] == IMAGE_NONE ? 0 : &symtab->image_symbols[rhs[j]];
+    }
+    for (unsigned j = 0; j < image->ruleset_cap; ++j) {
+      symtab->image_rulesets[j].index = rulesets[j].index;
+      symtab->image_rulesets[j].len = rulesets[j].rhs_len;
+      symtab->image_rulesets[j].rules = &symtab->image_rhs[rulesets[j].rhs_first];
+    }
+    for (unsigned j = 0; j < image->symbol_cap; ++j) {
+      Symbol* symbol = &symtab->image_symbols[j];
+      symbol->index = j;
+      symbol->name = slice_from_memory(base + symbols[j].name, symbols[j].name_len);
+      symbol->literal = symbols[j].literal;
+      symbol->defined = symbols[j].defined;
+      symbol->open = symbols[j].open;
+      symbol->rs_cap = symbols[j].rs_cap;
+      symbol->rs_table = symbol->rs_cap ? &symtab->image_rulesets[symbols[j].rs_first] : 0;
+      symbol->nxt_list = j + 1 < image->symbol_cap ? symbol + 1 : 0;
+    }
+    symtab->image = image;
+    symtab->image_symbol_cap = image->symbol_cap;
+    symtab->symbol_counter = image->symbol_cap;
+    symtab->rules_counter = image->rules_counter;
+    if (image->symbol_cap) {
+      symtab->first = &symtab->image_symbols[0];
+      symtab->last = &symtab->image_symbols[image->symbol_cap - 1];
+    }
+    symtab_index_rulesets(symtab);
+    LOG_DEBUG("mapped symtab: symbols=%u, rulesets=%u", image->symbol_cap, image->ruleset_cap);
+  } while (0);
+  return errors;
 }
 
-// http://www.cse.yorku.ca/~oz/hash.html
-static unsigned djb2(Slice s) {
-  unsigned hash = 5381;
-  for (unsigned p = 0; p < s.len; ++p) {
-    hash = ((hash << 5) + hash) + s.ptr[p]; /* hash * 33 + c */
+// FNV-1a over the name and literal flag, with a final avalanche (from
+// MurmurHash3) so that the low bits, used to pick a slot, depend on all
+// the bytes in the name
+unsigned symtab_hash(Slice name, unsigned char literal) {
+  uint32_t hash = 2166136261u;
+  for (unsigned p = 0; p < name.len; ++p) {
+    hash ^= (unsigned char) name.ptr[p];
+    hash *= 16777619u;
   }
+  hash ^= literal;
+  hash *= 16777619u;
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
   return hash;
 }
+
+Symbol* symtab_find_symbol_by_index(SymTab* symtab, unsigned index) {
+  if (index < symtab->image_symbol_cap) return &symtab->image_symbols[index];
+  if (index >= symtab->symbol_counter) return 0;
+  return symtab->symbols[index];
+}
+
+RuleSet* symtab_find_ruleset_by_index(SymTab* symtab, unsigned index) {
+  if (!symtab->frozen && symtab->rulesets_indexed != symtab->rules_counter) symtab_index_rulesets(symtab);
+  if (index >= symtab->rulesets_indexed) return 0;
+  return symtab->rulesets[index];
+}
+
+// put a symbol known not to be there into the table, which has room for it;
+// whenever it is further away from its home slot than the symbol in a slot,
+// it takes that slot and we go on inserting the displaced symbol
+static void symtab_insert(SymTab* symtab, unsigned hash, Symbol* symbol) {
+  unsigned mask = symtab->table_cap - 1;
+  unsigned pos = hash & mask;
+  for (unsigned dist = 0;; pos = (pos + 1) & mask, ++dist) {
+    struct SymSlot* slot = &symtab->table[pos];
+    if (!slot->symbol) {
+      slot->hash = hash;
+      slot->symbol = symbol;
+      ++symtab->table_used;
+      return;
+    }
+    unsigned slot_dist = (pos - slot->hash) & mask;
+    if (slot_dist >= dist) continue;
+    struct SymSlot displaced = *slot;
+    slot->hash = hash;
+    slot->symbol = symbol;
+    hash = displaced.hash;
+    symbol = displaced.symbol;
+    dist = slot_dist;
+  }
+}
+
+// rulesets move around while they are being added to their symbols, so we
+// only index them once they are all there -- which we notice because no
+// ruleset can be added without bumping rules_counter
+static void symtab_index_rulesets(SymTab* symtab) {
+  if (symtab->rulesets_size < symtab->rules_counter) {
+    symtab->rulesets_size = symtab->rules_counter;
+    REALLOC(RuleSet*, symtab->rulesets, symtab->rulesets_size);
+  }
+  if (symtab->rules_counter) memset(symtab->rulesets, 0, symtab->rules_counter * sizeof(RuleSet*));
+  for (Symbol* symbol = symtab->first; symbol != 0; symbol = symbol->nxt_list) {
+    for (unsigned j = 0; j < symbol->rs_cap; ++j) {
+      RuleSet* rs = &symbol->rs_table[j];
+      if (rs->index < symtab->rules_counter) symtab->rulesets[rs->index] = rs;
+    }
+  }
+  symtab->rulesets_indexed = symtab->rules_counter;
+}
+
+// double the size of the hash table, keeping its current symbols
+static void symtab_grow(SymTab* symtab) {
+  struct SymSlot* old = symtab->table;
+  unsigned old_cap = symtab->table_cap;
+  symtab->table_cap = old_cap ? 2 * old_cap : 256;
+  symtab->table = 0;
+  MALLOC_N(struct SymSlot, symtab->table, symtab->table_cap);
+  symtab->table_used = 0;
+  for (unsigned h = 0; h < old_cap; ++h) {
+    if (!old[h].symbol) continue;
+    symtab_insert(symtab, old[h].hash, old[h].symbol);
+  }
+  FREE(old);
+}
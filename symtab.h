@@ -1,22 +1,40 @@
 #pragma once
 
 #include "slice.h"
+#include "arena.h"
 
 struct Buffer;
+struct ImageHeader;
 
-// TODO: make hash table growable?
-enum {
-  SYMTAB_HASH_MAX = 0x100,
+// a slot in the hash table of a symbol table
+struct SymSlot {
+  unsigned hash;                         // cached hash of symbol name and literal
+  struct Symbol* symbol;                 // the symbol, null if the slot is empty
 };
 
-// a symbol (hash) table
+// a symbol (hash) table; the hash table uses open addressing with Robin Hood
+// hashing: a symbol can take the slot of another one that is closer to its
+// home slot, which keeps all probe sequences short
 typedef struct SymTab {
   unsigned symbol_counter;               // to create sequential indexes for symbols
   unsigned rules_counter;                // to create sequential indexes for rulesets
-  struct Symbol* table[SYMTAB_HASH_MAX]; // the actual table
+  struct SymSlot* table;                 // the actual table, a power of 2 of slots
+  unsigned table_cap;                    //   capacity of table
+  unsigned table_used;                   //   slots in use
   struct Symbol* first;                  // the first symbol seen
   struct Symbol* last;                   // the last symbol seen
-  struct NumTab* idx2sym;                // hash table for symbol indexes
+  unsigned char frozen;                  // are symbols no longer created?
+  Arena rhs;                             // right-hand sides of all rules, one after the other
+  struct Symbol** symbols;               // symbols by index
+  unsigned symbols_size;                 //   allocated elements in table
+  struct RuleSet** rulesets;             // rulesets by index, built when first needed
+  unsigned rulesets_size;                //   allocated elements in table
+  unsigned rulesets_indexed;             //   rules_counter when built
+  const struct ImageHeader* image;       // mapped image holding some symbols, if any
+  struct Symbol* image_symbols;          // symbols in image, by index
+  unsigned image_symbol_cap;             //   number of symbols
+  struct RuleSet* image_rulesets;        // rulesets for symbols in image
+  struct Symbol** image_rhs;             // right-hand sides for rulesets in image
 } SymTab;
 
 // Create an empty symbol table.
@@ -31,13 +49,24 @@ void symtab_clear(SymTab* symtab);
 // Print a symbol table in a human-readable format.
 void symtab_show(SymTab* symtab);
 
-// Look up a symbol with given name and literal, and create it if not found and we were told.
+// Freeze a symbol table, so that it is only read from now on (and can be
+// shared by many threads); it thaws when cleared.
+void symtab_freeze(SymTab* symtab);
+
+// Look up a symbol with given name and literal, and create it if not found and we were told
+// (and the table is not frozen).
 // Return the found / created symbol, or null if not found and not created.
 struct Symbol* symtab_lookup(SymTab* symtab, Slice name, unsigned char literal, unsigned char insert);
 
+// Return the hash for a symbol name and literal.
+unsigned symtab_hash(Slice name, unsigned char literal);
+
 // Find the symbol in the symbol table with the given index.
 struct Symbol* symtab_find_symbol_by_index(SymTab* symtab, unsigned index);
 
+// Find the ruleset in the symbol table with the given index.
+struct RuleSet* symtab_find_ruleset_by_index(SymTab* symtab, unsigned index);
+
 // Load a symbol table from a given path.
 // Format for file contents are "proprietary".
 // Return number of errors found (so 0 => ok)
@@ -47,3 +76,9 @@ unsigned symtab_load_from_slice(SymTab* symtab, Slice* text);
 // Format for saved contents are "proprietary".
 // Return number of errors found (so 0 => ok)
 unsigned symtab_save_to_buffer(SymTab* symtab, struct Buffer* b);
+
+// Take the symbols in a binary image as the contents of a symbol table.
+// Names stay in the image, which must outlive the symbol table contents;
+// symbols created afterwards are added as usual.
+// Return number of errors found (so 0 => ok)
+unsigned symtab_map_image(SymTab* symtab, const struct ImageHeader* image);
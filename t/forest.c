@@ -1,4 +1,6 @@
+#include <string.h>
 #include <tap.h>
+#include "buffer.h"
 #include "util.h"
 #include "symtab.h"
 #include "grammar.h"
@@ -70,6 +72,617 @@ static void test_build_forest(void) {
       forest_show(forest);
 #endif
     }
+
+    ForestStats high;
+    forest_stats(forest, &high);
+    ok(high.nodes > 0 && high.vertices > 0, "forest has high-water marks of %u nodes and %u vertices", high.nodes, high.vertices);
+    ok(high.subnodes > 1 && high.znodes > 0 && high.lists > 1, "forest has high-water marks of %u subnodes, %u stack nodes and %u list entries", high.subnodes, high.znodes, high.lists);
+    ok(forest_bytes(forest) > 0, "last forest takes %lu bytes", forest_bytes(forest));
+
+    // parsing the same sentences again should reuse the arena and tables as they are
+    forest_reserve(forest, &high);
+#if !ARENA_DEBUG
+    unsigned long held = arena_size(&forest->arena);
+#endif
+    struct Node* node_table = forest->node_table;
+    struct Subnode* sub_table = forest->sub_table;
+    unsigned* list_table = forest->list_table;
+    unsigned reparsed = 0;
+    for (unsigned j = 0; j < ALEN(exprs); ++j) {
+      Slice e = slice_from_string(exprs[j].what, 0);
+      if (forest_parse(forest, e) == 0 && forest->root && forest->root->sub_cap == exprs[j].branches) ++reparsed;
+    }
+    ok(reparsed == ALEN(exprs), "can parse all sources again with the same forest");
+    ok(forest->node_table == node_table, "pre-sized forest tables were kept across parses");
+    ok(forest->sub_table == sub_table && forest->list_table == list_table, "pre-sized forest pools were kept across parses");
+#if !ARENA_DEBUG
+    ok(arena_size(&forest->arena) == held, "forest arena was reused, it still holds %lu bytes", held);
+#endif
+  } while (0);
+  buffer_destroy(&grammar_src);
+  if (forest) forest_destroy(forest);
+  if (parser) parser_destroy(parser);
+  if (grammar) grammar_destroy(grammar);
+  if (symtab) symtab_destroy(symtab);
+}
+
+static void test_binarised_forest(void) {
+  static const struct {
+    unsigned branches;
+    const char* what;
+  } exprs[] = {
+    { 1, "9 - 3" },
+    { 2, "9 - 3 * 2" },
+    { 3, "1 * 2 * 3 * 4" },
+  };
+
+  unsigned errors = 0;
+  SymTab* symtab = 0;
+  Grammar* grammar = 0;
+  Parser* parser = 0;
+  Forest* forest = 0;
+  Buffer grammar_src; buffer_build(&grammar_src);
+  do {
+    ok(1, "=== TESTING binarised forest ===");
+
+    file_slurp(GRAMMAR_EXPR, &grammar_src);
+    symtab = symtab_create();
+    grammar = grammar_create(symtab);
+    parser = parser_create(symtab);
+    grammar_compile_from_slice(grammar, buffer_slice(&grammar_src));
+    parser_build_from_grammar(parser, grammar);
+    forest = forest_create(parser, 0, 0);
+    forest->binarised = 1;
+
+    for (unsigned j = 0; j < ALEN(exprs); ++j) {
+      const char* expr = exprs[j].what;
+      errors = forest_parse(forest, slice_from_string(expr, 0));
+      ok(errors == 0 && forest->root, "can parse source '%s' into a binarised parse forest", expr);
+      if (!forest->root) continue;
+      ok(forest->root->sub_cap == exprs[j].branches, "root node for '%s' has the expected %d branches", expr, exprs[j].branches);
+
+      unsigned intermediate = 0;
+      for (unsigned N = 0; N < forest->node_cap; ++N) {
+        if (forest->node_table[N].rule) ++intermediate;
+      }
+      ok(intermediate > 0, "binarised parse forest for '%s' has %u intermediate nodes", expr, intermediate);
+    }
+  } while (0);
+  buffer_destroy(&grammar_src);
+  if (forest) forest_destroy(forest);
+  if (parser) parser_destroy(parser);
+  if (grammar) grammar_destroy(grammar);
+  if (symtab) symtab_destroy(symtab);
+}
+
+static void test_right_nulled_forest(void) {
+  // a noun can be followed by two optional modifiers, so "n p n" has two
+  // parses: the prepositional phrase is either the first or the second one
+  static const char* source =
+    "S : NP ;"
+    "NP : N Mod Mod ;"
+    "N : n ;"
+    "Mod : | PP ;"
+    "PP : p NP ;"
+    "n ; p ;";
+
+  unsigned errors = 0;
+  SymTab* symtab = 0;
+  Grammar* grammar = 0;
+  Parser* parser = 0;
+  Forest* forest = 0;
+  do {
+    ok(1, "=== TESTING right-nulled forest ===");
+
+    symtab = symtab_create();
+    grammar = grammar_create(symtab);
+    parser = parser_create(symtab);
+    grammar_compile_from_slice(grammar, slice_from_string(source, 0));
+    errors = parser_build_from_grammar(parser, grammar);
+    ok(errors == 0 && parser->right_nulled, "can build a right-nulled parser from a grammar");
+
+    unsigned right_nulled = 0;
+    for (unsigned S = 0; S < parser->state_cap; ++S) {
+      struct ParserState* state = &parser->states[S];
+      for (unsigned R = 0; R < state->rr_cap; ++R) {
+        struct Reduce* Rd = &state->rr_table[R];
+        if (Rd->rs.rules[Rd->len]) ++right_nulled;
+      }
+    }
+    ok(right_nulled > 0, "parser has %u right-nulled reductions", right_nulled);
+
+    forest = forest_create(parser, 0, 0);
+    const char* text = "n p n";
+    errors = forest_parse(forest, slice_from_string(text, 0));
+    ok(errors == 0 && forest->root, "can parse source '%s' into a parse forest", text);
+    if (!forest->root) break;
+
+    struct Node* phrase = 0;
+    for (unsigned N = 0; N < forest->node_cap; ++N) {
+      struct Node* Nd = &forest->node_table[N];
+      if (Nd->Start == 0 && Nd->Size == 3 && slice_equal(Nd->symbol->name, slice_from_string("NP", 0))) phrase = Nd;
+    }
+    ok(phrase && phrase->sub_cap == 2, "noun phrase for '%s' has the expected 2 branches", text);
+  } while (0);
+  if (forest) forest_destroy(forest);
+  if (parser) parser_destroy(parser);
+  if (grammar) grammar_destroy(grammar);
+  if (symtab) symtab_destroy(symtab);
+}
+
+static void test_unknown_words(void) {
+  unsigned errors = 0;
+  SymTab* symtab = 0;
+  Grammar* grammar = 0;
+  Parser* parser = 0;
+  Forest* forest = 0;
+  Buffer grammar_src; buffer_build(&grammar_src);
+  do {
+    ok(1, "=== TESTING forest unknown words ===");
+
+    file_slurp(GRAMMAR_EXPR, &grammar_src);
+    symtab = symtab_create();
+    grammar = grammar_create(symtab);
+    parser = parser_create(symtab);
+    grammar_compile_from_slice(grammar, buffer_slice(&grammar_src));
+    errors = parser_build_from_grammar(parser, grammar);
+    ok(errors == 0 && symtab->frozen, "building a parser freezes its symtab");
+    unsigned symbols = symtab->symbol_counter;
+
+    // an unknown word can be any lexical category: an operator here
+    forest = forest_create(parser, 0, 0);
+    const char* text = "2 x 3 x 4";
+    errors = forest_parse(forest, slice_from_string(text, 0));
+    ok(errors == 0 && forest->root, "can parse source '%s' with unknown words", text);
+    ok(forest->unknown_cap == 1, "forest has %u unknown word, seen twice", forest->unknown_cap);
+    ok(symtab->symbol_counter == symbols, "unknown words are not added to the symtab");
+
+    forest_clear(forest);
+    ok(forest->unknown_cap == 0, "unknown words are gone after clearing the forest");
+  } while (0);
+  buffer_destroy(&grammar_src);
+  if (forest) forest_destroy(forest);
+  if (parser) parser_destroy(parser);
+  if (grammar) grammar_destroy(grammar);
+  if (symtab) symtab_destroy(symtab);
+}
+
+static void test_open_categories(void) {
+  // unknown words can only be nouns
+  static const char* source =
+    "S : N V N ;"
+    "N = dog cat ;"
+    "V = sees chases ;"
+    "% N ;";
+
+  unsigned errors = 0;
+  SymTab* symtab = 0;
+  Grammar* grammar = 0;
+  Parser* parser = 0;
+  Parser* loaded = 0;
+  Forest* forest = 0;
+  Buffer saved; buffer_build(&saved);
+  do {
+    ok(1, "=== TESTING forest open categories ===");
+
+    symtab = symtab_create();
+    grammar = grammar_create(symtab);
+    parser = parser_create(symtab);
+    errors = grammar_compile_from_slice(grammar, slice_from_string(source, 0));
+    ok(errors == 0, "can compile a grammar with open categories");
+    errors = parser_build_from_grammar(parser, grammar);
+    ok(errors == 0 && parser->open_cap == 1, "parser has %u open category", parser->open_cap);
+
+    forest = forest_create(parser, 0, 0);
+    const char* text = "fido sees cat";
+    errors = forest_parse(forest, slice_from_string(text, 0));
+    ok(errors == 0 && forest->root, "can parse source '%s' with an unknown noun", text);
+    text = "dog fido cat";
+    errors = forest_parse(forest, slice_from_string(text, 0));
+    ok(!forest->root, "cannot parse source '%s' with an unknown verb", text);
+
+    parser_save_to_buffer(parser, &saved);
+    SymTab* other = symtab_create();
+    loaded = parser_create(other);
+    errors = parser_load_from_slice(loaded, buffer_slice(&saved));
+    ok(errors == 0 && loaded->open_cap == 1 && loaded->open_table[0]->index == parser->open_table[0]->index,
+       "open categories are saved with the parser");
+    parser_destroy(loaded);
+    symtab_destroy(other);
+
+    // older files have no line for them, they are found as when building
+    Slice all = buffer_slice(&saved);
+    const char* line = memmem(all.ptr, all.len, "\no ", 3);
+    const char* end = memchr(line + 1, '\n', all.ptr + all.len - (line + 1));
+    Buffer older; buffer_build(&older);
+    buffer_append_string(&older, all.ptr, line - all.ptr);
+    buffer_append_string(&older, end, all.ptr + all.len - end);
+    other = symtab_create();
+    loaded = parser_create(other);
+    errors = parser_load_from_slice(loaded, buffer_slice(&older));
+    ok(errors == 0 && loaded->open_cap == 1 && loaded->open_table[0]->index == parser->open_table[0]->index,
+       "open categories are found for a parser saved without them");
+    parser_destroy(loaded);
+    symtab_destroy(other);
+    buffer_destroy(&older);
+  } while (0);
+  buffer_destroy(&saved);
+  if (forest) forest_destroy(forest);
+  if (parser) parser_destroy(parser);
+  if (grammar) grammar_destroy(grammar);
+  if (symtab) symtab_destroy(symtab);
+}
+
+// count the tokens shifted, through the forest callbacks
+static int count_new_token(void* fct, Slice t) {
+  UNUSED(t);
+  ++*(unsigned*) fct;
+  return 0;
+}
+
+static int count_reduce_rule(void* fct, RuleSet* rs) {
+  UNUSED(fct);
+  UNUSED(rs);
+  return 0;
+}
+
+static int count_accept(void* fct) {
+  UNUSED(fct);
+  return 0;
+}
+
+static void test_streaming_tokens(void) {
+  static const char* tokens[] = { "1", "*", "2", "*", "3", "*", "4" };
+  static const char* bad[] = { "1", "*", "*", "2" };
+
+  unsigned errors = 0;
+  SymTab* symtab = 0;
+  Grammar* grammar = 0;
+  Parser* parser = 0;
+  Forest* forest = 0;
+  Buffer grammar_src; buffer_build(&grammar_src);
+  do {
+    ok(1, "=== TESTING forest streaming tokens ===");
+
+    file_slurp(GRAMMAR_EXPR, &grammar_src);
+    symtab = symtab_create();
+    grammar = grammar_create(symtab);
+    parser = parser_create(symtab);
+    grammar_compile_from_slice(grammar, buffer_slice(&grammar_src));
+    errors = parser_build_from_grammar(parser, grammar);
+    ok(errors == 0, "can build a parser from a grammar");
+
+    forest = forest_create(parser, 0, 0);
+    const char* text = "1 * 2 * 3 * 4";
+    errors = forest_parse(forest, slice_from_string(text, 0));
+    unsigned long size = forest_size(forest);
+    ok(errors == 0 && size > 0, "can parse source '%s' in one go", text);
+
+    forest_begin(forest);
+    unsigned alive = 0;
+    unsigned shared = 0;
+    for (unsigned j = 0; j < ALEN(tokens); ++j) {
+      if (j % 2) {
+        forest_push_token(forest, slice_from_string(tokens[j], 0));
+      } else {
+        forest_push_symbol(forest, symtab_lookup(symtab, slice_from_string(tokens[j], 0), 1, 0));
+      }
+      if (forest_frontier_size(forest) > 0) ++alive;
+      // reductions reaching the same state share its vertex in the frontier;
+      // in '1 * 2 * 3', the Expr nodes after each '*' go to the same state
+      for (unsigned v = 0; v < forest_frontier_size(forest); ++v) {
+        for (unsigned w = v + 1; w < forest_frontier_size(forest); ++w) {
+          if (forest_frontier_state(forest, v) == forest_frontier_state(forest, w)) ++shared;
+        }
+      }
+    }
+    ok(alive == ALEN(tokens), "stack frontier is alive after pushing each of %u tokens", ALEN(tokens));
+    ok(shared == 0, "each state has a single vertex in each frontier");
+    errors = forest_end(forest);
+    ok(errors == 0 && forest->root && forest->root->sub_cap == 3, "can parse source '%s' one token at a time", text);
+    ok(forest_size(forest) == size, "forest parsed one token at a time has the same size, %lu", size);
+
+    forest_begin(forest);
+    unsigned dead = ALEN(bad);
+    for (unsigned j = 0; j < ALEN(bad) && dead == ALEN(bad); ++j) {
+      forest_push_token(forest, slice_from_string(bad[j], 0));
+      if (forest_frontier_size(forest) == 0) dead = j;
+    }
+    ok(dead == 3, "stack frontier is empty as soon as token %u arrives in '1 * * 2'", dead);
+    errors = forest_end(forest);
+    ok(errors != 0 && !forest->root, "cannot parse '1 * * 2'");
+
+    // tokens after the one that kills the stack are never shifted
+    ForestCallbacks callbacks = { count_new_token, count_reduce_rule, count_accept, 0 };
+    unsigned shifted = 0;
+    forest_destroy(forest);
+    forest = forest_create(parser, &callbacks, &shifted);
+    forest_begin(forest);
+    for (unsigned j = 0; j < ALEN(bad); ++j) {
+      forest_push_token(forest, slice_from_string(bad[j], 0));
+    }
+    errors = forest_end(forest);
+    ok(errors != 0 && forest->error_position == 2, "cannot parse '1 * * 2', fails at token %u", forest->error_position);
+    ok(shifted == 3, "only the %u tokens up to the failure were shifted", shifted);
+  } while (0);
+  buffer_destroy(&grammar_src);
+  if (forest) forest_destroy(forest);
+  if (parser) parser_destroy(parser);
+  if (grammar) grammar_destroy(grammar);
+  if (symtab) symtab_destroy(symtab);
+}
+
+static void test_scanned_literals(void) {
+  unsigned errors = 0;
+  SymTab* symtab = 0;
+  Grammar* grammar = 0;
+  Parser* parser = 0;
+  Forest* forest = 0;
+  Buffer grammar_src; buffer_build(&grammar_src);
+  do {
+    ok(1, "=== TESTING forest scanned literals ===");
+
+    file_slurp(GRAMMAR_EXPR, &grammar_src);
+    symtab = symtab_create();
+    grammar = grammar_create(symtab);
+    parser = parser_create(symtab);
+    grammar_compile_from_slice(grammar, buffer_slice(&grammar_src));
+    errors = parser_build_from_grammar(parser, grammar);
+    ok(errors == 0, "can build a parser from a grammar");
+
+    Symbol* symbol = 0;
+    unsigned len = scanner_match(&parser->scanner, slice_from_string("7*", 0), 0, &symbol);
+    ok(len == 1 && symbol == symtab_lookup(symtab, slice_from_string("7", 0), 1, 0), "scanner matches literal '7' in '7*'");
+    len = scanner_match(&parser->scanner, slice_from_string("x7", 0), 0, &symbol);
+    ok(len == 0 && symbol == 0, "scanner matches nothing in 'x7'");
+
+    forest = forest_create(parser, 0, 0);
+    const char* spaced = "1 * 2 - 3";
+    errors = forest_parse(forest, slice_from_string(spaced, 0));
+    unsigned long size = forest_size(forest);
+    ok(errors == 0 && size > 0, "can parse source '%s'", spaced);
+
+    const char* packed = "1*2-3";
+    errors = forest_parse(forest, slice_from_string(packed, 0));
+    ok(errors == 0 && forest->position == 5, "can parse source '%s' as %u tokens", packed, forest->position);
+    ok(forest_size(forest) == size, "forest for '%s' has the same size, %lu", packed, size);
+
+    const char* mixed = "1* 2 -3";
+    errors = forest_parse(forest, slice_from_string(mixed, 0));
+    ok(errors == 0 && forest_size(forest) == size, "can parse source '%s'", mixed);
+
+    const char* unknown = "1*2x";
+    forest_parse(forest, slice_from_string(unknown, 0));
+    ok(forest->position == 1, "word '%s' is not split, since 'x' is not a literal", unknown);
+
+    const char* digits = "12";
+    forest_parse(forest, slice_from_string(digits, 0));
+    ok(forest->position == 1, "word '%s' is not split between two digits", digits);
+
+    // words made of other words stay whole, and can be unknown words
+    forest_destroy(forest);
+    forest = 0;
+    parser_destroy(parser);
+    parser = 0;
+    grammar_destroy(grammar);
+    grammar = 0;
+    symtab_destroy(symtab);
+    symtab = symtab_create();
+    grammar = grammar_create(symtab);
+    parser = parser_create(symtab);
+    static const char* words_source =
+      "S : det noun ;"
+      "% noun ;"
+      "det = 'a' 'the' ;"
+      "noun = 'girl' 'boy' ;"
+    ;
+    grammar_compile_from_slice(grammar, slice_from_string(words_source, 0));
+    errors = parser_build_from_grammar(parser, grammar);
+    ok(errors == 0, "can build a parser from a grammar of words");
+    forest = forest_create(parser, 0, 0);
+    errors = forest_parse(forest, slice_from_string("the agirl", 0));
+    ok(errors == 0 && forest->position == 2, "word 'agirl' is not split into 'a' and 'girl', but is an unknown noun");
+    errors = forest_parse(forest, slice_from_string("theboy", 0));
+    ok(errors != 0, "word 'theboy' is not split into 'the' and 'boy'");
+  } while (0);
+  buffer_destroy(&grammar_src);
+  if (forest) forest_destroy(forest);
+  if (parser) parser_destroy(parser);
+  if (grammar) grammar_destroy(grammar);
+  if (symtab) symtab_destroy(symtab);
+}
+
+// semantic actions for the expression fixture, which count their calls and
+// pick the branch of ambiguous nodes they are told to
+struct Calc {
+  unsigned branch;
+  unsigned rules;
+  unsigned wrong;            // rule actions given a rule that does not fit
+};
+
+static ForestValue calc_token(void* ctx, struct Node* node) {
+  UNUSED(ctx);
+  ForestValue value = { .i = node->symbol->name.ptr[0] - '0' };
+  return value;
+}
+
+static ForestValue calc_rule(void* ctx, struct Node* node, RuleSet* rs,
+                             struct Node** children, ForestValue* values, unsigned count) {
+  struct Calc* calc = (struct Calc*) ctx;
+  ++calc->rules;
+  if (rs) {
+    // the rule recorded for the branch is one of the node's own rules
+    int fits = rs >= node->symbol->rs_table && rs < node->symbol->rs_table + node->symbol->rs_cap && rs->len == count;
+    for (unsigned j = 0; fits && j < count; ++j) fits = rs->rules[j] == children[j]->symbol;
+    if (!fits) ++calc->wrong;
+  }
+  ForestValue value = values[0];
+  if (rs && count == 3 && children[1]->symbol->name.ptr[0] == '-') value.i = values[0].i - values[2].i;
+  if (rs && count == 3 && children[1]->symbol->name.ptr[0] == '*') value.i = values[0].i * values[2].i;
+  return value;
+}
+
+static unsigned calc_choose(void* ctx, struct Node* node, unsigned count) {
+  UNUSED(node);
+  struct Calc* calc = (struct Calc*) ctx;
+  return calc->branch < count ? calc->branch : 0;
+}
+
+static ForestValue count_rule(void* ctx, struct Node* node, RuleSet* rs,
+                              struct Node** children, ForestValue* values, unsigned count) {
+  UNUSED(ctx);
+  UNUSED(node);
+  UNUSED(rs);
+  UNUSED(children);
+  ForestValue value = { .i = 0 };
+  for (unsigned j = 0; j < count; ++j) value.i += values[j].i;
+  return value;
+}
+
+static ForestValue count_token(void* ctx, struct Node* node) {
+  UNUSED(ctx);
+  UNUSED(node);
+  ForestValue value = { .i = 1 };
+  return value;
+}
+
+static void test_evaluate_forest(void) {
+  static const char* expr = "2 - 3 * 4";
+  static const char* list_source =
+    "List : List item | item ;"
+    "item = 'x';"
+  ;
+  enum { LIST_ITEMS = 20000 };
+
+  unsigned errors = 0;
+  SymTab* symtab = 0;
+  Grammar* grammar = 0;
+  Parser* parser = 0;
+  Forest* forest = 0;
+  Buffer grammar_src; buffer_build(&grammar_src);
+  Buffer text; buffer_build(&text);
+  do {
+    ok(1, "=== TESTING forest evaluation ===");
+
+    file_slurp(GRAMMAR_EXPR, &grammar_src);
+    symtab = symtab_create();
+    grammar = grammar_create(symtab);
+    parser = parser_create(symtab);
+    grammar_compile_from_slice(grammar, buffer_slice(&grammar_src));
+    parser_build_from_grammar(parser, grammar);
+    forest = forest_create(parser, 0, 0);
+
+    ForestActions actions = { calc_token, calc_rule, calc_choose };
+    for (unsigned binarised = 0; binarised <= 1; ++binarised) {
+      forest->binarised = binarised;
+      errors = forest_parse(forest, slice_from_string(expr, 0));
+      ok(errors == 0 && forest->root && forest->root->sub_cap == 2, "can parse ambiguous source '%s'", expr);
+
+      // (2 - 3) * 4 and 2 - (3 * 4), in some order
+      long values[2] = {0};
+      unsigned rules = 0;
+      unsigned wrong = 0;
+      for (unsigned b = 0; b < 2; ++b) {
+        struct Calc calc = { b, 0, 0 };
+        ForestValue value = { .i = 0 };
+        errors = forest_evaluate(forest, &actions, &calc, &value);
+        values[b] = value.i;
+        rules += calc.rules;
+        wrong += calc.wrong;
+        ForestValue* root = forest_node_value(forest, forest->root);
+        ok(errors == 0 && root && root->i == value.i, "%s forest for '%s' evaluates to %ld with branch %u",
+           binarised ? "binarised" : "plain", expr, value.i, b);
+      }
+      ok((values[0] == -4 && values[1] == -10) || (values[0] == -10 && values[1] == -4),
+         "each branch gets its own value");
+      // each branch has five Expr nodes, three digits and two operators (which
+      // are categories here), and none of them may be evaluated twice
+      ok(rules == 2 * 10, "rule actions were called %u times", rules);
+      ok(wrong == 0, "rule actions got the rule each branch was built with");
+    }
+
+    forest_destroy(forest);
+    parser_destroy(parser);
+    grammar_destroy(grammar);
+    symtab_destroy(symtab);
+    symtab = symtab_create();
+    grammar = grammar_create(symtab);
+    parser = parser_create(symtab);
+    grammar_compile_from_slice(grammar, slice_from_string(list_source, 0));
+    parser_build_from_grammar(parser, grammar);
+    forest = forest_create(parser, 0, 0);
+
+    for (unsigned j = 0; j < LIST_ITEMS; ++j) buffer_append_string(&text, "x ", 2);
+    errors = forest_parse(forest, buffer_slice(&text));
+    ok(errors == 0 && forest->root, "can parse a list of %u items", LIST_ITEMS);
+    ForestActions counter = { count_token, count_rule, 0 };
+    ForestValue value = { .i = 0 };
+    errors = forest_evaluate(forest, &counter, 0, &value);
+    ok(errors == 0 && value.i == LIST_ITEMS, "a derivation %u levels deep evaluates to %ld", LIST_ITEMS, value.i);
+
+    forest_clear(forest);
+    ok(forest_evaluate(forest, &counter, 0, &value) != 0, "cannot evaluate an empty forest");
+  } while (0);
+  buffer_destroy(&text);
+  buffer_destroy(&grammar_src);
+  if (forest) forest_destroy(forest);
+  if (parser) parser_destroy(parser);
+  if (grammar) grammar_destroy(grammar);
+  if (symtab) symtab_destroy(symtab);
+}
+
+// look for a symbol with a given name among some expected ones
+static int expected_has(Symbol** expected, unsigned count, const char* name) {
+  for (unsigned j = 0; j < count; ++j) {
+    if (slice_equal(expected[j]->name, slice_from_string(name, 0))) return 1;
+  }
+  return 0;
+}
+
+static void test_parse_errors(void) {
+  unsigned errors = 0;
+  SymTab* symtab = 0;
+  Grammar* grammar = 0;
+  Parser* parser = 0;
+  Forest* forest = 0;
+  Buffer grammar_src; buffer_build(&grammar_src);
+  do {
+    ok(1, "=== TESTING forest parse errors ===");
+
+    file_slurp(GRAMMAR_EXPR, &grammar_src);
+    symtab = symtab_create();
+    grammar = grammar_create(symtab);
+    parser = parser_create(symtab);
+    grammar_compile_from_slice(grammar, buffer_slice(&grammar_src));
+    errors = parser_build_from_grammar(parser, grammar);
+    ok(errors == 0, "can build a parser from a grammar");
+
+    forest = forest_create(parser, 0, 0);
+    Symbol* expected[8];
+    const char* text = "1 * * 2 * 3 * 4";
+    errors = forest_parse(forest, slice_from_string(text, 0));
+    ok(errors != 0 && !forest->root, "cannot parse source '%s'", text);
+    ok(forest->error_position == 2 && forest->error_symbol && slice_equal(forest->error_symbol->name, slice_from_string("*", 0)),
+       "parsing '%s' fails at token %u", text, forest->error_position);
+    ok(forest->position < 7, "parsing '%s' stops right after the failure, at token %u", text, forest->position);
+    unsigned count = forest_expected(forest, expected, ALEN(expected));
+    ok(count == 1 && expected_has(expected, count, "digit"), "parsing '%s' expected a digit", text);
+
+    text = "1 * 2 *";
+    errors = forest_parse(forest, slice_from_string(text, 0));
+    ok(errors != 0 && forest->error_position == 4 && !forest->error_symbol, "parsing '%s' fails at the end of the input", text);
+    count = forest_expected(forest, expected, ALEN(expected));
+    ok(count == 1 && expected_has(expected, count, "digit"), "parsing '%s' expected a digit", text);
+
+    text = "1 2";
+    errors = forest_parse(forest, slice_from_string(text, 0));
+    count = forest_expected(forest, expected, ALEN(expected));
+    ok(errors != 0 && forest->error_position == 1 && expected_has(expected, count, "-") && expected_has(expected, count, "*"),
+       "parsing '%s' fails at token 1, expecting an operator", text);
+
+    text = "1 * 2";
+    errors = forest_parse(forest, slice_from_string(text, 0));
+    ok(errors == 0 && forest_expected(forest, expected, ALEN(expected)) == 0, "nothing is expected after parsing '%s'", text);
   } while (0);
   buffer_destroy(&grammar_src);
   if (forest) forest_destroy(forest);
@@ -84,6 +697,14 @@ int main (int argc, char* argv[]) {
 
   do {
     test_build_forest();
+    test_binarised_forest();
+    test_right_nulled_forest();
+    test_unknown_words();
+    test_open_categories();
+    test_streaming_tokens();
+    test_scanned_literals();
+    test_parse_errors();
+    test_evaluate_forest();
   } while (0);
 
   done_testing();
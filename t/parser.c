@@ -1,7 +1,11 @@
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
 #include <tap.h>
 #include "util.h"
 #include "symtab.h"
 #include "grammar.h"
+#include "image.h"
 #include "parser.h"
 
 #define GRAMMAR_EXPR "t/fixtures/expr.grammar"
@@ -39,6 +43,9 @@ static void test_build_parser(void) {
 
     errors = parser_build_from_grammar(parser, grammar);
     ok(errors == 0, "can build a parser from a grammar");
+#if PARSER_LOOKAHEAD
+    ok(parser->la_bits > 0, "built parser has lookahead sets with %u bits", parser->la_bits);
+#endif
 
 #if 0
     parser_show(parser);
@@ -62,6 +69,18 @@ static void test_build_parser(void) {
     ok(slice_equal(c, l), "compiled and loaded parsers are identical");
     // printf(">>>\n%.*s<<<\n", c.len, c.ptr);
 
+    // older files have no right_nulled flag on their P line, and no
+    // lengths in their reductions
+    const char* P = memmem(c.ptr, c.len, "\nP ", 3);
+    const char* end = memchr(P + 1, '\n', c.ptr + c.len - (P + 1));
+    const char* last = end;
+    while (*--last != ' ') ;
+    buffer_clear(&loaded);
+    buffer_append_string(&loaded, c.ptr, last - c.ptr);
+    buffer_append_string(&loaded, end, c.ptr + c.len - end);
+    errors = parser_load_from_slice(parser, buffer_slice(&loaded));
+    ok(errors > 0, "cannot load a parser without reduction lengths");
+
   } while (0);
   buffer_destroy(&loaded);
   buffer_destroy(&compiled);
@@ -71,12 +90,203 @@ static void test_build_parser(void) {
   if (symtab) symtab_destroy(symtab);
 }
 
+static void test_goto_table(void) {
+  SymTab* symtab = 0;
+  Grammar* grammar = 0;
+  Parser* parser = 0;
+  Buffer grammar_src; buffer_build(&grammar_src);
+  do {
+    ok(1, "=== TESTING parser goto table ===");
+
+    file_slurp(GRAMMAR_EXPR, &grammar_src);
+    symtab = symtab_create();
+    grammar = grammar_create(symtab);
+    parser = parser_create(symtab);
+    grammar_compile_from_slice(grammar, buffer_slice(&grammar_src));
+
+    for (unsigned layout = PARSER_GOTO_DENSE; layout < PARSER_GOTO_LAST; ++layout) {
+      parser->goto_layout = layout;
+      parser_build_from_grammar(parser, grammar);
+      ok(parser->goto_used == layout, "goto table uses layout %u with %u entries", layout, parser->goto_cap);
+
+      unsigned found = 0;
+      unsigned total = 0;
+      unsigned missing = 0;
+      for (unsigned S = 0; S < parser->state_cap; ++S) {
+        struct ParserState* state = &parser->states[S];
+        for (unsigned X = 0; X < state->ss_cap; ++X) {
+          struct Shift* shift = &state->ss_table[X];
+          ++total;
+          if (parser_goto(parser, S, shift->symbol) == shift->state) ++found;
+        }
+        for (Symbol* symbol = symtab->first; symbol != 0; symbol = symbol->nxt_list) {
+          unsigned X = 0;
+          for (X = 0; X < state->ss_cap; ++X) {
+            if (state->ss_table[X].symbol == symbol) break;
+          }
+          if (X < state->ss_cap) continue;
+          if (parser_goto(parser, S, symbol) != PARSER_NO_STATE) ++missing;
+        }
+      }
+      ok(found == total, "goto table finds all %u transitions", total);
+      ok(missing == 0, "goto table finds no spurious transitions");
+    }
+  } while (0);
+  buffer_destroy(&grammar_src);
+  if (parser) parser_destroy(parser);
+  if (grammar) grammar_destroy(grammar);
+  if (symtab) symtab_destroy(symtab);
+}
+
+static void test_parser_image(void) {
+  unsigned errors = 0;
+  SymTab* symtab = 0;
+  Grammar* grammar = 0;
+  Parser* parser = 0;
+  SymTab* mapped_symtab = 0;
+  Parser* mapped = 0;
+  Buffer grammar_src; buffer_build(&grammar_src);
+  Buffer image; buffer_build(&image);
+  Buffer compiled; buffer_build(&compiled);
+  Buffer loaded; buffer_build(&loaded);
+  Buffer broken_image; buffer_build(&broken_image);
+  const char* path = "/tmp/tomita-test-parser.img";
+  do {
+    ok(1, "=== TESTING parser image ===");
+
+    file_slurp(GRAMMAR_EXPR, &grammar_src);
+    symtab = symtab_create();
+    grammar = grammar_create(symtab);
+    parser = parser_create(symtab);
+    grammar_compile_from_slice(grammar, buffer_slice(&grammar_src));
+    errors = parser_build_from_grammar(parser, grammar);
+    ok(errors == 0, "can build a parser from a grammar");
+    parser_save_to_buffer(parser, &compiled);
+
+    errors = parser_save_image(parser, &image);
+    ok(errors == 0, "can save a parser image to a buffer");
+    ok(image.len > 0, "saved parser image has a valid non-zero size of %u bytes", image.len);
+
+    mapped_symtab = symtab_create();
+    mapped = parser_create(mapped_symtab);
+    errors = parser_map_slice(mapped, buffer_slice(&image));
+    ok(errors == 0, "can map a parser image from a buffer");
+    parser_save_to_buffer(mapped, &loaded);
+    ok(slice_equal(buffer_slice(&compiled), buffer_slice(&loaded)), "compiled and mapped parsers are identical");
+    ok(mapped->scanner.mapped && mapped->scanner.state_cap == parser->scanner.state_cap,
+       "mapped parser uses the scanner in the image, with %u states", mapped->scanner.state_cap);
+    Symbol* minus = 0;
+    unsigned minus_len = scanner_match(&mapped->scanner, slice_from_string("-2", 0), 0, &minus);
+    ok(minus_len == 1 && minus == symtab_lookup(mapped_symtab, slice_from_string("-", 0), 1, 0),
+       "mapped scanner finds literal - in its symbol table");
+
+    Slice broken = buffer_slice(&image);
+    broken.len /= 2;
+    errors = parser_map_slice(mapped, broken);
+    ok(errors > 0, "cannot map a truncated parser image");
+
+    // entries pointing outside their tables, in an otherwise valid image
+    const ImageHeader* header = (const ImageHeader*) image.ptr;
+    static const struct {
+      const char* what;
+      unsigned section;        // offset in header of the section offset
+      unsigned field;          // offset of the field in the entry
+    } Corruptions[] = {
+      { "symbol name"    , offsetof(ImageHeader, symbols)   , offsetof(ImageSymbol, name)       },
+      { "symbol ruleset" , offsetof(ImageHeader, symbols)   , offsetof(ImageSymbol, rs_first)   },
+      { "ruleset"        , offsetof(ImageHeader, rulesets)  , offsetof(ImageRuleSet, rhs_first) },
+      { "right-hand side", offsetof(ImageHeader, rhs)       , 0                                 },
+      { "state"          , offsetof(ImageHeader, states)    , offsetof(ImageState, ss_first)    },
+      { "shift"          , offsetof(ImageHeader, shifts)    , offsetof(ImageShift, state)       },
+      { "reduction"      , offsetof(ImageHeader, reduces)   , offsetof(ImageReduce, ruleset)    },
+      { "lookahead"      , offsetof(ImageHeader, reduces)   , offsetof(ImageReduce, la)         },
+      { "goto entry"     , offsetof(ImageHeader, goto_next) , 0                                 },
+      { "scanner state"  , offsetof(ImageHeader, scan_states), offsetof(struct ScanState, first)  },
+      { "scanner edge"   , offsetof(ImageHeader, scan_edges), offsetof(struct ScanEdge, next)     },
+    };
+    for (unsigned j = 0; j < ALEN(Corruptions); ++j) {
+      buffer_clear(&broken_image);
+      buffer_append_slice(&broken_image, buffer_slice(&image));
+      uint32_t section = *(const uint32_t*) (image.ptr + Corruptions[j].section);
+      // no position or offset in the first entry can be as large as the image
+      uint32_t* field = (uint32_t*) (broken_image.ptr + section + Corruptions[j].field);
+      *field = header->size;
+      errors = parser_map_slice(mapped, buffer_slice(&broken_image));
+      ok(errors > 0, "cannot map a parser image with an invalid %s", Corruptions[j].what);
+    }
+    errors = parser_map_slice(mapped, buffer_slice(&image));
+    ok(errors == 0, "can still map the valid parser image");
+
+    unsigned written = file_spew(path, buffer_slice(&image));
+    ok(written == image.len, "can write parser image to file %s", path);
+    errors = parser_map_file(mapped, path);
+    ok(errors == 0, "can map a parser image from a file");
+    buffer_clear(&loaded);
+    parser_save_to_buffer(mapped, &loaded);
+    ok(slice_equal(buffer_slice(&compiled), buffer_slice(&loaded)), "compiled and file-mapped parsers are identical");
+  } while (0);
+  unlink(path);
+  buffer_destroy(&broken_image);
+  buffer_destroy(&loaded);
+  buffer_destroy(&compiled);
+  buffer_destroy(&image);
+  buffer_destroy(&grammar_src);
+  if (mapped) parser_destroy(mapped);
+  if (mapped_symtab) symtab_destroy(mapped_symtab);
+  if (parser) parser_destroy(parser);
+  if (grammar) grammar_destroy(grammar);
+  if (symtab) symtab_destroy(symtab);
+}
+
+#if PARSER_LOOKAHEAD
+static void test_build_parser_modes(void) {
+  unsigned errors = 0;
+  SymTab* symtab = 0;
+  Grammar* grammar = 0;
+  Parser* parser = 0;
+  Buffer grammar_src; buffer_build(&grammar_src);
+  do {
+    ok(1, "=== TESTING parser modes ===");
+
+    file_slurp(GRAMMAR_EXPR, &grammar_src);
+    symtab = symtab_create();
+    grammar = grammar_create(symtab);
+    parser = parser_create(symtab);
+    errors = grammar_compile_from_slice(grammar, buffer_slice(&grammar_src));
+    ok(errors == 0, "can compile a grammar from source");
+
+    ParserStats lalr;
+    errors = parser_build_from_grammar(parser, grammar);
+    ok(errors == 0, "can build a %s parser from a grammar", parser_mode_name(parser->mode));
+    parser_stats(parser, &lalr);
+
+    ParserStats lr1;
+    parser->mode = PARSER_MODE_LR1;
+    errors = parser_build_from_grammar(parser, grammar);
+    ok(errors == 0, "can build a %s parser from a grammar", parser_mode_name(parser->mode));
+    parser_stats(parser, &lr1);
+
+    ok(lr1.states >= lalr.states, "LR(1) parser has %u states, LALR(1) has %u", lr1.states, lalr.states);
+    ok(lr1.conflict_rr <= lalr.conflict_rr, "LR(1) parser has %u r/r conflicts, LALR(1) has %u", lr1.conflict_rr, lalr.conflict_rr);
+  } while (0);
+  buffer_destroy(&grammar_src);
+  if (parser) parser_destroy(parser);
+  if (grammar) grammar_destroy(grammar);
+  if (symtab) symtab_destroy(symtab);
+}
+#endif
+
 int main (int argc, char* argv[]) {
   UNUSED(argc);
   UNUSED(argv);
 
   do {
     test_build_parser();
+    test_goto_table();
+    test_parser_image();
+#if PARSER_LOOKAHEAD
+    test_build_parser_modes();
+#endif
   } while (0);
 
   done_testing();
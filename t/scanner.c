@@ -0,0 +1,121 @@
+#include <tap.h>
+#include "buffer.h"
+#include "util.h"
+#include "symbol.h"
+#include "symtab.h"
+#include "scanner.h"
+
+static void test_match_literals(void) {
+  static const char* literals[] = { "+", "+=", "if", "iff", "i" };
+  static struct {
+    const char* text;
+    unsigned pos;
+    unsigned len;
+  } Matches[] = {
+    { "+"      , 0, 1 },
+    { "+=1"    , 0, 2 },
+    { "a+=1"   , 1, 2 },
+    { "iffy"   , 0, 3 },
+    { "if"     , 0, 2 },
+    { "ix"     , 0, 1 },
+    { "x"      , 0, 0 },
+    { "="      , 0, 0 },
+    { "iff"    , 3, 0 },
+  };
+  SymTab* symtab = symtab_create();
+  Scanner scanner; scanner_build(&scanner);
+  do {
+    ok(1, "=== TESTING scanner match literals ===");
+    Symbol* symbol = 0;
+    unsigned len = scanner_match(&scanner, slice_from_string("if", 0), 0, &symbol);
+    ok(len == 0 && symbol == 0, "empty scanner matches nothing");
+
+    for (unsigned j = 0; j < ALEN(literals); ++j) {
+      symtab_lookup(symtab, slice_from_string(literals[j], 0), 1, 1);
+    }
+    // a category is not a literal, and must never be matched
+    symtab_lookup(symtab, slice_from_string("x", 0), 0, 1);
+    symtab_freeze(symtab);
+    unsigned errors = scanner_compile(&scanner, symtab);
+    ok(errors == 0, "can compile a scanner for %u literals", ALEN(literals));
+
+    for (unsigned j = 0; j < ALEN(Matches); ++j) {
+      Slice text = slice_from_string(Matches[j].text, 0);
+      len = scanner_match(&scanner, text, Matches[j].pos, &symbol);
+      Symbol* wanted = 0;
+      if (Matches[j].len) {
+        wanted = symtab_lookup(symtab, slice_from_memory(text.ptr + Matches[j].pos, Matches[j].len), 1, 0);
+      }
+      ok(len == Matches[j].len && symbol == wanted, "longest match in '%s' at %u has length %u", Matches[j].text, Matches[j].pos, len);
+    }
+  } while (0);
+  scanner_destroy(&scanner);
+  symtab_destroy(symtab);
+}
+
+static void test_split_words(void) {
+  static struct {
+    const char* text;
+    int delimiter;
+    unsigned words;
+    unsigned next;           // position right after the first sentence
+  } Sentences[] = {
+    { ""                    , '\n'                 , 0,  0 },
+    { "   \t "              , '\n'                 , 0,  5 },
+    { "one"                 , '\n'                 , 1,  3 },
+    { " one  two\tthree "   , '\n'                 , 3, 16 },
+    { "a\rb\vc\fd"          , '\n'                 , 4,  7 },
+    { "one two\nthree four" , '\n'                 , 2,  8 },
+    { "\none"               , '\n'                 , 0,  1 },
+    { "one two\nthree four" , SCANNER_NO_DELIMITER, 4, 18 },
+    { "one;two three;four"  , ';'                 , 1,  4 },
+    { "one two;three"       , ' '                 , 1,  4 },
+    { "one two "            , ' '                 , 1,  4 },
+    { "one"                 , ' '                 , 1,  3 },
+  };
+  ScanWords words = {0};
+  Buffer text; buffer_build(&text);
+  do {
+    ok(1, "=== TESTING scanner split words ===");
+    for (unsigned j = 0; j < ALEN(Sentences); ++j) {
+      Slice sentence = slice_from_string(Sentences[j].text, 0);
+      unsigned next = scanner_split(sentence, 0, Sentences[j].delimiter, &words);
+      ok(words.cap == Sentences[j].words && next == Sentences[j].next, "found %u words in sentence %u, next one at %u", words.cap, j, next);
+    }
+
+    // words of growing length, so that they end on both sides of every block
+    // boundary; no word may be lost or split
+    unsigned count = 0;
+    unsigned wrong = 0;
+    for (unsigned len = 1; len <= 70; ++len) {
+      for (unsigned k = 0; k < len; ++k) buffer_append_byte(&text, 'a' + len % 26);
+      buffer_append_byte(&text, len % 3 ? ' ' : '\t');
+      ++count;
+    }
+    buffer_append_string(&text, "\nnext", 0);
+    unsigned next = scanner_split(buffer_slice(&text), 0, '\n', &words);
+    for (unsigned w = 0; w < words.cap; ++w) {
+      unsigned beg = words.table[2 * w + 0];
+      unsigned end = words.table[2 * w + 1];
+      if (end - beg != w + 1 || text.ptr[beg] != (char) ('a' + (w + 1) % 26)) ++wrong;
+    }
+    ok(words.cap == count && wrong == 0, "found all %u words of growing length in a long line", count);
+    ok(next == text.len - 4, "next line starts at %u", next);
+    next = scanner_split(buffer_slice(&text), next, '\n', &words);
+    ok(words.cap == 1 && next == text.len, "found the word in the next line");
+  } while (0);
+  buffer_destroy(&text);
+  scanner_words_destroy(&words);
+}
+
+int main (int argc, char* argv[]) {
+  UNUSED(argc);
+  UNUSED(argv);
+
+  do {
+    test_match_literals();
+    test_split_words();
+  } while (0);
+
+  done_testing();
+}
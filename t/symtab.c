@@ -80,6 +80,11 @@ static void test_build_symtab(void) {
       }
     }
 
+    symtab_freeze(symtab);
+    unsigned counter = symtab->symbol_counter;
+    Symbol* frozen = symtab_lookup(symtab, slice_from_string(Elves[0].name, 0), 1, 1);
+    ok(frozen == 0 && symtab->symbol_counter == counter, "frozen symtab does not create symbols");
+
     buffer_clear(&created);
     errors = symtab_save_to_buffer(symtab, &created);
     ok(errors == 0, "can save a created symtab to a buffer");
@@ -90,6 +95,7 @@ static void test_build_symtab(void) {
     errors = symtab_load_from_slice(symtab, &x);
     ok(errors == 0, "can load a created symtab from a buffer");
     ok(x.len == 0, "after loading, there was nothing after the symtab contents");
+    ok(!symtab->frozen, "loaded symtab is no longer frozen");
 
     buffer_clear(&loaded);
     errors = symtab_save_to_buffer(symtab, &loaded);
@@ -107,12 +113,80 @@ static void test_build_symtab(void) {
   if (symtab) symtab_destroy(symtab);
 }
 
+static void test_grow_symtab(void) {
+  enum { COUNT = 5000 };
+  SymTab* symtab = 0;
+  Buffer names; buffer_build(&names);
+  do {
+    ok(1, "=== TESTING symtab growth ===");
+
+    // names are not copied, so they must all be in place before inserting
+    unsigned offsets[COUNT + 1];
+    for (unsigned j = 0; j < COUNT; ++j) {
+      offsets[j] = names.len;
+      buffer_format_print(&names, "word%u", j);
+    }
+    offsets[COUNT] = names.len;
+
+    symtab = symtab_create();
+    for (unsigned literal = 0; literal < 2; ++literal) {
+      for (unsigned j = 0; j < COUNT; ++j) {
+        Slice name = slice_from_memory(names.ptr + offsets[j], offsets[j + 1] - offsets[j]);
+        symtab_lookup(symtab, name, literal, 1);
+      }
+    }
+    ok(symtab->table_used == 2 * COUNT, "symtab has all %u symbols", 2 * COUNT);
+    ok(symtab->table_cap >= symtab->table_used && !(symtab->table_cap & (symtab->table_cap - 1)),
+       "symtab grew to %u slots", symtab->table_cap);
+
+    unsigned found = 0;
+    for (unsigned literal = 0; literal < 2; ++literal) {
+      for (unsigned j = 0; j < COUNT; ++j) {
+        Slice name = slice_from_memory(names.ptr + offsets[j], offsets[j + 1] - offsets[j]);
+        Symbol* s = symtab_lookup(symtab, name, literal, 0);
+        if (s && s->literal == literal && s->index == literal * COUNT + j) ++found;
+      }
+    }
+    ok(found == 2 * COUNT, "can find all %u symbols after growing", 2 * COUNT);
+
+    unsigned ordered = 0;
+    for (Symbol* s = symtab->first; s != 0; s = s->nxt_list) {
+      if (s->index == ordered) ++ordered;
+    }
+    ok(ordered == 2 * COUNT, "symbols are still listed in insertion order");
+
+    unsigned indexed = 0;
+    for (unsigned j = 0; j < 2 * COUNT; ++j) {
+      Symbol* s = symtab_find_symbol_by_index(symtab, j);
+      if (s && s->index == j) ++indexed;
+    }
+    ok(indexed == 2 * COUNT, "can find all %u symbols by index", 2 * COUNT);
+    ok(symtab_find_symbol_by_index(symtab, 2 * COUNT) == 0, "there is no symbol past the last index");
+
+    // every literal gets a rule with the non-terminal of the same name
+    for (Symbol* s = symtab->first; s != 0; s = s->nxt_list) {
+      if (!s->literal) continue;
+      Symbol* rule[2] = { symtab_find_symbol_by_index(symtab, s->index - COUNT), 0 };
+      symbol_insert_rule(s, &symtab->rhs, rule, rule + 2, &symtab->rules_counter, 0);
+    }
+    unsigned rules = 0;
+    for (unsigned j = 0; j < COUNT; ++j) {
+      RuleSet* rs = symtab_find_ruleset_by_index(symtab, j);
+      if (rs && rs->index == j && rs->len == 1 && rs->rules[0]->index == j && !rs->rules[1]) ++rules;
+    }
+    ok(rules == COUNT, "can find all %u rulesets by index, with their length", COUNT);
+  } while (0);
+  buffer_destroy(&names);
+  if (symtab) symtab_destroy(symtab);
+}
+
 int main (int argc, char* argv[]) {
   UNUSED(argc);
   UNUSED(argv);
 
   do {
     test_build_symtab();
+    test_grow_symtab();
   } while (0);
 
   done_testing();
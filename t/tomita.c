@@ -1,6 +1,12 @@
 #include <tap.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include "buffer.h"
 #include "util.h"
+#include "symtab.h"
+#include "parser.h"
 #include "forest.h"
 #include "tomita.h"
 
@@ -43,12 +49,214 @@ static void test_tomita_build_and_parse_ok(void) {
   if (tomita) tomita_destroy(tomita);
 }
 
+static void test_tomita_parser_cache(void) {
+  static const char* expr_source =
+    "2 - 3 * 4"
+  ;
+  unsigned errors = 0;
+  Buffer grammar_src; buffer_build(&grammar_src);
+  char dir[] = "/tmp/tomita-cache-XXXXXX";
+  do {
+    ok(1, "=== TESTING tomita parser cache ===");
+
+    file_slurp(GRAMMAR_EXPR, &grammar_src);
+    ok(mkdtemp(dir) != 0, "can create cache directory %s", dir);
+
+    // the first time builds the parser, the second one maps it
+    unsigned long sizes[2] = {0};
+    for (unsigned j = 0; j < 2; ++j) {
+      Tomita* tomita = tomita_create(0, 0);
+      unsigned hit = 2;
+      errors = tomita_parser_build_cached(tomita, buffer_slice(&grammar_src), dir, &hit);
+      ok(errors == 0 && hit == j, "tomita can build a parser with the cache, run %u %s it", j, hit ? "hits" : "misses");
+      errors = tomita_forest_parse_from_slice(tomita, slice_from_string(expr_source, 0));
+      sizes[j] = errors ? 0 : forest_size(tomita->forest);
+      tomita_destroy(tomita);
+    }
+    ok(sizes[0] > 0 && sizes[0] == sizes[1], "cached parser gives the same forest, size %lu", sizes[0]);
+
+    // a different mode is a different parser
+    Tomita* tomita = tomita_create(0, 0);
+    unsigned hit = 2;
+    tomita_parser_set_mode(tomita, PARSER_MODE_LR1);
+    errors = tomita_parser_build_cached(tomita, buffer_slice(&grammar_src), dir, &hit);
+    ok(errors == 0 && hit == 0, "tomita builds another parser for another mode");
+    tomita_destroy(tomita);
+
+    // and so is a different goto table layout
+    tomita = tomita_create(0, 0);
+    hit = 2;
+    tomita_parser_set_mode(tomita, PARSER_MODE_LALR1);
+    tomita->parser->goto_layout = PARSER_GOTO_COMB;
+    errors = tomita_parser_build_cached(tomita, buffer_slice(&grammar_src), dir, &hit);
+    ok(errors == 0 && hit == 0 && tomita->parser->goto_used == PARSER_GOTO_COMB,
+       "tomita builds another parser for another goto table layout");
+    tomita_destroy(tomita);
+
+    unsigned images = 0;
+    DIR* entries = opendir(dir);
+    for (struct dirent* entry = entries ? readdir(entries) : 0; entry; entry = readdir(entries)) {
+      if (entry->d_name[0] == '.') continue;
+      char path[1024];
+      snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+      images += unlink(path) == 0;
+    }
+    if (entries) closedir(entries);
+    ok(images == 3 && rmdir(dir) == 0, "cache had %u images, and can be removed", images);
+  } while (0);
+  buffer_destroy(&grammar_src);
+}
+
+// remember the size of the forest for each input
+static void batch_size(void* ctx, unsigned index, Forest* forest, unsigned errors) {
+  unsigned long* sizes = (unsigned long*) ctx;
+  sizes[index] = errors ? 0 : forest_size(forest);
+}
+
+static void test_tomita_parse_batch(void) {
+  static const char* inputs_source[] = {
+    "2 - 3 * 4",
+    "7",
+    "2 - 3 * 4 - 5",
+    "2 - - 3",
+    "1 + 2 * ( 3 - 4 )",
+    "9 * 8 * 7 * 6 - 5",
+    "",
+    "1 - 2 - 3 - 4 - 5 - 6 - 7 - 8",
+  };
+  enum { COUNT = sizeof(inputs_source) / sizeof(inputs_source[0]) };
+  Slice inputs[COUNT];
+  unsigned errors[COUNT];
+  unsigned long sizes[COUNT];
+  unsigned long expected[COUNT];
+  Tomita* tomita = 0;
+  Buffer grammar_src; buffer_build(&grammar_src);
+  do {
+    ok(1, "=== TESTING tomita batch ===");
+
+    file_slurp(GRAMMAR_EXPR, &grammar_src);
+    tomita = tomita_create(0, 0);
+    tomita_grammar_compile_from_slice(tomita, buffer_slice(&grammar_src));
+    tomita_parser_build_from_grammar(tomita);
+
+    for (unsigned j = 0; j < COUNT; ++j) {
+      inputs[j] = slice_from_string(inputs_source[j], 0);
+    }
+
+    // parse the batches first, while some of the words are still unknown
+    unsigned symbols = tomita->symtab->symbol_counter;
+    unsigned bad[3];
+    unsigned long batch_sizes[3][COUNT];
+    unsigned batch_errors[3][COUNT];
+    for (unsigned k = 0, threads = 1; k < 3; ++k, threads *= 2) {
+      for (unsigned j = 0; j < COUNT; ++j) errors[j] = sizes[j] = 0;
+      bad[k] = tomita_parse_batch(tomita, inputs, COUNT, threads, errors, batch_size, sizes);
+      for (unsigned j = 0; j < COUNT; ++j) {
+        batch_sizes[k][j] = sizes[j];
+        batch_errors[k][j] = errors[j];
+      }
+    }
+    ok(tomita->symtab->symbol_counter == symbols, "batch leaves the symbol table alone");
+
+    unsigned failed = 0;
+    for (unsigned j = 0; j < COUNT; ++j) {
+      unsigned e = tomita_forest_parse_from_slice(tomita, inputs[j]);
+      expected[j] = e ? 0 : forest_size(tomita->forest);
+      if (e) ++failed;
+    }
+
+    for (unsigned k = 0, threads = 1; k < 3; ++k, threads *= 2) {
+      unsigned same = 0;
+      for (unsigned j = 0; j < COUNT; ++j) {
+        if (batch_sizes[k][j] == expected[j] && !batch_errors[k][j] == !!expected[j]) ++same;
+      }
+      ok(bad[k] == failed, "batch with %u threads fails on the same %u inputs", threads, failed);
+      ok(same == COUNT, "batch with %u threads gives the same forests, in input order", threads);
+    }
+  } while (0);
+  buffer_destroy(&grammar_src);
+  if (tomita) tomita_destroy(tomita);
+}
+
+// evaluate expressions in the ambiguous fixture, taking the first branch
+static ForestValue eval_token(void* ctx, struct Node* node) {
+  UNUSED(ctx);
+  ForestValue value = { .i = node->symbol->name.ptr[0] - '0' };
+  return value;
+}
+
+static ForestValue eval_rule(void* ctx, struct Node* node, RuleSet* rs,
+                             struct Node** children, ForestValue* values, unsigned count) {
+  UNUSED(ctx);
+  UNUSED(node);
+  ForestValue value = values[0];
+  if (rs && count == 3 && children[1]->symbol->name.ptr[0] == '-') value.i = values[0].i - values[2].i;
+  if (rs && count == 3 && children[1]->symbol->name.ptr[0] == '*') value.i = values[0].i * values[2].i;
+  return value;
+}
+
+// evaluate each input right after parsing it, from any thread
+static void batch_evaluate(void* ctx, unsigned index, Forest* forest, unsigned errors) {
+  long* values = (long*) ctx;
+  ForestActions actions = { eval_token, eval_rule, 0 };
+  ForestValue value = { .i = 0 };
+  values[index] = errors || forest_evaluate(forest, &actions, 0, &value) ? -1 : value.i;
+}
+
+static void test_tomita_batch_evaluate(void) {
+  static const char* inputs_source[] = {
+    "2 - 3 * 4",
+    "7",
+    "9 * 8 - 7 * 6",
+    "1 - 2 - 3 - 4 - 5 - 6 - 7 - 8",
+    "2 - - 3",
+    "4 * 4 * 4",
+  };
+  enum { COUNT = sizeof(inputs_source) / sizeof(inputs_source[0]) };
+  Slice inputs[COUNT];
+  long values[COUNT];
+  long expected[COUNT];
+  Tomita* tomita = 0;
+  Buffer grammar_src; buffer_build(&grammar_src);
+  do {
+    ok(1, "=== TESTING tomita batch evaluation ===");
+
+    file_slurp(GRAMMAR_EXPR, &grammar_src);
+    tomita = tomita_create(0, 0);
+    tomita_grammar_compile_from_slice(tomita, buffer_slice(&grammar_src));
+    tomita_parser_build_from_grammar(tomita);
+    // evaluation looks up rulesets by index; the threads must find it built
+    SymTab* symtab = tomita->symtab;
+    ok(symtab->frozen && symtab->rulesets_indexed == symtab->rules_counter, "building a parser indexes its rulesets");
+
+    for (unsigned j = 0; j < COUNT; ++j) {
+      inputs[j] = slice_from_string(inputs_source[j], 0);
+      values[j] = -2;
+    }
+    tomita_parse_batch(tomita, inputs, COUNT, 4, 0, batch_evaluate, values);
+
+    unsigned same = 0;
+    for (unsigned j = 0; j < COUNT; ++j) {
+      unsigned e = tomita_forest_parse_from_slice(tomita, inputs[j]);
+      batch_evaluate(expected, j, tomita->forest, e);
+      if (values[j] == expected[j]) ++same;
+    }
+    ok(same == COUNT, "batch with 4 threads evaluates all %u inputs as one thread does", COUNT);
+    ok(values[0] == expected[0] && expected[0] != -1 && expected[4] == -1, "batch evaluates good inputs, and skips bad ones");
+  } while (0);
+  buffer_destroy(&grammar_src);
+  if (tomita) tomita_destroy(tomita);
+}
+
 int main (int argc, char* argv[]) {
   UNUSED(argc);
   UNUSED(argv);
 
   do {
     test_tomita_build_and_parse_ok();
+    test_tomita_parse_batch();
+    test_tomita_batch_evaluate();
+    test_tomita_parser_cache();
   } while (0);
 
   done_testing();
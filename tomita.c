@@ -1,11 +1,42 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "mem.h"
 #include "log.h"
+#include "buffer.h"
+#include "util.h"
+#include "image.h"
 #include "grammar.h"
 #include "parser.h"
 #include "symtab.h"
 #include "forest.h"
 #include "tomita.h"
 
+// shared by all the threads parsing a batch
+typedef struct Batch {
+  Tomita* tomita;
+  const Slice* inputs;
+  unsigned count;
+  unsigned* errors;
+  TomitaBatchFn fn;
+  void* ctx;
+  atomic_uint next;          // next input to be parsed
+  atomic_uint failed;        // inputs that could not be parsed
+} Batch;
+
+// what each thread gets
+typedef struct BatchWorker {
+  Batch* batch;
+  Forest* forest;
+} BatchWorker;
+
+static uint64_t cache_key(Parser* parser, Slice grammar);
+static void cache_save(Parser* parser, const char* path);
+static void* batch_work(void* arg);
+static void ensure_batch(Tomita* tomita, unsigned threads);
 static void ensure_forest(Tomita* tomita);
 static void ensure_parser(Tomita* tomita);
 static void ensure_grammar(Tomita* tomita);
@@ -21,6 +52,11 @@ Tomita* tomita_create(ForestCallbacks* cb, void* ctx) {
 
 void tomita_destroy(Tomita* tomita) {
   if (!tomita) return;
+  for (unsigned j = 0; j < tomita->batch_cap; ++j) {
+    forest_destroy(tomita->batch[j]);
+  }
+  FREE(tomita->batch);
+  tomita->batch_cap = 0;
   if (tomita->forest) {
     forest_destroy(tomita->forest);
     tomita->forest = 0;
@@ -113,6 +149,33 @@ unsigned tomita_parser_show(Tomita* tomita) {
   return errors;
 }
 
+unsigned tomita_parser_report(Tomita* tomita) {
+  unsigned errors = 0;
+  do {
+    if (!tomita->grammar) {
+      LOG_DEBUG("tomita: cannot report on null grammar");
+      ++errors;
+      break;
+    }
+    errors += parser_report(tomita->grammar);
+  } while (0);
+  return errors;
+}
+
+unsigned tomita_parser_set_mode(Tomita* tomita, unsigned mode) {
+  unsigned errors = 0;
+  do {
+    if (mode >= PARSER_MODE_LAST) {
+      LOG_WARN("tomita: invalid parser mode %u", mode);
+      ++errors;
+      break;
+    }
+    ensure_parser(tomita);
+    tomita->parser->mode = mode;
+  } while (0);
+  return errors;
+}
+
 unsigned tomita_parser_build_from_grammar(Tomita* tomita) {
   unsigned errors = 0;
   do {
@@ -145,6 +208,56 @@ unsigned tomita_parser_write_to_buffer(Tomita* tomita, Buffer* b) {
   return errors;
 }
 
+unsigned tomita_parser_write_image_to_buffer(Tomita* tomita, Buffer* b) {
+  unsigned errors = 0;
+  do {
+    if (!b) {
+      ++errors;
+      break;
+    }
+    ensure_parser(tomita);
+    errors += parser_save_image(tomita->parser, b);
+  } while (0);
+  return errors;
+}
+
+unsigned tomita_parser_map_file(Tomita* tomita, const char* path) {
+  unsigned errors = 0;
+  do {
+    ensure_parser(tomita);
+    errors += parser_map_file(tomita->parser, path);
+  } while (0);
+  return errors;
+}
+
+unsigned tomita_parser_build_cached(Tomita* tomita, Slice grammar, const char* dir, unsigned* hit) {
+  unsigned errors = 0;
+  unsigned found = 0;
+  do {
+    ensure_parser(tomita);
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%016llx.img", dir, (unsigned long long) cache_key(tomita->parser, grammar));
+    if (access(path, R_OK) == 0) {
+      if (parser_map_file(tomita->parser, path) == 0) {
+        LOG_DEBUG("tomita: using cached parser [%s]", path);
+        found = 1;
+        break;
+      }
+      LOG_WARN("tomita: could not use cached parser [%s], rebuilding it", path);
+      parser_clear(tomita->parser);
+    }
+
+    errors += tomita_grammar_compile_from_slice(tomita, grammar);
+    if (errors) break;
+    errors += tomita_parser_build_from_grammar(tomita);
+    if (errors) break;
+    mkdir(dir, 0777);
+    cache_save(tomita->parser, path);
+  } while (0);
+  if (hit) *hit = found;
+  return errors;
+}
+
 unsigned tomita_forest_show(Tomita* tomita) {
   unsigned errors = 0;
   do {
@@ -166,6 +279,15 @@ unsigned tomita_show(Tomita* tomita) {
   return errors;
 }
 
+unsigned tomita_forest_set_binarised(Tomita* tomita, unsigned binarised) {
+  unsigned errors = 0;
+  do {
+    ensure_forest(tomita);
+    tomita->forest->binarised = !!binarised;
+  } while (0);
+  return errors;
+}
+
 unsigned tomita_forest_parse_from_slice(Tomita* tomita, Slice source) {
   unsigned errors = 0;
   do {
@@ -179,11 +301,134 @@ unsigned tomita_forest_parse_from_slice(Tomita* tomita, Slice source) {
   return errors;
 }
 
+unsigned tomita_parse_batch(Tomita* tomita, const Slice* inputs, unsigned count, unsigned threads,
+                            unsigned* errors, TomitaBatchFn fn, void* ctx) {
+  if (!tomita || !inputs) return count;
+  if (threads == 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cores > 0 ? cores : 1;
+  }
+  if (threads > count) threads = count;
+  if (threads == 0) return 0;
+
+  ensure_batch(tomita, threads);
+  Batch batch = {
+    .tomita = tomita,
+    .inputs = inputs,
+    .count = count,
+    .errors = errors,
+    .fn = fn,
+    .ctx = ctx,
+  };
+  atomic_init(&batch.next, 0);
+  atomic_init(&batch.failed, 0);
+
+  BatchWorker* workers = 0;
+  pthread_t* ids = 0;
+  MALLOC_N(BatchWorker, workers, threads);
+  MALLOC_N(pthread_t, ids, threads);
+  unsigned started = 0;
+  for (unsigned j = 0; j < threads; ++j) {
+    workers[j].batch = &batch;
+    workers[j].forest = tomita->batch[j];
+  }
+  // thread 0 is the calling thread, which parses along with the others
+  for (unsigned j = 1; j < threads; ++j) {
+    if (pthread_create(&ids[j], 0, batch_work, &workers[j]) != 0) {
+      LOG_WARN("tomita: could not start thread %u for batch, using %u", j, started + 1);
+      break;
+    }
+    ++started;
+  }
+  batch_work(&workers[0]);
+  for (unsigned j = 1; j <= started; ++j) {
+    pthread_join(ids[j], 0);
+  }
+  FREE(ids);
+  FREE(workers);
+  return atomic_load(&batch.failed);
+}
+
+// a 64-bit FNV-1a hash of the grammar source, mixed with everything else that
+// changes the parser built from it
+static uint64_t cache_key(Parser* parser, Slice grammar) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned j = 0; j < grammar.len; ++j) {
+    hash ^= (unsigned char) grammar.ptr[j];
+    hash *= 0x100000001b3ULL;
+  }
+  unsigned settings[] = {
+    grammar.len,
+    parser->mode,
+    parser->right_nulled,
+    parser->goto_layout,
+    PARSER_LOOKAHEAD,
+    IMAGE_VERSION,
+  };
+  for (unsigned j = 0; j < ALEN(settings); ++j) {
+    hash ^= settings[j];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// write the image for a parser into the cache; it shows up under its final
+// name only once complete, so that other runs never map half an image
+static void cache_save(Parser* parser, const char* path) {
+  Buffer image; buffer_build(&image);
+  do {
+    if (parser_save_image(parser, &image)) break;
+    char tmp[1100];
+    snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long) getpid());
+    if (file_spew(tmp, buffer_slice(&image)) != image.len || rename(tmp, path)) {
+      LOG_WARN("tomita: could not write cached parser [%s]", path);
+      unlink(tmp);
+      break;
+    }
+    LOG_DEBUG("tomita: cached parser [%s], %u bytes", path, image.len);
+  } while (0);
+  buffer_destroy(&image);
+}
+
+static void* batch_work(void* arg) {
+  BatchWorker* worker = (BatchWorker*) arg;
+  Batch* batch = worker->batch;
+  while (1) {
+    unsigned pos = atomic_fetch_add(&batch->next, 1);
+    if (pos >= batch->count) break;
+    unsigned errors = forest_parse(worker->forest, batch->inputs[pos]);
+    if (!worker->forest->root) ++errors;
+    if (errors) atomic_fetch_add(&batch->failed, 1);
+    if (batch->errors) batch->errors[pos] = errors;
+    if (batch->fn) batch->fn(batch->ctx, pos, worker->forest, errors);
+  }
+  return 0;
+}
+
+static void ensure_batch(Tomita* tomita, unsigned threads) {
+  ensure_parser(tomita);
+  unsigned binarised = tomita->forest ? tomita->forest->binarised : 0;
+  if (tomita->batch_cap < threads) {
+    REALLOC(Forest*, tomita->batch, threads);
+    for (unsigned j = tomita->batch_cap; j < threads; ++j) {
+      Forest* forest = forest_create(tomita->parser, 0, 0);
+      forest_reserve(forest, 0);
+      tomita->batch[j] = forest;
+    }
+    tomita->batch_cap = threads;
+  }
+  for (unsigned j = 0; j < tomita->batch_cap; ++j) {
+    tomita->batch[j]->binarised = binarised;
+  }
+}
+
 static void ensure_forest(Tomita* tomita) {
   if (!tomita) return;
   ensure_parser(tomita);
   if (tomita->forest) return;
   tomita->forest = forest_create(tomita->parser, tomita->cb, tomita->ctx);
+  // we parse many sentences with the same forest, keep its tables around
+  forest_reserve(tomita->forest, 0);
 }
 
 static void ensure_parser(Tomita* tomita) {
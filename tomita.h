@@ -3,6 +3,7 @@
 #include "slice.h"
 
 struct Buffer;
+struct Forest;
 struct ForestCallbacks;
 
 enum TomitaFormat {
@@ -12,6 +13,7 @@ enum TomitaFormat {
   FORMAT_SYMBOL      = 'y',
   FORMAT_RULE        = 'u',
   FORMAT_PARSER      = 'P',
+  FORMAT_OPEN        = 'o',
   FORMAT_STATE       = 'T',
   FORMAT_SHIFT       = 's',
   FORMAT_REDUCE      = 'r',
@@ -23,6 +25,7 @@ enum TomitaGrammar {
   GRAMMAR_EQ_RULE    = ':',
   GRAMMAR_EQ_TOKEN   = '=',
   GRAMMAR_START      = '@',
+  GRAMMAR_OPEN       = '%',
   GRAMMAR_OR         = '|',
   GRAMMAR_SLASH      = '/',
   GRAMMAR_LT         = '<',
@@ -37,8 +40,15 @@ typedef struct Tomita {
   struct Forest* forest;
   struct ForestCallbacks* cb;
   void* ctx;
+  struct Forest** batch;     // forests for the threads parsing batches
+  unsigned batch_cap;        //   capacity of table
 } Tomita;
 
+// Called by a thread parsing a batch, after parsing each of its inputs, with
+// the position of the input in the batch and the forest for it; the forest
+// is only valid until the function returns.
+typedef void (*TomitaBatchFn)(void* ctx, unsigned index, struct Forest* forest, unsigned errors);
+
 // Create an empty Tomita.
 Tomita* tomita_create(struct ForestCallbacks* cb, void* ctx);
 
@@ -59,10 +69,35 @@ unsigned tomita_grammar_write_to_buffer(Tomita* tomita, struct Buffer* b);
 
 // parser functions
 unsigned tomita_parser_show(Tomita* tomita);
+unsigned tomita_parser_report(Tomita* tomita);
+unsigned tomita_parser_set_mode(Tomita* tomita, unsigned mode);
 unsigned tomita_parser_build_from_grammar(Tomita* tomita);
 unsigned tomita_parser_read_from_slice(Tomita* tomita, Slice parser);
 unsigned tomita_parser_write_to_buffer(Tomita* tomita, struct Buffer* b);
+unsigned tomita_parser_write_image_to_buffer(Tomita* tomita, struct Buffer* b);
+unsigned tomita_parser_map_file(Tomita* tomita, const char* path);
+
+// Build a parser for a grammar source, keeping its binary image in a cache
+// directory (created if needed), under a hash of the source and the parser
+// mode: if the image is there, map it, without compiling the grammar or
+// building the parser; otherwise do those, and save the image for next time.
+// If hit is not null, it tells whether the cache had the image.  As with
+// tomita_grammar_compile_from_slice(), the source must outlive the parser.
+// Return number of errors found (so 0 => ok)
+unsigned tomita_parser_build_cached(Tomita* tomita, Slice grammar, const char* dir, unsigned* hit);
 
 // forest functions
 unsigned tomita_forest_show(Tomita* tomita);
+unsigned tomita_forest_set_binarised(Tomita* tomita, unsigned binarised);
 unsigned tomita_forest_parse_from_slice(Tomita* tomita, Slice source);
+
+// Parse a batch of inputs in parallel, using a given number of threads (or
+// one per core, if 0).  Each thread has its own forest, and they all share
+// the parser and its symbol table, which are left untouched; the threads
+// take the next pending input as soon as they are done with one.
+// If errors is not null, it gets the number of errors for each input, in
+// the same order as the inputs.  Forest callbacks are not used; fn, if not
+// null, is called with ctx after parsing each input -- from any thread.
+// Return number of inputs that could not be parsed.
+unsigned tomita_parse_batch(Tomita* tomita, const Slice* inputs, unsigned count, unsigned threads,
+                            unsigned* errors, TomitaBatchFn fn, void* ctx);
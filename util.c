@@ -1,5 +1,8 @@
 #include <ctype.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include "stb_sprintf.h"
 #include "log.h"
@@ -51,6 +54,34 @@ unsigned file_spew(const char* path, Slice s) {
   return len;
 }
 
+const char* file_map(const char* path, size_t* len) {
+  const char* ptr = 0;
+  *len = 0;
+  int fd = -1;
+  do {
+    fd = open(path, O_RDONLY);
+    if (fd < 0) break;
+
+    struct stat st = {0};
+    if (fstat(fd, &st)) break;
+    if (st.st_size <= 0) break;
+
+    void* map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) break;
+    ptr = (const char*) map;
+    *len = st.st_size;
+  } while (0);
+  if (fd >= 0) {
+    close(fd);
+  }
+  return ptr;
+}
+
+void file_unmap(const char* ptr, size_t len) {
+  if (!ptr) return;
+  munmap((void*) ptr, len);
+}
+
 unsigned skip_spaces(Slice line, unsigned pos) {
   while (pos < line.len && isspace(line.ptr[pos])) ++pos;
   return pos;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include "slice.h"
 
 struct Buffer;
@@ -18,6 +19,14 @@ unsigned file_slurp(const char* path, struct Buffer* b);
 // Return the number of bytes written.
 unsigned file_spew(const char* path, Slice s);
 
+// Map the contents of a file given by path into memory, read-only.
+// Return a pointer to the mapped contents, and store their length (which can
+// be larger than a slice holds); the pointer is null on errors.
+const char* file_map(const char* path, size_t* len);
+
+// Unmap the contents of a file mapped with file_map().
+void file_unmap(const char* ptr, size_t len);
+
 // Parse a slice, starting at pos, skipping white space.
 // Return the updated pos.
 unsigned skip_spaces(Slice line, unsigned pos);